@@ -28,13 +28,17 @@
 
 static acpi_header_t *acpi_map(uintptr_t addr)
 {
-  acpi_header_t *table = mmio_map(addr, sizeof(*table), VM_R);
-  if (!table)
+  acpi_header_t *header = mmio_map(addr, sizeof(*header), VM_R);
+  if (!header)
     return 0;
 
-  uint32_t len = table->len;
-  mmio_unmap(table, sizeof(*table));
-  return mmio_map(addr, len, VM_R);
+  /*
+   * map the whole table before unmapping the header, so if the table fits in
+   * the header's pages the mapping is shared rather than made twice
+   */
+  acpi_header_t *table = mmio_map(addr, header->len, VM_R);
+  mmio_unmap(header, sizeof(*header));
+  return table;
 }
 
 static void acpi_unmap(acpi_header_t *table)
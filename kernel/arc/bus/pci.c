@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/bus/pci.h>
+#include <arc/cpu/port.h>
+#include <arc/lock/spinlock.h>
+
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_CONFIG_ENABLE 0x80000000
+
+#define PCI_BUSES     256
+#define PCI_DEVICES   32
+#define PCI_FUNCTIONS 8
+
+/* the address and data ports are used as a pair, so they need a lock */
+static spinlock_t pci_lock = SPIN_UNLOCKED;
+
+static void pci_select(pci_addr_t addr, uint8_t off)
+{
+  outl(PCI_CONFIG_ADDR, PCI_CONFIG_ENABLE | (addr.bus << 16) | (addr.dev << 11) | (addr.func << 8) | (off & 0xFC));
+}
+
+uint32_t pci_read32(pci_addr_t addr, uint8_t off)
+{
+  spin_lock(&pci_lock);
+  pci_select(addr, off);
+  uint32_t value = inl(PCI_CONFIG_DATA);
+  spin_unlock(&pci_lock);
+  return value;
+}
+
+uint16_t pci_read16(pci_addr_t addr, uint8_t off)
+{
+  spin_lock(&pci_lock);
+  pci_select(addr, off);
+  uint16_t value = inw(PCI_CONFIG_DATA + (off & 0x2));
+  spin_unlock(&pci_lock);
+  return value;
+}
+
+uint8_t pci_read8(pci_addr_t addr, uint8_t off)
+{
+  spin_lock(&pci_lock);
+  pci_select(addr, off);
+  uint8_t value = inb(PCI_CONFIG_DATA + (off & 0x3));
+  spin_unlock(&pci_lock);
+  return value;
+}
+
+void pci_write32(pci_addr_t addr, uint8_t off, uint32_t value)
+{
+  spin_lock(&pci_lock);
+  pci_select(addr, off);
+  outl(PCI_CONFIG_DATA, value);
+  spin_unlock(&pci_lock);
+}
+
+void pci_write16(pci_addr_t addr, uint8_t off, uint16_t value)
+{
+  spin_lock(&pci_lock);
+  pci_select(addr, off);
+  outw(PCI_CONFIG_DATA + (off & 0x2), value);
+  spin_unlock(&pci_lock);
+}
+
+bool pci_find(uint16_t vendor, uint16_t device, pci_addr_t *addr)
+{
+  for (int bus = 0; bus < PCI_BUSES; bus++)
+  {
+    for (int dev = 0; dev < PCI_DEVICES; dev++)
+    {
+      for (int func = 0; func < PCI_FUNCTIONS; func++)
+      {
+        pci_addr_t cur = { .bus = bus, .dev = dev, .func = func };
+        uint16_t cur_vendor = pci_read16(cur, PCI_VENDOR_ID);
+        if (cur_vendor == PCI_VENDOR_NONE)
+        {
+          /* a missing function 0 means the whole device is missing */
+          if (func == 0)
+            break;
+
+          continue;
+        }
+
+        if (cur_vendor == vendor && pci_read16(cur, PCI_DEVICE_ID) == device)
+        {
+          *addr = cur;
+          return true;
+        }
+
+        /* only look at the other functions of multi-function devices */
+        if (func == 0 && !(pci_read8(cur, PCI_HEADER_TYPE) & PCI_HEADER_MULTI_FUNC))
+          break;
+      }
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_BUS_PCI_H
+#define ARC_BUS_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* offsets of the fields in the configuration space header */
+#define PCI_VENDOR_ID   0x00
+#define PCI_DEVICE_ID   0x02
+#define PCI_COMMAND     0x04
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0        0x10
+
+/* bits in the command register */
+#define PCI_COMMAND_IO     0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4
+
+/* the header type bit which indicates a device has more than one function */
+#define PCI_HEADER_MULTI_FUNC 0x80
+
+/* set in a BAR which describes a range of I/O ports rather than memory */
+#define PCI_BAR_IO      0x1
+#define PCI_BAR_IO_MASK 0xFFFFFFFC
+
+/* the vendor id read back from an empty slot */
+#define PCI_VENDOR_NONE 0xFFFF
+
+typedef struct
+{
+  uint8_t bus, dev, func;
+} pci_addr_t;
+
+/*
+ * Reads and writes a device's configuration space with configuration
+ * mechanism #1 (the 0xCF8/0xCFC I/O ports.) Offsets must be aligned to the
+ * size of the access.
+ */
+uint32_t pci_read32(pci_addr_t addr, uint8_t off);
+uint16_t pci_read16(pci_addr_t addr, uint8_t off);
+uint8_t pci_read8(pci_addr_t addr, uint8_t off);
+void pci_write32(pci_addr_t addr, uint8_t off, uint32_t value);
+void pci_write16(pci_addr_t addr, uint8_t off, uint16_t value);
+
+/*
+ * Searches every bus for the first function with the given vendor and device
+ * ids, returning false if there isn't one.
+ */
+bool pci_find(uint16_t vendor, uint16_t device, pci_addr_t *addr);
+
+#endif
@@ -15,7 +15,7 @@
  */
 
 #include <arc/cmdline.h>
-#include <arc/mm/seq.h>
+#include <arc/mm/memblock.h>
 #include <arc/util/container.h>
 #include <arc/util/list.h>
 #include <arc/panic.h>
@@ -33,7 +33,7 @@ static list_t cmdline_list = LIST_EMPTY;
 
 static void cmdline_put(const char *key, const char *value)
 {
-  cmdline_pair_t *pair = seq_alloc(sizeof(*pair));
+  cmdline_pair_t *pair = memblock_alloc(sizeof(*pair));
   if (!pair)
     panic("allocating cmdline pair failed");
 
@@ -65,7 +65,7 @@ void cmdline_init(multiboot_t *multiboot)
           panic("malformed kernel command line");
 
         size_t token_len = cmdline - token_start;
-        char *token = seq_alloc(token_len + 1);
+        char *token = memblock_alloc(token_len + 1);
         if (!token)
           panic("allocating cmdline token failed");
 
@@ -34,3 +34,25 @@ cpu_id:
 
   pop rbp
   ret
+
+[global cpu_id_sub]
+cpu_id_sub:
+  push rbp
+  mov rbp, rsp
+
+  mov r10, rdx
+  mov r11, rcx
+  mov rax, rdi
+  mov rcx, rsi
+  mov rdi, rbx
+
+  cpuid
+
+  mov dword [r10], eax
+  mov dword [r11], ebx
+  mov dword [r8], ecx
+  mov dword [r9], edx
+  mov rbx, rdi
+
+  pop rbp
+  ret
@@ -48,6 +48,7 @@
 #define CR4_PCE        0x00000100 /* enable performance counters */
 #define CR4_OSFXSR     0x00000200 /* fast fpu save */
 #define CR4_OSXMMEXCPT 0x00000400 /* unmask SSE exceptions */
+#define CR4_LA57       0x00001000 /* five-level paging */
 #define CR4_VMXE       0x00002000 /* enable VMX */
 #define CR4_RDWRGSFS   0x00010000 /* enable RDWRGSFS */
 #define CR4_OSXSAVE    0x00040000 /* enable xsave and xrestore */
@@ -26,6 +26,8 @@
 
 uint64_t features[ELEMENTS];
 
+static uint32_t cache_way_size;
+
 static void cpu_feature_set(cpu_feature_t feature)
 {
   int element = feature / BITS_PER_ELEMENT;
@@ -33,6 +35,38 @@ static void cpu_feature_set(cpu_feature_t feature)
   features[element] |= (0x1 << bit);
 }
 
+/*
+ * finds the way size of the highest level data or unified cache, using the
+ * deterministic cache parameters leaf (CPUID_CACHE_PARAMS on Intel and
+ * CPUID_EXT_CACHE_PARAMS on AMD, which share a format)
+ */
+static void cpu_cache_init(uint32_t code)
+{
+  uint32_t best_level = 0;
+  for (uint32_t i = 0; i < 32; i++)
+  {
+    uint32_t eax, ebx, ecx, edx;
+    cpu_id_sub(code, i, &eax, &ebx, &ecx, &edx);
+
+    /* a type of zero means there are no more caches */
+    uint32_t type = eax & 0x1F;
+    if (type == 0)
+      break;
+
+    /* skip instruction caches */
+    uint32_t level = (eax >> 5) & 0x7;
+    if (type == 2 || level <= best_level)
+      continue;
+
+    uint32_t line_size = (ebx & 0xFFF) + 1;
+    uint32_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+    uint32_t sets = ecx + 1;
+
+    best_level = level;
+    cache_way_size = line_size * partitions * sets;
+  }
+}
+
 void cpu_features_init(void)
 {
   /* reset all feature flags */
@@ -51,6 +85,12 @@ void cpu_features_init(void)
     if (edx & CPUID_EXT_FEATURE_EDX_1GB_PAGE)
       cpu_feature_set(FEATURE_1G_PAGE);
   }
+
+  /* detect the last level cache's geometry */
+  if (CPUID_CACHE_PARAMS <= max)
+    cpu_cache_init(CPUID_CACHE_PARAMS);
+  if (cache_way_size == 0 && CPUID_EXT_CACHE_PARAMS <= max_ext)
+    cpu_cache_init(CPUID_EXT_CACHE_PARAMS);
 }
 
 bool cpu_feature_supported(cpu_feature_t feature)
@@ -59,3 +99,8 @@ bool cpu_feature_supported(cpu_feature_t feature)
   int bit = feature % BITS_PER_ELEMENT;
   return (features[element] >> bit) & 0x1;
 }
+
+uint32_t cpu_cache_way_size(void)
+{
+  return cache_way_size;
+}
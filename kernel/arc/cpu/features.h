@@ -18,6 +18,7 @@
 #define ARC_CPU_FEATURES_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum
 {
@@ -28,4 +29,10 @@ typedef enum
 void cpu_features_init(void);
 bool cpu_feature_supported(cpu_feature_t feature);
 
+/*
+ * returns the size of one way of the last level cache (its size divided by
+ * its associativity), or zero if it is unknown
+ */
+uint32_t cpu_cache_way_size(void);
+
 #endif
@@ -15,6 +15,7 @@
  */
 
 #include <arc/cpu/idt.h>
+#include <arc/cpu/tss.h>
 #include <arc/intr/common.h>
 #include <arc/intr/stub.h>
 #include <arc/types.h>
@@ -119,6 +120,9 @@ void idt_bsp_init(void)
   idt_encode_descriptor(LVT_ERROR, &lvt_error, IDT_PRESENT | IDT_INTERRUPT);
   idt_encode_descriptor(SPURIOUS,  &spurious,  IDT_PRESENT | IDT_INTERRUPT);
 
+  /* double faults run on their own stack in case the kernel stack overflowed */
+  idt_descriptors[FAULT8].ist = TSS_IST_DOUBLE_FAULT;
+
   idtr.addr = (uint64_t) idt_descriptors;
   idtr.len = sizeof(idt_descriptors) - 1;
   idtr_install(&idtr);
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/cpu/pat.h>
+#include <arc/cpu/msr.h>
+#include <stdint.h>
+
+#define PAT_ENTRY(i, type) ((uint64_t) (type) << ((i) * 8))
+
+void pat_init(void)
+{
+  /*
+   * the power-on layout is WB, WT, UC-, UC repeated twice. we only ever use
+   * the first four entries (see PG_CACHE_MASK) and swap PWT to WC and PCD to
+   * WT. nothing maps memory with either bit set before this point, so there
+   * are no cache lines of the old types to flush.
+   */
+  uint64_t pat = PAT_ENTRY(0, PAT_WB) |
+                 PAT_ENTRY(1, PAT_WC) |
+                 PAT_ENTRY(2, PAT_WT) |
+                 PAT_ENTRY(3, PAT_UC);
+  pat |= pat << 32;
+  msr_write(MSR_PAT, pat);
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_CPU_PAT_H
+#define ARC_CPU_PAT_H
+
+/* memory types which can be stored in the PAT */
+#define PAT_UC       0x00 /* uncacheable */
+#define PAT_WC       0x01 /* write combining */
+#define PAT_WT       0x04 /* write through */
+#define PAT_WP       0x05 /* write protected */
+#define PAT_WB       0x06 /* write back */
+#define PAT_UC_MINUS 0x07 /* uncacheable, but can be overridden by the MTRRs */
+
+/* programs this CPU's PAT with the layout vm_acc_to_pg_flags() expects */
+void pat_init(void);
+
+#endif
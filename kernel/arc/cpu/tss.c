@@ -41,3 +41,22 @@ void tss_set_rsp0(uint64_t rsp0)
   /* set the stack pointer for this CPU */
   tss->rsp0 = rsp0;
 }
+
+void tss_set_ist(int ist, uint64_t rsp)
+{
+  /* find this CPU's TSS */
+  cpu_t *cpu = cpu_get();
+  tss_t *tss = &cpu->tss;
+
+  /* set the stack pointer for this IST entry */
+  switch (ist)
+  {
+    case 1: tss->ist1 = rsp; break;
+    case 2: tss->ist2 = rsp; break;
+    case 3: tss->ist3 = rsp; break;
+    case 4: tss->ist4 = rsp; break;
+    case 5: tss->ist5 = rsp; break;
+    case 6: tss->ist6 = rsp; break;
+    case 7: tss->ist7 = rsp; break;
+  }
+}
@@ -19,6 +19,9 @@
 
 #include <stdint.h>
 
+/* the interrupt stack table entry used by the double fault handler */
+#define TSS_IST_DOUBLE_FAULT 1
+
 typedef struct
 {
   uint32_t reserved0;
@@ -40,6 +43,7 @@ typedef struct
 
 void tss_init(void);
 void tss_set_rsp0(uint64_t rsp0);
+void tss_set_ist(int ist, uint64_t rsp);
 void tss_install(uint16_t selector);
 
 #endif
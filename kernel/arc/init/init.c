@@ -17,14 +17,20 @@
 #include <arc/trace.h>
 #include <arc/cmdline.h>
 #include <arc/stacktrace.h>
-#include <arc/mm/map.h>
+#include <arc/mm/memblock.h>
 #include <arc/mm/phy32.h>
 #include <arc/mm/pmm.h>
 #include <arc/mm/vmm.h>
 #include <arc/mm/heap.h>
+#include <arc/mm/malloc.h>
+#include <arc/mm/kstack.h>
 #include <arc/mm/tlb.h>
+#include <arc/mm/ksm.h>
+#include <arc/mm/reclaim.h>
+#include <arc/virtio/balloon.h>
 #include <arc/bus/isa.h>
 #include <arc/cpu/features.h>
+#include <arc/cpu/pat.h>
 #include <arc/cpu/gdt.h>
 #include <arc/cpu/tss.h>
 #include <arc/cpu/idt.h>
@@ -72,6 +78,9 @@ noreturn void init(uint32_t magic, multiboot_t *multiboot)
   /* set up the BSP's percpu structure */
   cpu_bsp_init();
 
+  /* set up the early memory allocator */
+  memblock_init(multiboot);
+
   /* parse command line arguments */
   cmdline_init(multiboot);
 
@@ -98,13 +107,16 @@ noreturn void init(uint32_t magic, multiboot_t *multiboot)
   /* scan CPU features */
   cpu_features_init();
 
+  /* set up the memory types used by the VMM */
+  pat_init();
+
   /* map physical memory */
   trace_puts("Mapping physical memory...\n");
-  list_t *map = mm_map_init(multiboot);
+  memblock_trace();
 
   /* set up the physical memory manager */
   trace_puts("Setting up the physical memory manager...\n");
-  pmm_init(map);
+  pmm_init();
 
   /* set up the virtual memory manager */
   trace_puts("Setting up the virtual memory manager...\n");
@@ -114,6 +126,16 @@ noreturn void init(uint32_t magic, multiboot_t *multiboot)
   trace_puts("Setting up the heap...\n");
   heap_init();
 
+  /* set up malloc() */
+  malloc_init();
+
+  /* switch the VGA buffer to a write combining mapping */
+  trace_remap();
+
+  /* set up kernel stacks, including the BSP's double fault stack */
+  kstack_init();
+  kstack_cpu_init();
+
   /* init ISA bus */
   isa_init();
 
@@ -158,6 +180,15 @@ noreturn void init(uint32_t magic, multiboot_t *multiboot)
   /* set up the scheduler, also needs SMP mode */
   sched_init();
 
+  /* start the same-page merging thread, which needs the scheduler */
+  ksm_init();
+
+  /* start the thread which frees memory when it runs low */
+  reclaim_init();
+
+  /* start the memory balloon driver, if we are running under a hypervisor */
+  balloon_init();
+
   /* set up modules */
   module_init(multiboot);
 
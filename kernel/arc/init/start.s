@@ -17,6 +17,8 @@
 [bits 32]
 [extern init]
 [extern _start]
+[extern _rodata]
+[extern _data]
 [extern _end]
 
 ; higher-half virtual memory address
@@ -30,22 +32,32 @@ EFER_LM equ 0x100
 EFER_NX equ 0x800
 
 ; CR0 bitmasks
+CR0_WP     equ 0x10000
 CR0_PAGING equ 0x80000000
 
 ; CR4 bitmasks
-CR4_PAE equ 0x20
-CR4_PSE equ 0x10
+CR4_PAE  equ 0x20
+CR4_PSE  equ 0x10
+CR4_PGE  equ 0x80
+CR4_LA57 equ 0x1000
+
+; CPUID leaves and bitmasks
+CPUID_VENDOR            equ 0x0
+CPUID_EXT_FLAGS         equ 0x7
+CPUID_EXT_FLAGS_ECX_LA57 equ 0x10000
 
 ; page flag bitmasks
 PG_PRESENT  equ 0x1
 PG_WRITABLE equ 0x2
 PG_USER     equ 0x4
 PG_BIG      equ 0x80
+PG_GLOBAL   equ 0x100
 PG_NO_EXEC  equ 0x8000000000000000
 
 ; page and table size constants
 LOG_TABLE_SIZE equ 9
 LOG_PAGE_SIZE  equ 12
+LOG_BIG_PAGE_SIZE equ (LOG_PAGE_SIZE + LOG_TABLE_SIZE)
 PAGE_SIZE  equ (1 << LOG_PAGE_SIZE)
 TABLE_SIZE equ (1 << LOG_TABLE_SIZE)
 
@@ -119,9 +131,12 @@ boot_pml3h:
   dq (boot_pml2 + PG_PRESENT + PG_WRITABLE)
   dq 0
 
+; maps the 2M page the kernel is loaded at, both in the lower half (for the
+; jump to the higher half) and in the higher half
 boot_pml2:
-  dq (0x0 + PG_PRESENT + PG_WRITABLE + PG_BIG)
-  times (TABLE_SIZE - 1) dq 0
+  dq 0
+  dq (0x200000 + PG_PRESENT + PG_WRITABLE + PG_BIG)
+  times (TABLE_SIZE - 2) dq 0
 
 identity_pml3:
   times (TABLE_SIZE - 5) dq 0
@@ -163,6 +178,20 @@ identity_pml2d:
     %assign pg pg+PAGE_SIZE*TABLE_SIZE
   %endrep
 
+; used instead of boot_pml4 if five-level paging is supported. the last entry
+; maps boot_pml4, so the higher half looks the same as it does with four levels
+[global boot_pml5]
+boot_pml5:
+  dq (boot_pml4 + PG_PRESENT + PG_WRITABLE)
+  times (TABLE_SIZE - 3) dq 0
+  dq (boot_pml5 + PG_PRESENT + PG_WRITABLE + PG_NO_EXEC)
+  dq (boot_pml4 + PG_PRESENT + PG_WRITABLE)
+
+; set to 1 if five-level paging is enabled, so the APs can do the same
+[global boot_la57]
+boot_la57:
+  dd 0
+
 ; the global descriptor table
 gdt:
   ; null selector
@@ -185,10 +214,29 @@ start:
   mov edi, eax
   mov esi, ebx
 
-  ; enable PAE and PSE
+  ; enable PAE, PSE and global pages
+  mov eax, cr4
+  or eax, (CR4_PAE + CR4_PSE + CR4_PGE)
+  mov cr4, eax
+
+  ; enable five-level paging if the CPU supports it, which can only be done
+  ; before long mode is activated
+  mov eax, CPUID_VENDOR
+  cpuid
+  cmp eax, CPUID_EXT_FLAGS
+  jb .no_la57
+
+  mov eax, CPUID_EXT_FLAGS
+  xor ecx, ecx
+  cpuid
+  test ecx, CPUID_EXT_FLAGS_ECX_LA57
+  jz .no_la57
+
+  mov dword [boot_la57], 1
   mov eax, cr4
-  or eax, (CR4_PAE + CR4_PSE)
+  or eax, CR4_LA57
   mov cr4, eax
+.no_la57:
 
   ; enable long mode and the NX bit
   mov ecx, MSR_EFER
@@ -196,8 +244,12 @@ start:
   or eax, (EFER_LM + EFER_NX)
   wrmsr
 
-  ; set cr3 to a pointer to pml4
+  ; set cr3 to a pointer to pml4, or pml5 with five-level paging
   mov eax, boot_pml4
+  cmp dword [boot_la57], 0
+  je .set_cr3
+  mov eax, boot_pml5
+.set_cr3:
   mov cr3, eax
 
   ; enable paging
@@ -235,22 +287,41 @@ start:
   mov rax, gdtr + KERNEL_VMA
   lgdt [rax]
 
-  ; map the rest of the kernel into virtual memory
+  ; map the rest of the kernel into virtual memory with global 2M pages. the
+  ; linker script starts the read-only data and the writable data on new 2M
+  ; pages, so each page can be given the permissions of its sections
   mov rax, _start - KERNEL_VMA      ; first page number
-  shr rax, LOG_PAGE_SIZE + LOG_TABLE_SIZE
-  mov rbx, _end - KERNEL_VMA        ; last page number
-  shr rbx, LOG_PAGE_SIZE + LOG_TABLE_SIZE
+  shr rax, LOG_BIG_PAGE_SIZE
+  mov rbx, _end - KERNEL_VMA - 1    ; last page number
+  shr rbx, LOG_BIG_PAGE_SIZE
   mov rcx, boot_pml2 + KERNEL_VMA   ; pointer into pml2 table
+  lea rcx, [rcx + rax * 8]
   .map_page:
-    ; calculate the value of the page table entry
+    ; calculate the physical and virtual addresses of the page
     mov rdx, rax
-    shl rdx, LOG_PAGE_SIZE + LOG_TABLE_SIZE
+    shl rdx, LOG_BIG_PAGE_SIZE
     mov r8, rdx
     mov r9, KERNEL_VMA
     add r8, r9
-    or rdx, PG_PRESENT + PG_WRITABLE + PG_BIG
 
+    ; text is read-only and executable
+    mov r10, PG_PRESENT + PG_BIG + PG_GLOBAL
+    mov r9, _rodata
+    cmp r8, r9
+    jb .write_page
+
+    ; read-only data is not executable
+    mov r10, PG_PRESENT + PG_BIG + PG_GLOBAL + PG_NO_EXEC
+    mov r9, _data
+    cmp r8, r9
+    jb .write_page
+
+    ; and data and bss are writable
+    or r10, PG_WRITABLE
+
+  .write_page:
     ; write the page table entry
+    or rdx, r10
     mov [rcx], rdx
     invlpg [r8]
 
@@ -271,11 +342,21 @@ start:
   mov rbp, 0 ; terminate stack traces here
   mov rsp, qword stack + STACK_SIZE
 
-  ; unmap the identity-mapped memory
+  ; unmap the identity-mapped memory, the write to boot_pml5 goes through the
+  ; higher half as the identity mapping is gone by then
   mov qword [boot_pml4], 0x0
+  mov rax, boot_pml5 + KERNEL_VMA
+  mov qword [rax], 0x0
 
   ; invalidate the TLB cache for the identity-mapped memory
-  invlpg [0x0]
+  mov rax, _start - KERNEL_VMA
+  invlpg [rax]
+
+  ; these were the last writes to the kernel's read-only pages, so now enforce
+  ; read-only pages in ring 0 too
+  mov rax, cr0
+  or rax, CR0_WP
+  mov cr0, rax
 
   ; clear the RFLAGS register
   push 0x0
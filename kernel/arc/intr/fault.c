@@ -17,8 +17,15 @@
 #include <arc/intr/fault.h>
 #include <arc/intr/common.h>
 #include <arc/intr/route.h>
+#include <arc/cpu/cr.h>
+#include <arc/mm/seg.h>
 #include <arc/panic.h>
 
+/* page fault error code bits */
+#define PF_PRESENT 0x01
+#define PF_WRITE   0x02
+#define PF_FETCH   0x10
+
 static const char *fault_names[] = {
   "Divide by Zero Error",
   "Debug",
@@ -69,6 +76,19 @@ void fault_init(void)
 
 void fault_handle(cpu_state_t *state)
 {
+  /*
+   * page faults on non-present pages may just need a frame allocating, and
+   * writes to present pages may be to a merged page which needs copying
+   * (this includes writes by the kernel, as CR0.WP is set)
+   */
+  if (state->id == FAULT14 && (!(state->error & PF_PRESENT) || (state->error & PF_WRITE)))
+  {
+    bool write = state->error & PF_WRITE;
+    bool exec = state->error & PF_FETCH;
+    if (seg_fault(cr2_read(), write, exec))
+      return;
+  }
+
   const char *name = fault_names[state->id];
   spanic("Fault: %s (num=%d, error=%0#18x)", state, name, state->id, state->error, state->rip);
 }
@@ -18,8 +18,8 @@
 #include <arc/intr/common.h>
 #include <arc/lock/barrier.h>
 #include <arc/mm/mmio.h>
+#include <arc/mm/slab.h>
 #include <arc/types.h>
-#include <stdlib.h>
 
 #define IOAPIC_ID     0x00
 #define IOAPIC_VER    0x01
@@ -43,6 +43,7 @@
 #define REDTBL_DELMOD_EXTINT    0x0000000000000700
 
 list_t ioapic_list = LIST_EMPTY;
+static kmem_cache_t ioapic_cache = KMEM_CACHE("ioapic", sizeof(ioapic_t), _Alignof(ioapic_t), 0);
 
 static uint32_t ioapic_read(ioapic_t *apic, uint32_t reg)
 {
@@ -60,14 +61,14 @@ static void ioapic_write(ioapic_t *apic, uint32_t reg, uint32_t val)
 
 bool ioapic_init(ioapic_id_t id, uintptr_t addr, irq_t irq_base)
 {
-  ioapic_t *apic = malloc(sizeof(*apic));
+  ioapic_t *apic = kmem_cache_alloc(&ioapic_cache);
   if (!apic)
     return false;
 
-  uintptr_t virt_addr = (uintptr_t) mmio_map(addr, 32, VM_R | VM_W);
+  uintptr_t virt_addr = (uintptr_t) mmio_map(addr, 32, VM_R | VM_W | VM_UC);
   if (!virt_addr)
   {
-    free(apic);
+    kmem_cache_free(&ioapic_cache, apic);
     return false;
   }
 
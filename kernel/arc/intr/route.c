@@ -19,12 +19,12 @@
 #include <arc/intr/ioapic.h>
 #include <arc/intr/pic.h>
 #include <arc/lock/rwlock.h>
+#include <arc/mm/slab.h>
 #include <arc/smp/mode.h>
 #include <arc/util/container.h>
 #include <arc/util/list.h>
 #include <arc/panic.h>
 #include <assert.h>
-#include <stdlib.h>
 
 typedef struct intr_handler_node
 {
@@ -32,6 +32,7 @@ typedef struct intr_handler_node
   list_node_t node;
 } intr_handler_pair_t;
 
+static kmem_cache_t intr_handler_cache = KMEM_CACHE("intr_handler", sizeof(intr_handler_pair_t), _Alignof(intr_handler_pair_t), 0);
 static rwlock_t intr_route_lock = RWLOCK_UNLOCKED;
 static list_t intr_handlers[INTERRUPTS];
 
@@ -70,7 +71,7 @@ void intr_dispatch(cpu_state_t *state)
 static bool _intr_route_intr(intr_t intr, intr_handler_t handler)
 {
   /* allocate the handler pair */
-  intr_handler_pair_t *pair = malloc(sizeof(*pair));
+  intr_handler_pair_t *pair = kmem_cache_alloc(&intr_handler_cache);
   if (!pair)
     return false;
 
@@ -94,7 +95,7 @@ static void _intr_unroute_intr(intr_t intr, intr_handler_t handler)
       list_remove(&intr_handlers[intr], &pair->node);
 
       /* free it */
-      free(pair);
+      kmem_cache_free(&intr_handler_cache, pair);
       return;
     }
   }
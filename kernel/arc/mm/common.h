@@ -20,6 +20,9 @@
 /* user-space virtual memory end address (inclusive) */
 #define VM_USER_END 0x00007FFFFFFFFFFF
 
+/* the same, with five-level paging - see vmm_user_end() */
+#define VM_USER_END_LA57 0x00FFFFFFFFFFFFFF
+
 /* virtual memory offset of the higher half */
 #define VM_HIGHER_HALF 0xFFFF800000000000
 
@@ -35,6 +38,7 @@
 #define FRAME_SIZE_1G (512 * FRAME_SIZE_2M)
 /* 512G pages don't exist (yet) but this is useful for the vmm anyway */
 #define FRAME_SIZE_512G (512L * FRAME_SIZE_1G)
+#define FRAME_SIZE_256T (512L * FRAME_SIZE_512G)
 
 /* page size types */
 #define SIZE_4K    0
@@ -45,17 +49,52 @@
 /* memory access flags */
 typedef enum
 {
-  VM_R = 0x1, /* readable (on x86 it is not possible to deny read access) */
+  VM_R = 0x1, /* readable (on x86 lack of this flag makes the page not present) */
   VM_W = 0x2, /* writable */
-  VM_X = 0x4  /* executable (on x86 lack of this flag sets the NX bit) */
+  VM_X = 0x4, /* executable (on x86 lack of this flag sets the NX bit) */
+
+  /*
+   * memory types, for mappings of device memory (at most one may be given,
+   * the default is write back)
+   */
+  VM_UC = 0x8,  /* uncacheable, for device registers */
+  VM_WC = 0x10, /* write combining, for framebuffers and device buffers */
+  VM_WT = 0x20  /* write through */
 } vm_acc_t;
 
 /* page table flags */
 #define PG_PRESENT   0x1
 #define PG_WRITABLE  0x2
 #define PG_USER      0x4
+#define PG_PWT       0x8
+#define PG_PCD       0x10
+#define PG_ACCESSED  0x20
+#define PG_DIRTY     0x40
 #define PG_BIG       0x80
+#define PG_SWAP      0x200 /* available to software, see below */
+#define PG_SHARED    0x400 /* available to software, marks a merged page */
+#define PG_DENIED    0x800 /* available to software, see below */
 #define PG_NO_EXEC   0x8000000000000000
 #define PG_ADDR_MASK 0xFFFFFFFFFF000
 
+/*
+ * a 4K entry without PG_PRESENT but with PG_SWAP set is a swap entry: the
+ * page's contents are held by the swap code, in the slot stored in the
+ * address bits. an entry of any size without PG_PRESENT but with PG_DENIED
+ * set still owns its frame, but all access to the page has been taken away
+ * (x86 can't deny read access to a present page, so it is made not present)
+ */
+#define PG_SWAP_SHIFT 12
+
+/*
+ * the PWT and PCD bits select the memory type through the PAT, which
+ * pat_init() programs as WB (neither), WC (PWT), WT (PCD) and UC (both). the
+ * PAT bit itself is never set, as in 2M and 1G entries it overlaps the bottom
+ * address bit in PG_ADDR_MASK.
+ */
+#define PG_CACHE_MASK (PG_PWT | PG_PCD)
+#define PG_CACHE_WC   PG_PWT
+#define PG_CACHE_WT   PG_PCD
+#define PG_CACHE_UC   (PG_PCD | PG_PWT)
+
 #endif
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/mm/compact.h>
+#include <arc/mm/common.h>
+#include <arc/mm/heap.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/pmm.h>
+#include <arc/mm/reclaim.h>
+#include <arc/mm/vmm.h>
+#include <arc/proc/proc.h>
+#include <arc/lock/intr.h>
+#include <arc/lock/spinlock.h>
+#include <arc/cpu/cr.h>
+#include <arc/smp/cpu.h>
+#include <arc/util/container.h>
+#include <arc/trace.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* the most pages one compaction moves, regions needing more are left alone */
+#define COMPACT_MAX_PAGES 1024
+
+/* the number of pages moved before interrupts are unmasked again */
+#define COMPACT_BATCH 32
+
+/* the number of free and movable 4K frames in each region */
+typedef struct
+{
+  uint32_t free, movable;
+} compact_count_t;
+
+/* a user page which needs to be moved out of the region */
+typedef struct
+{
+  uintptr_t virt, frame;
+} compact_page_t;
+
+typedef struct
+{
+  /* the size and alignment of the regions */
+  size_t region_len;
+  size_t region_frames;
+
+  /* used while choosing a region */
+  compact_count_t *counts;
+  size_t regions;
+
+  /* used while emptying the chosen region */
+  uintptr_t start;
+  uint64_t *owned; /* a bit for each 4K frame in the region we have claimed */
+  compact_page_t *pages;
+  size_t page_count, page_capacity;
+
+  /* the address space to go back to after working in a process's */
+  proc_t *old_proc;
+  uintptr_t old_pml4_table;
+} compact_t;
+
+typedef void (*compact_func_t)(compact_t *c, proc_t *proc);
+
+/*
+ * only the reclaim thread compacts memory, so there is no need for a lock to
+ * stop two compactions running at once
+ */
+
+/* a bit for each size of frame which has been asked for */
+static int compact_pending;
+
+static bool compact_in_region(compact_t *c, uintptr_t addr)
+{
+  return addr >= c->start && addr < c->start + c->region_len;
+}
+
+static void compact_own(compact_t *c, uintptr_t addr, size_t len)
+{
+  for (size_t off = 0; off < len; off += FRAME_SIZE)
+  {
+    size_t bit = (addr + off - c->start) / FRAME_SIZE;
+    c->owned[bit / 64] |= 1UL << (bit % 64);
+  }
+}
+
+static bool compact_count_free(uintptr_t addr, int size, void *arg)
+{
+  compact_t *c = arg;
+
+  size_t region = addr / c->region_len;
+  if (region < c->regions)
+    c->counts[region].free += (size == SIZE_2M) ? (FRAME_SIZE_2M / FRAME_SIZE) : 1;
+
+  return false;
+}
+
+static void compact_count_movable(uintptr_t virt, uintptr_t frame, int size, void *arg)
+{
+  compact_t *c = arg;
+
+  /* only 4K pages are moved, larger pages pin their region */
+  size_t region = frame / c->region_len;
+  if (size == SIZE_4K && region < c->regions)
+    c->counts[region].movable++;
+}
+
+static bool compact_claim_free(uintptr_t addr, int size, void *arg)
+{
+  compact_t *c = arg;
+  if (!compact_in_region(c, addr))
+    return false;
+
+  compact_own(c, addr, (size == SIZE_2M) ? FRAME_SIZE_2M : FRAME_SIZE);
+  return true;
+}
+
+static void compact_find_pages(uintptr_t virt, uintptr_t frame, int size, void *arg)
+{
+  compact_t *c = arg;
+  if (size != SIZE_4K || !compact_in_region(c, frame))
+    return;
+
+  /* if more pages have appeared since counting, the region won't be freed */
+  if (c->page_count < c->page_capacity)
+  {
+    compact_page_t *page = &c->pages[c->page_count++];
+    page->virt = virt;
+    page->frame = frame;
+  }
+}
+
+/*
+ * switches to a process's address space. interrupts are masked until
+ * compact_leave(), as the scheduler would switch back to our own address space
+ * if it preempted us
+ */
+static void compact_enter(compact_t *c, proc_t *proc)
+{
+  intr_lock();
+
+  cpu_t *cpu = cpu_get();
+  c->old_proc = cpu->proc;
+  c->old_pml4_table = cr3_read();
+  proc_switch(proc);
+}
+
+static void compact_leave(compact_t *c)
+{
+  cpu_t *cpu = cpu_get();
+  cpu->proc = c->old_proc;
+  cr3_write(c->old_pml4_table);
+
+  intr_unlock();
+}
+
+/* pins the first live process from node onwards, with proc_list_lock held */
+static proc_t *compact_pin(list_node_t *node)
+{
+  for (; node; node = node->next)
+  {
+    proc_t *proc = container_of(node, proc_t, node);
+    if (proc->state != PROC_DEAD)
+    {
+      proc_retain(proc);
+      return proc;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * calls func for every process. each one is pinned while func runs, so
+ * proc_list_lock is only held to move from one process to the next
+ */
+static void compact_walk(compact_func_t func, compact_t *c)
+{
+  spin_lock(&proc_list_lock);
+  proc_t *proc = compact_pin(proc_list.head);
+  spin_unlock(&proc_list_lock);
+
+  while (proc)
+  {
+    func(c, proc);
+
+    /* pin the next process before letting go of this one, so it stays in the list */
+    spin_lock(&proc_list_lock);
+    proc_t *next = compact_pin(proc->node.next);
+    spin_unlock(&proc_list_lock);
+
+    proc_release(proc);
+    proc = next;
+  }
+}
+
+static void compact_count_proc(compact_t *c, proc_t *proc)
+{
+  compact_enter(c, proc);
+  vmm_scan_user(&compact_count_movable, c);
+  compact_leave(c);
+}
+
+/* copies a user page out of the region, in the current address space */
+static void compact_migrate(compact_t *c, compact_page_t *page)
+{
+  /* find a frame outside the region, any we get inside it are ours anyway */
+  uintptr_t new_frame;
+  for (;;)
+  {
+    /* keep the page's colour, so migrating it doesn't change its cache sets */
+    new_frame = pmm_alloc_colour(page->frame / FRAME_SIZE);
+    if (!new_frame)
+      return;
+
+    if (!compact_in_region(c, new_frame))
+      break;
+
+    compact_own(c, new_frame, FRAME_SIZE);
+  }
+
+  /* map the new frame so the page can be copied into it */
+  void *ptr = mmio_map_frame(new_frame);
+  if (!ptr)
+  {
+    pmm_free(new_frame);
+    return;
+  }
+
+  bool ok = vmm_migrate(page->virt, page->frame, new_frame, ptr);
+  mmio_unmap_frame(new_frame, ptr);
+
+  if (ok)
+    compact_own(c, page->frame, FRAME_SIZE);
+  else
+    pmm_free(new_frame);
+}
+
+/* moves a process's user pages out of the region */
+static void compact_evacuate_proc(compact_t *c, proc_t *proc)
+{
+  compact_enter(c, proc);
+
+  c->page_count = 0;
+  vmm_scan_user(&compact_find_pages, c);
+
+  for (size_t i = 0; i < c->page_count; i++)
+  {
+    /* let interrupts in between batches, each copy and shootdown is slow */
+    if (i > 0 && (i % COMPACT_BATCH) == 0)
+    {
+      compact_leave(c);
+      compact_enter(c, proc);
+    }
+
+    compact_migrate(c, &c->pages[i]);
+  }
+
+  compact_leave(c);
+}
+
+/* picks the region which needs the fewest pages moving, or returns false */
+static bool compact_choose(compact_t *c)
+{
+  bool found = false;
+  uint32_t best_free = 0;
+
+  for (size_t i = 0; i < c->regions; i++)
+  {
+    compact_count_t *count = &c->counts[i];
+    if (count->free + count->movable != c->region_frames || count->movable > COMPACT_MAX_PAGES)
+      continue;
+
+    if (!found || count->free > best_free)
+    {
+      found = true;
+      best_free = count->free;
+      c->start = i * c->region_len;
+      c->page_capacity = count->movable;
+    }
+  }
+
+  return found;
+}
+
+static uintptr_t _compact(compact_t *c)
+{
+  /* count the free and movable frames in each region */
+  c->regions = pmm_end() / c->region_len;
+  if (c->regions == 0)
+    return 0;
+
+  size_t counts_len = c->regions * sizeof(*c->counts);
+  c->counts = heap_alloc(counts_len, VM_R | VM_W);
+  if (!c->counts)
+    return 0;
+
+  memclr(c->counts, counts_len);
+  compact_walk(&compact_count_proc, c);
+  pmm_filter(&compact_count_free, c);
+
+  bool found = compact_choose(c);
+  heap_free(c->counts);
+  if (!found)
+    return 0;
+
+  /* allocate the bitmap of frames we own and the list of pages to move */
+  size_t owned_len = c->region_frames / 8;
+  c->owned = heap_alloc(owned_len, VM_R | VM_W);
+  if (!c->owned)
+    return 0;
+
+  memclr(c->owned, owned_len);
+
+  if (c->page_capacity > 0)
+  {
+    c->pages = heap_alloc(c->page_capacity * sizeof(*c->pages), VM_R | VM_W);
+    if (!c->pages)
+    {
+      heap_free(c->owned);
+      return 0;
+    }
+  }
+
+  /* take the free frames in the region, then move the user pages out */
+  pmm_filter(&compact_claim_free, c);
+  if (c->page_capacity > 0)
+  {
+    compact_walk(&compact_evacuate_proc, c);
+    heap_free(c->pages);
+  }
+
+  /* check nothing else was allocated from the region while we were working */
+  bool complete = true;
+  for (size_t i = 0; i < c->region_frames / 64; i++)
+  {
+    if (c->owned[i] != ~0UL)
+    {
+      complete = false;
+      break;
+    }
+  }
+
+  /* if it was, give back what we did manage to claim */
+  if (!complete)
+  {
+    for (size_t i = 0; i < c->region_frames; i++)
+    {
+      if (c->owned[i / 64] & (1UL << (i % 64)))
+        pmm_free(c->start + i * FRAME_SIZE);
+    }
+  }
+
+  heap_free(c->owned);
+  return complete ? c->start : 0;
+}
+
+static uintptr_t compact(int size)
+{
+  compact_t c;
+  c.region_len = (size == SIZE_2M) ? FRAME_SIZE_2M : FRAME_SIZE_1G;
+  c.region_frames = c.region_len / FRAME_SIZE;
+  return _compact(&c);
+}
+
+void compact_request(int size)
+{
+  if (size != SIZE_2M && size != SIZE_1G)
+    return;
+
+  __sync_fetch_and_or(&compact_pending, 1 << size);
+  reclaim_wake();
+}
+
+void compact_run(void)
+{
+  int pending = __sync_lock_test_and_set(&compact_pending, 0);
+
+  for (int size = SIZE_1G; size >= SIZE_2M; size--)
+  {
+    if (!(pending & (1 << size)))
+      continue;
+
+    uintptr_t frame = compact(size);
+    if (frame)
+    {
+      trace_printf("compact: assembled a %s frame\n", size == SIZE_1G ? "1G" : "2M");
+      pmm_frees(size, frame);
+    }
+  }
+}
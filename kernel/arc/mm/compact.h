@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_MM_COMPACT_H
+#define ARC_MM_COMPACT_H
+
+#include <stdint.h>
+
+/*
+ * Asks for a free 2M or 1G frame (depending on 'size') to be assembled, after
+ * an explicit huge page request found none left. Compaction picks an aligned
+ * region of physical memory made up only of free frames and 4K user pages,
+ * migrates the user pages elsewhere and gives the whole region back to the
+ * PMM, which tops up its huge page pool with it.
+ *
+ * Compacting takes proc_list_lock and shoots down TLB entries, so it can't be
+ * done from the fault or mmap paths. Instead this wakes the reclaim thread,
+ * which calls compact_run(). Each run tries one region of each size asked for,
+ * skipping regions which would need too many pages moving.
+ */
+void compact_request(int size);
+void compact_run(void);
+
+#endif
@@ -18,16 +18,24 @@
 #include <arc/lock/spinlock.h>
 #include <arc/mm/pmm.h>
 #include <arc/mm/vmm.h>
+#include <arc/mm/mmio.h>
 #include <arc/mm/align.h>
 #include <arc/mm/range.h>
+#include <arc/util/container.h>
+#include <arc/util/tree.h>
 #include <arc/panic.h>
 #include <arc/trace.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
 
-/* a magic id used to check if requests are valid */
-#define HEAP_MAGIC 0x461E7B705515DB7F
+/* the node pool lives at the start of the higher half (inclusive) */
+#define HEAP_POOL_START VM_HIGHER_HALF
+#define HEAP_POOL_END   (VM_HIGHER_HALF + FRAME_SIZE_1G - 1)
+
+/* the heap itself takes the space from the MMIO region up to the pmm stacks */
+#define HEAP_START (VM_MMIO_END + 1)
+#define HEAP_END   (VM_STACK_OFFSET - 1)
 
 /* the states a heap node can be in */
 typedef enum
@@ -39,114 +47,193 @@ typedef enum
 
 typedef struct heap_node
 {
-  struct heap_node *next;
-  struct heap_node *prev;
+  union
+  {
+    tree_node_t addr_node;       /* used by heap_addr_tree */
+    struct heap_node *pool_next; /* used by the node pool's free list */
+  };
+  tree_node_t free_node; /* used by heap_free_tree when the node is free */
   heap_state_t state;
   vm_acc_t flags;
   uintptr_t start; /* the address of the first byte, inclusive */
   uintptr_t end;   /* the address of the last byte, inclusive */
-  uint64_t magic;
 } heap_node_t;
 
-static heap_node_t *heap_root;
+static int heap_addr_compare(const void *left, const void *right);
+static int heap_free_compare(const void *left, const void *right);
+
+/* every node, ordered by address */
+static tree_t heap_addr_tree = TREE_EMPTY(&heap_addr_compare);
+
+/* free nodes, ordered by size and then by address */
+static tree_t heap_free_tree = TREE_EMPTY(&heap_free_compare);
+
+/*
+ * the node pool: heap_node_t structures are kept out of line in their own
+ * region of virtual memory, which is mapped a page at a time as it grows, so
+ * the heap itself only ever contains the pages that were asked for
+ */
+static heap_node_t *heap_pool_free;
+static uintptr_t heap_pool_end = HEAP_POOL_START;
+
 static spinlock_t heap_lock = SPIN_UNLOCKED;
 
-void heap_init(void)
+static int heap_addr_compare(const void *left, const void *right)
+{
+  heap_node_t *left_node = container_of(left, heap_node_t, addr_node);
+  heap_node_t *right_node = container_of(right, heap_node_t, addr_node);
+
+  if (left_node->start < right_node->start)
+    return -1;
+  else if (left_node->start > right_node->start)
+    return 1;
+
+  return 0;
+}
+
+static int heap_free_compare(const void *left, const void *right)
 {
-  /* hard coded start of the heap (inclusive) */
-  uintptr_t heap_start = VM_HIGHER_HALF;
+  heap_node_t *left_node = container_of(left, heap_node_t, free_node);
+  heap_node_t *right_node = container_of(right, heap_node_t, free_node);
+
+  size_t left_size = left_node->end - left_node->start;
+  size_t right_size = right_node->end - right_node->start;
 
-  /* hard coded end of the heap (inclusive) */
-  uintptr_t heap_end = VM_STACK_OFFSET - 1;
+  if (left_size < right_size)
+    return -1;
+  else if (left_size > right_size)
+    return 1;
 
-  /* allocate some space for the root node */
-  uintptr_t root_phy = pmm_alloc();
-  if (!root_phy)
-    panic("couldn't allocate physical frame for heap root node");
+  if (left_node->start < right_node->start)
+    return -1;
+  else if (left_node->start > right_node->start)
+    return 1;
+
+  return 0;
+}
+
+static heap_node_t *node_alloc(void)
+{
+  if (!heap_pool_free)
+  {
+    /* check if the pool has room to grow */
+    if (heap_pool_end > HEAP_POOL_END - FRAME_SIZE + 1)
+      return 0;
+
+    /* map another page into the pool */
+    uintptr_t phy = pmm_alloc();
+    if (!phy)
+      return 0;
+
+    if (!vmm_map(heap_pool_end, phy, VM_R | VM_W))
+    {
+      pmm_free(phy);
+      return 0;
+    }
+
+    /* carve the page up into nodes and put them on the free list */
+    heap_node_t *nodes = (heap_node_t *) heap_pool_end;
+    for (size_t i = 0; i < FRAME_SIZE / sizeof(*nodes); i++)
+    {
+      nodes[i].pool_next = heap_pool_free;
+      heap_pool_free = &nodes[i];
+    }
+
+    heap_pool_end += FRAME_SIZE;
+  }
 
+  heap_node_t *node = heap_pool_free;
+  heap_pool_free = node->pool_next;
+  return node;
+}
+
+static void node_free(heap_node_t *node)
+{
+  node->pool_next = heap_pool_free;
+  heap_pool_free = node;
+}
+
+void heap_init(void)
+{
   /* sanity check which probably seems completely ridiculous */
-  if ((heap_start + FRAME_SIZE) >= heap_end)
+  if (HEAP_START >= HEAP_END)
     panic("no room for heap");
 
-  /* the root node will take the first virtual address */
-  heap_root = (heap_node_t *) heap_start;
-  if (!vmm_map(heap_start, root_phy, VM_R | VM_W))
-    panic("couldn't map heap root node into the virtual memory");
+  /* allocate the root node, which covers the whole heap */
+  heap_node_t *root = node_alloc();
+  if (!root)
+    panic("couldn't allocate heap root node");
 
   /* fill out the root node */
-  heap_root->next = 0;
-  heap_root->prev = 0;
-  heap_root->state = HEAP_FREE;
-  heap_root->start = heap_start + FRAME_SIZE;
-  heap_root->end = heap_end;
-  heap_root->magic = heap_root->start ^ HEAP_MAGIC;
+  root->state = HEAP_FREE;
+  root->start = HEAP_START;
+  root->end = HEAP_END;
+
+  tree_insert(&heap_addr_tree, &root->addr_node);
+  tree_insert(&heap_free_tree, &root->free_node);
 }
 
 static heap_node_t *find_node(size_t size)
 {
-  /* look for the first node that will fit the requested size */
-  for (heap_node_t *node = heap_root; node; node = node->next)
+  /* look for the smallest free node that will fit the requested size */
+  heap_node_t key;
+  key.start = 0;
+  key.end = size - 1;
+
+  tree_node_t *free_node = tree_ceil(&heap_free_tree, &key.free_node);
+  if (!free_node)
+    return 0;
+
+  heap_node_t *node = container_of(free_node, heap_node_t, free_node);
+  tree_remove(&heap_free_tree, &node->free_node);
+
+  /* split the node if it is bigger than required */
+  size_t node_size = node->end - node->start + 1;
+  if (node_size != size)
   {
-    /* skip free nodes */
-    if (node->state != HEAP_FREE)
-      continue;
-
-    /* skip nodes that are too small */
-    size_t node_size = node->end - node->start + 1;
-    if (node_size < size)
-      continue;
-
-    /* check if splitting the node would actually leave some space */
-    size_t extra_size = node_size - size;
-    if (extra_size >= (FRAME_SIZE * 2))
+    /* only split the node if we can allocate another one */
+    heap_node_t *next = node_alloc();
+    if (next)
     {
-      /* only split the node if we can allocate a physical page */
-      uintptr_t phy = pmm_alloc();
-      if (phy)
-      {
-        /* map the new heap_node_t into virtual memory, only split if it works */
-        heap_node_t *next = (heap_node_t *) ((uintptr_t) node + size + FRAME_SIZE);
-        if (vmm_map((uintptr_t) next, phy, VM_R | VM_W))
-        {
-          /* fill in the new heap_node_t */
-          next->start = (uintptr_t) node + size + FRAME_SIZE * 2;
-          next->end = node->end;
-          next->state = HEAP_FREE;
-          next->prev = node;
-          next->next = node->next;
-          next->magic = next->start ^ HEAP_MAGIC;
-
-          /* update the node that was split */
-          node->end = (uintptr_t) next - 1;
-
-          /* update the surrounding nodes */
-          node->next = next;
-          if (next->next)
-            next->next->prev = next;
-        }
-        else
-        {
-          /* free the unused physical frame */
-          pmm_free(phy);
-        }
-      }
-    }
+      /* fill in the new heap_node_t */
+      next->start = node->start + size;
+      next->end = node->end;
+      next->state = HEAP_FREE;
 
-    /* update the state of the allocated node */
-    node->state = HEAP_RESERVED;
-    return node;
+      /* update the node that was split */
+      node->end = next->start - 1;
+
+      /* the remainder of the node is now free */
+      tree_insert(&heap_addr_tree, &next->addr_node);
+      tree_insert(&heap_free_tree, &next->free_node);
+    }
   }
 
-  return 0;
+  /* update the state of the allocated node */
+  node->state = HEAP_RESERVED;
+  return node;
 }
 
-static void _heap_free(void *ptr)
+/* finds the allocated node which starts at this address */
+static heap_node_t *get_node(void *ptr)
 {
-  /* find where the node is */
-  heap_node_t *node = (heap_node_t *) ((uintptr_t) ptr - FRAME_SIZE);
+  heap_node_t key;
+  key.start = (uintptr_t) ptr;
+
+  tree_node_t *addr_node = tree_find(&heap_addr_tree, &key.addr_node);
+  if (!addr_node)
+    return 0;
+
+  heap_node_t *node = container_of(addr_node, heap_node_t, addr_node);
+  assert(node->state != HEAP_FREE);
+  return node;
+}
 
-  /* check if the magic matches to see if we get passed a dodgy pointer */
-  assert(node->magic == (node->start ^ HEAP_MAGIC));
+static void _heap_free(void *ptr)
+{
+  heap_node_t *node = get_node(ptr);
+  if (!node)
+    panic("heap_free() called with invalid pointer %0#18x", ptr);
 
   /* free the physical frames if heap_alloc allocated them */
   size_t size = node->end - node->start + 1;
@@ -157,36 +244,42 @@ static void _heap_free(void *ptr)
   node->state = HEAP_FREE;
 
   /* try to coalesce with the next node */
-  heap_node_t *next = node->next;
-  if (next && next->state == HEAP_FREE)
+  tree_node_t *next_node = tree_next(&node->addr_node);
+  if (next_node)
   {
-    /* update the pointers */
-    node->next = next->next;
-    if (next->next)
-      next->next->prev = node;
-
-    /* update the address range */
-    node->end = next->end;
+    heap_node_t *next = container_of(next_node, heap_node_t, addr_node);
+    if (next->state == HEAP_FREE)
+    {
+      /* absorb the next node's address range */
+      node->end = next->end;
 
-    /* unmap and free the physical frame behind the next node */
-    pmm_free(vmm_unmap((uintptr_t) next));
+      tree_remove(&heap_free_tree, &next->free_node);
+      tree_remove(&heap_addr_tree, &next->addr_node);
+      node_free(next);
+    }
   }
 
   /* try to coalesce with the previous node */
-  heap_node_t *prev = node->prev;
-  if (prev && prev->state == HEAP_FREE)
+  tree_node_t *prev_node = tree_prev(&node->addr_node);
+  if (prev_node)
   {
-    /* update the pointers */
-    prev->next = node->next;
-    if (node->next)
-      node->next->prev = prev;
+    heap_node_t *prev = container_of(prev_node, heap_node_t, addr_node);
+    if (prev->state == HEAP_FREE)
+    {
+      /* the previous node is resized, so remove it from the free tree */
+      tree_remove(&heap_free_tree, &prev->free_node);
 
-    /* update the address range */
-    prev->end = node->end;
+      /* absorb this node's address range */
+      prev->end = node->end;
 
-    /* unmap and free the physical frame behind the next node */
-    pmm_free(vmm_unmap((uintptr_t) next));
+      tree_remove(&heap_addr_tree, &node->addr_node);
+      node_free(node);
+      node = prev;
+    }
   }
+
+  /* add the (possibly coalesced) node to the free tree */
+  tree_insert(&heap_free_tree, &node->free_node);
 }
 
 static void *_heap_alloc(size_t size, vm_acc_t flags, bool phy_alloc)
@@ -207,10 +300,171 @@ static void *_heap_alloc(size_t size, vm_acc_t flags, bool phy_alloc)
 
     /* allocate physical frames and map them into memory */
     if (!range_alloc(node->start, size, flags))
+    {
+      /* range_alloc() cleans up after itself, so just release the node */
+      node->state = HEAP_RESERVED;
       _heap_free((void *) node->start);
+      return 0;
+    }
   }
 
-  return (void *) ((uintptr_t) node + FRAME_SIZE);
+  return (void *) node->start;
+}
+
+static bool heap_shrink(heap_node_t *node, size_t size)
+{
+  uintptr_t cut = node->start + size;
+
+  /* don't release part of a large page, keep the whole page instead */
+  if (node->state == HEAP_ALLOCATED)
+  {
+    int page_size = vmm_size(cut);
+    if (page_size == SIZE_2M)
+      cut = PAGE_ALIGN_2M(cut);
+    else if (page_size == SIZE_1G)
+      cut = PAGE_ALIGN_1G(cut);
+
+    if (cut > node->end)
+      return true;
+  }
+
+  /* the released space is absorbed by the next node if it's free */
+  heap_node_t *next = 0;
+  tree_node_t *next_node = tree_next(&node->addr_node);
+  if (next_node)
+    next = container_of(next_node, heap_node_t, addr_node);
+
+  heap_node_t *tail = 0;
+  if (!next || next->state != HEAP_FREE)
+  {
+    /* otherwise it needs a node of its own, allocated before anything is freed */
+    tail = node_alloc();
+    if (!tail)
+      return false;
+  }
+
+  if (node->state == HEAP_ALLOCATED)
+    range_free(cut, node->end - cut + 1);
+
+  if (tail)
+  {
+    tail->state = HEAP_FREE;
+    tail->start = cut;
+    tail->end = node->end;
+
+    tree_insert(&heap_addr_tree, &tail->addr_node);
+    tree_insert(&heap_free_tree, &tail->free_node);
+  }
+  else
+  {
+    /* moving next's start down keeps it in the same place in the address tree */
+    tree_remove(&heap_free_tree, &next->free_node);
+    next->start = cut;
+    tree_insert(&heap_free_tree, &next->free_node);
+  }
+
+  node->end = cut - 1;
+  return true;
+}
+
+static bool heap_grow(heap_node_t *node, size_t size)
+{
+  /* check if the next node is free and big enough */
+  tree_node_t *next_node = tree_next(&node->addr_node);
+  if (!next_node)
+    return false;
+
+  heap_node_t *next = container_of(next_node, heap_node_t, addr_node);
+  if (next->state != HEAP_FREE)
+    return false;
+
+  size_t extra = size - (node->end - node->start + 1);
+  if ((next->end - next->start + 1) < extra)
+    return false;
+
+  /* map frames into the extra space */
+  if (node->state == HEAP_ALLOCATED && !range_alloc(node->end + 1, extra, node->flags))
+    return false;
+
+  /* take the space from the next node */
+  tree_remove(&heap_free_tree, &next->free_node);
+  if ((next->end - next->start + 1) == extra)
+  {
+    tree_remove(&heap_addr_tree, &next->addr_node);
+    node_free(next);
+  }
+  else
+  {
+    next->start += extra;
+    tree_insert(&heap_free_tree, &next->free_node);
+  }
+
+  node->end += extra;
+  return true;
+}
+
+static void *heap_move(heap_node_t *node, size_t size)
+{
+  /* the frames of reserved memory aren't ours to move */
+  if (node->state != HEAP_ALLOCATED)
+    return 0;
+
+  heap_node_t *new_node = find_node(size);
+  if (!new_node)
+    return 0;
+
+  /* map frames into the part of the new node beyond the old size */
+  size_t old_size = node->end - node->start + 1;
+  if (!range_alloc(new_node->start + old_size, size - old_size, node->flags))
+  {
+    _heap_free((void *) new_node->start);
+    return 0;
+  }
+
+  /* move the old frames across, without copying them */
+  if (!vmm_move_range(node->start, new_node->start, old_size, node->flags))
+  {
+    range_free(new_node->start + old_size, size - old_size);
+    _heap_free((void *) new_node->start);
+    return 0;
+  }
+
+  new_node->state = HEAP_ALLOCATED;
+  new_node->flags = node->flags;
+
+  /* the old node no longer has any frames, so just release the address space */
+  node->state = HEAP_RESERVED;
+  _heap_free((void *) node->start);
+
+  return (void *) new_node->start;
+}
+
+static void *_heap_resize(void *ptr, size_t size, bool may_move)
+{
+  heap_node_t *node = get_node(ptr);
+  if (!node)
+    panic("heap_resize() called with invalid pointer %0#18x", ptr);
+
+  /* round up the size such that it is a multiple of the page size */
+  size = PAGE_ALIGN(size);
+  if (size == 0)
+    return 0;
+
+  size_t old_size = node->end - node->start + 1;
+  if (size == old_size)
+    return ptr;
+
+  if (size < old_size)
+    return heap_shrink(node, size) ? ptr : 0;
+
+  /* try to grow in place before moving */
+  if (heap_grow(node, size))
+    return ptr;
+
+  if (!may_move)
+    return 0;
+
+  return heap_move(node, size);
 }
 
 void *heap_reserve(size_t size)
@@ -236,13 +490,22 @@ void heap_free(void *ptr)
   spin_unlock(&heap_lock);
 }
 
+void *heap_resize(void *ptr, size_t size, bool may_move)
+{
+  spin_lock(&heap_lock);
+  ptr = _heap_resize(ptr, size, may_move);
+  spin_unlock(&heap_lock);
+  return ptr;
+}
+
 void heap_trace(void)
 {
   spin_lock(&heap_lock);
 
   trace_printf("Tracing kernel heap...\n");
-  for (heap_node_t *node = heap_root; node; node = node->next)
+  tree_for_each(&heap_addr_tree, addr_node)
   {
+    heap_node_t *node = container_of(addr_node, heap_node_t, addr_node);
     const char *state = "free";
     const char *r = "", *w = "", *x = "";
 
@@ -261,5 +524,8 @@ void heap_trace(void)
     trace_printf(" => %0#18x -> %0#18x (%s%s%s%s)\n", node->start, node->end, state, r, w, x);
   }
 
+  size_t pool_size = heap_pool_end - HEAP_POOL_START;
+  trace_printf(" => %d nodes, %d bytes of node pool mapped\n", heap_addr_tree.size, pool_size);
+
   spin_unlock(&heap_lock);
 }
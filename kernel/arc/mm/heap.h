@@ -18,6 +18,7 @@
 #define ARC_MM_HEAP_H
 
 #include <arc/mm/common.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /*
@@ -50,6 +51,17 @@ void *heap_alloc(size_t size, vm_acc_t flags);
  */
 void heap_free(void *ptr);
 
+/*
+ * Resizes some memory on the kernel heap to 'size' bytes, rounded up to the
+ * nearest page size, and returns its (possibly new) address or zero if it
+ * could not be resized. It is grown in place if the following address space
+ * is free. Otherwise, if 'may_move' is true and the memory was allocated with
+ * heap_alloc(), its frames are moved to a new address without copying. When
+ * shrinking, frames in the released space are freed (although a large page is
+ * never split, so slightly more memory than requested may be kept.)
+ */
+void *heap_resize(void *ptr, size_t size, bool may_move);
+
 /* Prints out the kernel heap blocks for debugging purposes. */
 void heap_trace(void);
 
@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/mm/ksm.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/pmm.h>
+#include <arc/mm/slab.h>
+#include <arc/mm/vmm.h>
+#include <arc/proc/kthread.h>
+#include <arc/proc/proc.h>
+#include <arc/lock/spinlock.h>
+#include <arc/cpu/cr.h>
+#include <arc/smp/cpu.h>
+#include <arc/util/container.h>
+#include <arc/util/list.h>
+#include <arc/util/refcnt.h>
+#include <arc/cmdline.h>
+#include <arc/panic.h>
+#include <arc/trace.h>
+#include <assert.h>
+#include <stddef.h>
+#include <stdnoreturn.h>
+#include <string.h>
+
+/* the number of milliseconds between scans */
+#define KSM_INTERVAL 1000
+
+/* the number of pages looked at in each scan */
+#define KSM_SCAN_PAGES 512
+
+/* the number of buckets in each hash table */
+#define KSM_BUCKETS 1024
+
+#define KSM_NONE (-1)
+
+/* a merged frame */
+typedef struct
+{
+  list_node_t checksum_node, frame_node;
+  uintptr_t frame;
+  uint64_t checksum;
+  bool stable; /* if the node is in the checksum table yet */
+  bool owned;  /* if ksm_share() gave out a reference which isn't a mapping */
+  refcnt_t refs;
+} ksm_node_t;
+
+/* a page which hasn't been merged, but may be merged with a later one */
+typedef struct
+{
+  proc_t *proc;
+  uintptr_t virt, frame;
+  uint64_t checksum;
+  int next; /* the next page in the same bucket */
+} ksm_page_t;
+
+static kmem_cache_t ksm_node_cache = KMEM_CACHE("ksm_node", sizeof(ksm_node_t), _Alignof(ksm_node_t), 0);
+
+/* merged frames, indexed by checksum and by frame */
+static spinlock_t ksm_lock = SPIN_UNLOCKED;
+static list_t ksm_checksums[KSM_BUCKETS];
+static list_t ksm_frames[KSM_BUCKETS];
+static size_t ksm_shared, ksm_saved;
+
+/* used by the scanner thread only */
+static ksm_page_t ksm_pages[KSM_SCAN_PAGES];
+static size_t ksm_page_count;
+static int ksm_page_buckets[KSM_BUCKETS];
+static proc_t *ksm_scan_proc;
+static uintptr_t ksm_cursor;
+
+static uint64_t ksm_checksum(const uint64_t *page)
+{
+  /* FNV-1a, a word at a time */
+  uint64_t hash = 0xCBF29CE484222325;
+  for (size_t i = 0; i < FRAME_SIZE / sizeof(*page); i++)
+    hash = (hash ^ page[i]) * 0x100000001B3;
+
+  return hash;
+}
+
+static size_t ksm_frame_bucket(uintptr_t frame)
+{
+  return (frame / FRAME_SIZE) % KSM_BUCKETS;
+}
+
+static ksm_node_t *_ksm_find_frame(uintptr_t frame)
+{
+  list_for_each(&ksm_frames[ksm_frame_bucket(frame)], node)
+  {
+    ksm_node_t *ksm_node = container_of(node, ksm_node_t, frame_node);
+    if (ksm_node->frame == frame)
+      return ksm_node;
+  }
+
+  return 0;
+}
+
+/* frees a merged frame once the last reference to it has gone */
+static void _ksm_free(ksm_node_t *node)
+{
+  list_remove(&ksm_frames[ksm_frame_bucket(node->frame)], &node->frame_node);
+  if (node->stable)
+    list_remove(&ksm_checksums[node->checksum % KSM_BUCKETS], &node->checksum_node);
+
+  ksm_shared--;
+  pmm_free(node->frame);
+  kmem_cache_free(&ksm_node_cache, node);
+}
+
+/* the number of references to a node which don't save a frame */
+static unsigned int ksm_unsaved(ksm_node_t *node)
+{
+  /* the first mapping of a frame doesn't save anything, nor does an owner */
+  return node->owned ? 2 : 1;
+}
+
+static void _ksm_put(ksm_node_t *node)
+{
+  bool saved = node->refs.count > ksm_unsaved(node);
+  refcnt_release(&node->refs);
+
+  if (saved)
+    ksm_saved--;
+
+  if (node->refs.count == 0)
+    _ksm_free(node);
+}
+
+void ksm_put(uintptr_t frame)
+{
+  spin_lock(&ksm_lock);
+
+  ksm_node_t *node = _ksm_find_frame(frame);
+  assert(node);
+  _ksm_put(node);
+
+  spin_unlock(&ksm_lock);
+}
+
+bool ksm_share(uintptr_t frame)
+{
+  ksm_node_t *node = kmem_cache_alloc(&ksm_node_cache);
+  if (!node)
+    return false;
+
+  /* the node is never put in the checksum table, so nothing is merged with it */
+  node->frame = frame;
+  node->stable = false;
+  node->owned = true;
+  refcnt_init(&node->refs);
+
+  spin_lock(&ksm_lock);
+  list_add_tail(&ksm_frames[ksm_frame_bucket(frame)], &node->frame_node);
+  ksm_shared++;
+  spin_unlock(&ksm_lock);
+
+  return true;
+}
+
+void ksm_get(uintptr_t frame)
+{
+  spin_lock(&ksm_lock);
+
+  ksm_node_t *node = _ksm_find_frame(frame);
+  assert(node);
+  refcnt_retain(&node->refs);
+  if (node->refs.count > ksm_unsaved(node))
+    ksm_saved++;
+
+  spin_unlock(&ksm_lock);
+}
+
+void ksm_disown(uintptr_t frame)
+{
+  spin_lock(&ksm_lock);
+
+  ksm_node_t *node = _ksm_find_frame(frame);
+  assert(node && node->owned);
+  node->owned = false;
+  refcnt_release(&node->refs);
+
+  if (node->refs.count == 0)
+    _ksm_free(node);
+
+  spin_unlock(&ksm_lock);
+}
+
+bool ksm_unshare(uintptr_t virt, uint64_t colour, vm_acc_t flags)
+{
+  uintptr_t frame;
+  if (!vmm_shared(virt, &frame))
+    return true;
+
+  uintptr_t new_frame = pmm_alloc_user(SIZE_4K, colour);
+  if (!new_frame)
+    return false;
+
+  void *ptr = mmio_map_frame(new_frame);
+  if (!ptr)
+  {
+    pmm_free(new_frame);
+    return false;
+  }
+
+  bool ok = vmm_unshare(virt, frame, new_frame, ptr, flags);
+  mmio_unmap_frame(new_frame, ptr);
+
+  /* if the page changed in the meantime, the access is just retried */
+  if (ok)
+    ksm_put(frame);
+  else
+    pmm_free(new_frame);
+
+  return true;
+}
+
+/* maps a page onto a merged frame, which it must have the same contents as */
+static bool ksm_merge(ksm_node_t *node, ksm_page_t *page)
+{
+  /* hold a reference so the frame can't be freed while we map it */
+  spin_lock(&ksm_lock);
+  refcnt_retain(&node->refs);
+  ksm_saved++;
+  spin_unlock(&ksm_lock);
+
+  bool ok = false;
+  void *ptr = mmio_map_frame(node->frame);
+  if (ptr)
+  {
+    proc_switch(page->proc);
+    ok = vmm_merge(page->virt, page->frame, node->frame, ptr);
+    mmio_unmap_frame(node->frame, ptr);
+  }
+
+  if (ok)
+    pmm_free(page->frame);
+  else
+    ksm_put(node->frame);
+
+  return ok;
+}
+
+/* tries to merge a page with a merged frame which has the same checksum */
+static bool ksm_merge_stable(ksm_page_t *page)
+{
+  spin_lock(&ksm_lock);
+
+  ksm_node_t *found = 0;
+  list_for_each(&ksm_checksums[page->checksum % KSM_BUCKETS], node)
+  {
+    ksm_node_t *ksm_node = container_of(node, ksm_node_t, checksum_node);
+    if (ksm_node->checksum == page->checksum)
+    {
+      found = ksm_node;
+      refcnt_retain(&found->refs);
+      ksm_saved++;
+      break;
+    }
+  }
+
+  spin_unlock(&ksm_lock);
+
+  if (!found)
+    return false;
+
+  bool ok = ksm_merge(found, page);
+  ksm_put(found->frame);
+  return ok;
+}
+
+/* turns a page into a new merged frame, which other pages can be merged with */
+static ksm_node_t *ksm_stabilise(ksm_page_t *page)
+{
+  ksm_node_t *node = kmem_cache_alloc(&ksm_node_cache);
+  if (!node)
+    return 0;
+
+  node->frame = page->frame;
+  node->stable = false;
+  node->owned = false;
+  refcnt_init(&node->refs);
+
+  /*
+   * the node must be findable by ksm_put() before the page is marked as
+   * merged, in case it is unmapped straight away
+   */
+  spin_lock(&ksm_lock);
+  list_add_tail(&ksm_frames[ksm_frame_bucket(node->frame)], &node->frame_node);
+  ksm_shared++;
+  spin_unlock(&ksm_lock);
+
+  proc_switch(page->proc);
+  if (!vmm_merge(page->virt, page->frame, page->frame, 0))
+  {
+    spin_lock(&ksm_lock);
+    list_remove(&ksm_frames[ksm_frame_bucket(node->frame)], &node->frame_node);
+    ksm_shared--;
+    spin_unlock(&ksm_lock);
+
+    kmem_cache_free(&ksm_node_cache, node);
+    return 0;
+  }
+
+  /* the frame is read-only now, so its checksum won't change any more */
+  void *ptr = mmio_map_frame(node->frame);
+  node->checksum = ptr ? ksm_checksum(ptr) : page->checksum;
+  if (ptr)
+    mmio_unmap_frame(node->frame, ptr);
+
+  spin_lock(&ksm_lock);
+  list_add_tail(&ksm_checksums[node->checksum % KSM_BUCKETS], &node->checksum_node);
+  node->stable = true;
+  spin_unlock(&ksm_lock);
+
+  return node;
+}
+
+static void ksm_find_pages(uintptr_t virt, uintptr_t frame, int size, void *arg)
+{
+  if (size != SIZE_4K || virt < ksm_cursor || ksm_page_count == KSM_SCAN_PAGES)
+    return;
+
+  ksm_page_t *page = &ksm_pages[ksm_page_count++];
+  page->proc = ksm_scan_proc;
+  page->virt = virt;
+  page->frame = frame;
+}
+
+/* collects the next batch of pages, carrying on from where the last scan stopped */
+static void ksm_collect(void)
+{
+  ksm_page_count = 0;
+
+  /* start from the beginning if the process we stopped in has gone */
+  bool found = false;
+  list_for_each(&proc_list, node)
+  {
+    proc_t *proc = container_of(node, proc_t, node);
+    if (proc == ksm_scan_proc)
+    {
+      found = true;
+      break;
+    }
+  }
+
+  if (!found)
+  {
+    ksm_scan_proc = proc_list.head ? container_of(proc_list.head, proc_t, node) : 0;
+    ksm_cursor = 0;
+  }
+
+  for (int procs = 0; ksm_scan_proc && procs < proc_list.size; procs++)
+  {
+    if (ksm_scan_proc->state != PROC_DEAD)
+    {
+      proc_switch(ksm_scan_proc);
+
+      vmm_scan_user(&ksm_find_pages, 0);
+
+      /* stop here if the batch is full, otherwise move on to the next process */
+      if (ksm_page_count == KSM_SCAN_PAGES)
+      {
+        ksm_cursor = ksm_pages[ksm_page_count - 1].virt + FRAME_SIZE;
+        break;
+      }
+    }
+
+    list_node_t *next = ksm_scan_proc->node.next ? ksm_scan_proc->node.next : proc_list.head;
+    ksm_scan_proc = container_of(next, proc_t, node);
+    ksm_cursor = 0;
+  }
+}
+
+static void ksm_scan(void)
+{
+  spin_lock(&proc_list_lock);
+
+  cpu_t *cpu = cpu_get();
+  proc_t *old_proc = cpu->proc;
+  uintptr_t old_pml4_table = cr3_read();
+
+  ksm_collect();
+
+  for (int i = 0; i < KSM_BUCKETS; i++)
+    ksm_page_buckets[i] = KSM_NONE;
+
+  size_t old_saved = ksm_saved;
+
+  for (size_t i = 0; i < ksm_page_count; i++)
+  {
+    ksm_page_t *page = &ksm_pages[i];
+
+    void *ptr = mmio_map_frame(page->frame);
+    if (!ptr)
+      continue;
+
+    page->checksum = ksm_checksum(ptr);
+    mmio_unmap_frame(page->frame, ptr);
+
+    /* try to merge the page with an existing merged frame */
+    if (ksm_merge_stable(page))
+      continue;
+
+    /* otherwise look for an identical page found earlier in this scan */
+    size_t bucket = page->checksum % KSM_BUCKETS;
+    int *prev = &ksm_page_buckets[bucket];
+    bool merged = false;
+    while (*prev != KSM_NONE)
+    {
+      ksm_page_t *other = &ksm_pages[*prev];
+      if (other->checksum != page->checksum)
+      {
+        prev = &other->next;
+        continue;
+      }
+
+      /* take the other page out of the bucket, it is either merged now or gone */
+      *prev = other->next;
+
+      ksm_node_t *node = ksm_stabilise(other);
+      if (node && ksm_merge(node, page))
+      {
+        merged = true;
+        break;
+      }
+    }
+
+    if (!merged)
+    {
+      page->next = ksm_page_buckets[bucket];
+      ksm_page_buckets[bucket] = i;
+    }
+  }
+
+  cpu->proc = old_proc;
+  cr3_write(old_pml4_table);
+
+  spin_unlock(&proc_list_lock);
+
+  if (ksm_saved != old_saved)
+    trace_printf("ksm: %d frames shared, saving %d frames\n", ksm_shared, ksm_saved);
+}
+
+static noreturn void ksm_daemon(void)
+{
+  for (;;)
+  {
+    thread_sleep(KSM_INTERVAL);
+    ksm_scan();
+  }
+}
+
+void ksm_init(void)
+{
+  const char *ksm = cmdline_get("ksm");
+  if (ksm && strcmp(ksm, "off") == 0)
+    return;
+
+  for (int i = 0; i < KSM_BUCKETS; i++)
+  {
+    list_init(&ksm_checksums[i]);
+    list_init(&ksm_frames[i]);
+  }
+
+  if (!kthread_create(&ksm_daemon))
+    panic("couldn't create ksm thread");
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ARC_MM_KSM_H
+#define ARC_MM_KSM_H
+
+#include <arc/mm/common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Same-page merging. A kernel thread periodically hashes the 4K pages of
+ * every process, and maps pages with identical contents to a single
+ * read-only frame (see vmm_merge()). Writing to a merged page faults, and
+ * ksm_unshare() gives the writer a private copy again.
+ */
+void ksm_init(void);
+
+/*
+ * if the page at virt is merged, copies it into a new frame of the given
+ * colour and maps it with the given flags. returns false if there wasn't a
+ * frame to copy it into
+ */
+bool ksm_unshare(uintptr_t virt, uint64_t colour, vm_acc_t flags);
+
+/*
+ * makes frame a merged frame with a single reference, for frames which are
+ * shared from the start rather than found by the scanner (see image.h). the
+ * reference belongs to the caller rather than a mapping, so it isn't counted
+ * as saving a frame
+ */
+bool ksm_share(uintptr_t frame);
+
+/* adds a reference to a merged frame, before mapping it with vmm_map_shared() */
+void ksm_get(uintptr_t frame);
+
+/* drops the reference given out by ksm_share() */
+void ksm_disown(uintptr_t frame);
+
+/* drops a reference to a merged frame, called by the VMM when unmapping it */
+void ksm_put(uintptr_t frame);
+
+#endif
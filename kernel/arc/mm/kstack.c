@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/mm/kstack.h>
+#include <arc/mm/heap.h>
+#include <arc/mm/range.h>
+#include <arc/cpu/tss.h>
+#include <arc/lock/intr.h>
+#include <arc/lock/spinlock.h>
+#include <arc/smp/cpu.h>
+#include <arc/panic.h>
+#include <stdint.h>
+
+/* the maximum number of kernel stacks */
+#define KSTACK_SLOTS 4096
+
+/* each slot is an unmapped guard page followed by the stack itself */
+#define KSTACK_SLOT_SIZE (FRAME_SIZE + KSTACK_SIZE)
+
+static uintptr_t kstack_region;
+static uint16_t kstack_free_slots[KSTACK_SLOTS];
+static size_t kstack_free_count;
+static spinlock_t kstack_lock = SPIN_UNLOCKED;
+
+/* unmaps a stack and gives its slot back */
+static void kstack_release(void *stack)
+{
+  uintptr_t addr = (uintptr_t) stack;
+  range_free(addr, KSTACK_SIZE);
+
+  spin_lock(&kstack_lock);
+  kstack_free_slots[kstack_free_count++] = (addr - kstack_region) / KSTACK_SLOT_SIZE;
+  spin_unlock(&kstack_lock);
+}
+
+void kstack_init(void)
+{
+  /* reserve (but don't map) the virtual memory for every slot */
+  kstack_region = (uintptr_t) heap_reserve(KSTACK_SLOTS * KSTACK_SLOT_SIZE);
+  if (!kstack_region)
+    panic("couldn't reserve kernel stack region");
+
+  /* all slots start off free, lowest address at the top of the stack */
+  for (size_t i = 0; i < KSTACK_SLOTS; i++)
+    kstack_free_slots[i] = KSTACK_SLOTS - i - 1;
+
+  kstack_free_count = KSTACK_SLOTS;
+}
+
+void kstack_cpu_init(void)
+{
+  void *stack = kstack_alloc();
+  if (!stack)
+    panic("couldn't allocate double fault stack");
+
+  tss_set_ist(TSS_IST_DOUBLE_FAULT, (uintptr_t) stack + KSTACK_SIZE);
+}
+
+void *kstack_alloc(void)
+{
+  /* try to reuse a stack this cpu freed recently, which is still mapped */
+  intr_lock();
+
+  cpu_t *cpu = cpu_get();
+  if (cpu->kstack_cache_count)
+  {
+    void *stack = cpu->kstack_cache[--cpu->kstack_cache_count];
+    intr_unlock();
+    return stack;
+  }
+
+  intr_unlock();
+
+  /* otherwise take a free slot */
+  spin_lock(&kstack_lock);
+
+  if (!kstack_free_count)
+  {
+    spin_unlock(&kstack_lock);
+    return 0;
+  }
+
+  uint16_t slot = kstack_free_slots[--kstack_free_count];
+  spin_unlock(&kstack_lock);
+
+  /* map the stack, leaving the guard page below it unmapped */
+  uintptr_t stack = kstack_region + slot * KSTACK_SLOT_SIZE + FRAME_SIZE;
+  if (!range_alloc(stack, KSTACK_SIZE, VM_R | VM_W))
+  {
+    spin_lock(&kstack_lock);
+    kstack_free_slots[kstack_free_count++] = slot;
+    spin_unlock(&kstack_lock);
+    return 0;
+  }
+
+  return (void *) stack;
+}
+
+void kstack_free(void *stack)
+{
+  /* keep the stack mapped in this cpu's cache if there is room */
+  intr_lock();
+
+  cpu_t *cpu = cpu_get();
+  if (cpu->kstack_cache_count < KSTACK_CACHE_SIZE)
+  {
+    cpu->kstack_cache[cpu->kstack_cache_count++] = stack;
+    intr_unlock();
+    return;
+  }
+
+  intr_unlock();
+
+  kstack_release(stack);
+}
+
+size_t kstack_reap(void)
+{
+  size_t frames = 0;
+
+  for (;;)
+  {
+    intr_lock();
+
+    cpu_t *cpu = cpu_get();
+    if (!cpu->kstack_cache_count)
+    {
+      intr_unlock();
+      return frames;
+    }
+
+    void *stack = cpu->kstack_cache[--cpu->kstack_cache_count];
+    intr_unlock();
+
+    kstack_release(stack);
+    frames += KSTACK_SIZE / FRAME_SIZE;
+  }
+}
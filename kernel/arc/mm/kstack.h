@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ARC_MM_KSTACK_H
+#define ARC_MM_KSTACK_H
+
+#include <stddef.h>
+
+/* the usable size of each kernel stack */
+#define KSTACK_SIZE 8192
+
+/* the number of freed stacks each cpu keeps mapped for quick reuse */
+#define KSTACK_CACHE_SIZE 8
+
+/*
+ * Reserves the virtual memory region kernel stacks are allocated from. Each
+ * stack sits above an unmapped guard page, so an overflow causes a page fault
+ * rather than silently corrupting whatever is below it.
+ */
+void kstack_init(void);
+
+/*
+ * Allocates this cpu's double fault stack, which is switched to with the IST
+ * mechanism, so a kernel stack overflow can be reported rather than causing a
+ * triple fault.
+ */
+void kstack_cpu_init(void);
+
+/* allocates a kernel stack, returning its lowest address */
+void *kstack_alloc(void);
+
+/* frees a kernel stack allocated with kstack_alloc() */
+void kstack_free(void *stack);
+
+/*
+ * Unmaps the stacks in this cpu's cache, returning the number of frames freed.
+ */
+size_t kstack_reap(void);
+
+#endif
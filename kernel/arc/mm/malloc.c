@@ -16,9 +16,102 @@
 
 #include <arc/mm/malloc.h>
 #include <arc/mm/heap.h>
+#include <arc/smp/cpu.h>
+#include <arc/util/container.h>
 #include <string.h>
 
-spinlock_t malloc_lock = SPIN_UNLOCKED;
+spinlock_t malloc_global_lock = SPIN_UNLOCKED;
+
+/* used before a cpu has its own mspace, or if creating one failed */
+static mspace malloc_fallback;
+
+void malloc_init(void)
+{
+  malloc_fallback = create_mspace(0, 1);
+  if (!malloc_fallback)
+    panic("couldn't create fallback mspace");
+
+  /* the BSP's cpu_t is not allocated with malloc(), so set it up now */
+  malloc_cpu_init();
+}
+
+void malloc_cpu_init(void)
+{
+  cpu_t *cpu = cpu_get();
+  cpu->malloc_deferred = 0;
+  cpu->mspace = create_mspace(0, 1);
+}
+
+mspace malloc_mspace(void)
+{
+  cpu_t *cpu = cpu_get();
+  mspace space = cpu->mspace;
+  if (!space)
+    return malloc_fallback;
+
+  /* give back chunks that other cpus freed */
+  void *chunk = __sync_lock_test_and_set(&cpu->malloc_deferred, 0);
+  while (chunk)
+  {
+    void *next = *(void **) chunk;
+    mspace_free(space, chunk);
+    chunk = next;
+  }
+
+  return space;
+}
+
+void malloc_free(void *ptr)
+{
+  if (!ptr)
+    return;
+
+  /* chunks from our own (or the fallback) mspace are freed straight away */
+  mspace owner = mspace_owner(ptr);
+  cpu_t *self = cpu_get();
+  if (owner == self->mspace || owner == malloc_fallback)
+  {
+    mspace_free(owner, ptr);
+    return;
+  }
+
+  /*
+   * otherwise push the chunk on to the owning cpu's deferred list, so we
+   * don't contend for its lock
+   */
+  list_for_each(&cpu_list, node)
+  {
+    cpu_t *cpu = container_of(node, cpu_t, node);
+    if (cpu->mspace != owner)
+      continue;
+
+    void *head;
+    do
+    {
+      head = cpu->malloc_deferred;
+      *(void **) ptr = head;
+    } while (!__sync_bool_compare_and_swap(&cpu->malloc_deferred, head, ptr));
+
+    return;
+  }
+
+  /* no cpu claims the mspace, which shouldn't happen - free it directly */
+  mspace_free(owner, ptr);
+}
+
+size_t malloc_reclaim(void)
+{
+  size_t trimmed = mspace_trim(malloc_fallback, 0);
+
+  list_for_each(&cpu_list, node)
+  {
+    cpu_t *cpu = container_of(node, cpu_t, node);
+    if (cpu->mspace)
+      trimmed += mspace_trim(cpu->mspace, 0);
+  }
+
+  return trimmed;
+}
 
 /*
  * note: these are only functions required for dlmalloc to work, for the bulk
@@ -48,3 +141,12 @@ int munmap(void *addr, size_t len)
   heap_free(addr);
   return 0;
 }
+
+void *mremap(void *old_addr, size_t old_len, size_t new_len, int flags)
+{
+  void *ptr = heap_resize(old_addr, new_len, flags & MREMAP_MAYMOVE);
+  if (!ptr)
+    return MAP_FAILED;
+
+  return ptr;
+}
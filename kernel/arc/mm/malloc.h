@@ -43,9 +43,25 @@
 /* stats require stdio.h which we don't support */
 #define NO_MALLOC_STATS 1
 
-/* don't use built-in spinlocks */
-#define USE_LOCKS           0
-#define USE_SPIN_LOCKS      0
+/* each cpu has its own mspace, the regular malloc() functions are not used */
+#define MSPACES      1
+#define ONLY_MSPACES 1
+
+/* record the owning mspace in each chunk so free() can find it */
+#define FOOTERS 1
+
+/* lock each mspace with one of our own spinlocks */
+#define USE_LOCKS      2
+#define USE_SPIN_LOCKS 0
+
+#define MLOCK_T                      spinlock_t
+#define INITIAL_LOCK(lock)           (*(lock) = SPIN_UNLOCKED, 0)
+#define DESTROY_LOCK(lock)           (0)
+#define ACQUIRE_LOCK(lock)           (spin_lock(lock), 0)
+#define RELEASE_LOCK(lock)           spin_unlock(lock)
+#define TRY_LOCK(lock)               spin_try_lock(lock)
+#define ACQUIRE_MALLOC_GLOBAL_LOCK() spin_lock(&malloc_global_lock);
+#define RELEASE_MALLOC_GLOBAL_LOCK() spin_unlock(&malloc_global_lock);
 
 /* prefix function names with dl */
 #define USE_DL_PREFIX 1
@@ -56,7 +72,7 @@
 /* we only support mmap-like calls */
 #define HAVE_MORECORE 0
 #define HAVE_MMAP     1
-#define HAVE_MREMAP   0
+#define HAVE_MREMAP   1
 #define MMAP_CLEARS   0
 
 /* hard-coded page size of 4k */
@@ -72,6 +88,8 @@
 
 #define MAP_FAILED ((void *) -1)
 
+#define MREMAP_MAYMOVE 0x1
+
 #define PROT_NONE  0x0
 #define PROT_READ  0x1
 #define PROT_WRITE 0x2
@@ -79,12 +97,27 @@
 
 typedef size_t off_t;
 
-extern spinlock_t malloc_lock;
+/* protects dlmalloc's global parameters */
+extern spinlock_t malloc_global_lock;
 
 void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
 int munmap(void *addr, size_t len);
+void *mremap(void *old_addr, size_t old_len, size_t new_len, int flags);
 
 /* include the actual dlmalloc header file */
 #include <dlmalloc.h>
 
+mspace mspace_owner(void *mem);
+
+void malloc_init(void);
+void malloc_cpu_init(void);
+mspace malloc_mspace(void);
+void malloc_free(void *ptr);
+
+/*
+ * gives the unused memory at the top of every mspace back to the heap,
+ * returning the number of mspaces which shrank
+ */
+size_t malloc_reclaim(void);
+
 #endif
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/mm/memblock.h>
+#include <arc/mm/align.h>
+#include <arc/mm/common.h>
+#include <arc/mm/phy32.h>
+#include <arc/mm/pmm.h>
+#include <arc/panic.h>
+#include <arc/trace.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* the number of regions each list can hold before it has to grow */
+#define MEMBLOCK_INIT_REGIONS 64
+
+/* allocations are rounded up to this many bytes */
+#define MEMBLOCK_ALIGN 16
+
+/* the highest address which can be allocated, so phy32_to_virt() works */
+#define MEMBLOCK_LIMIT ZONE_LIMIT_DMA32
+
+typedef struct
+{
+  uintptr_t start; /* the address of the first byte, inclusive */
+  uintptr_t end;   /* the address of the last byte, inclusive */
+} memblock_region_t;
+
+/* a list of regions, sorted by address, which never overlap or touch */
+typedef struct
+{
+  const char *name;
+  memblock_region_t *regions;
+  size_t count;
+  size_t capacity;
+  bool allocated; /* true if the array was allocated by memblock_grow() */
+} memblock_list_t;
+
+static memblock_region_t memblock_memory_init[MEMBLOCK_INIT_REGIONS];
+static memblock_region_t memblock_reserved_init[MEMBLOCK_INIT_REGIONS];
+
+static memblock_list_t memblock_memory =
+{
+  .name = "available",
+  .regions = memblock_memory_init,
+  .capacity = MEMBLOCK_INIT_REGIONS
+};
+
+static memblock_list_t memblock_reserved =
+{
+  .name = "reserved",
+  .regions = memblock_reserved_init,
+  .capacity = MEMBLOCK_INIT_REGIONS
+};
+
+/* set once the memory has been handed to the physical memory manager */
+static bool memblock_released;
+
+/* the number of bytes currently allocated by memblock_alloc(), and the peak */
+static size_t memblock_used, memblock_peak;
+
+static bool memblock_add(memblock_list_t *list, uintptr_t start, uintptr_t end);
+static bool memblock_remove(memblock_list_t *list, uintptr_t start, uintptr_t end);
+
+/*
+ * finds 'len' free bytes (aligned to 'align' bytes) as high as possible below
+ * MEMBLOCK_LIMIT, returning zero if there is no room. the space isn't reserved.
+ */
+static uintptr_t memblock_find(size_t len, size_t align)
+{
+  for (size_t i = memblock_memory.count; i-- > 0;)
+  {
+    memblock_region_t *mem = &memblock_memory.regions[i];
+    if (mem->start > MEMBLOCK_LIMIT)
+      continue;
+
+    uintptr_t top = mem->end;
+    if (top > MEMBLOCK_LIMIT)
+      top = MEMBLOCK_LIMIT;
+
+    /* walk down through the free gaps between the reserved regions */
+    for (size_t j = memblock_reserved.count + 1; j-- > 0;)
+    {
+      uintptr_t bottom = mem->start;
+      memblock_region_t *res = 0;
+      if (j > 0)
+      {
+        res = &memblock_reserved.regions[j - 1];
+        if (res->start > top)
+          continue;
+
+        if (res->end >= bottom)
+          bottom = res->end + 1;
+      }
+
+      /* try to fit the allocation at the top of the gap */
+      if (bottom <= top && top - bottom + 1 >= len)
+      {
+        uintptr_t addr = (top + 1 - len) & ~(align - 1);
+        if (addr >= bottom)
+          return addr;
+      }
+
+      /* move below the reserved region, if it is still within this region */
+      if (!res || res->start <= mem->start)
+        break;
+
+      top = res->start - 1;
+    }
+  }
+
+  return 0;
+}
+
+/* doubles the size of a list's array, by moving it to newly allocated memory */
+static bool memblock_grow(memblock_list_t *list)
+{
+  size_t old_len = list->capacity * sizeof(*list->regions);
+  size_t new_len = old_len * 2;
+
+  uintptr_t addr = memblock_find(new_len, MEMBLOCK_ALIGN);
+  if (!addr)
+    return false;
+
+  memblock_region_t *old_regions = list->regions;
+  bool old_allocated = list->allocated;
+
+  list->regions = (memblock_region_t *) aphy32_to_virt(addr);
+  memcpy(list->regions, old_regions, old_len);
+  list->capacity *= 2;
+  list->allocated = true;
+
+  /* the reserved list has room now, even if it's the one which grew */
+  if (!memblock_add(&memblock_reserved, addr, addr + new_len - 1))
+    return false;
+
+  if (old_allocated)
+  {
+    uintptr_t old_addr = (uintptr_t) old_regions - PHY32_OFFSET;
+    return memblock_remove(&memblock_reserved, old_addr, old_addr + old_len - 1);
+  }
+
+  return true;
+}
+
+/* adds a range to a list, merging it with any regions it overlaps or touches */
+static bool memblock_add(memblock_list_t *list, uintptr_t start, uintptr_t end)
+{
+  if (list->count == list->capacity && !memblock_grow(list))
+    return false;
+
+  /* find the first region which isn't entirely before the range */
+  size_t first = 0;
+  while (first < list->count && list->regions[first].end + 1 < start)
+    first++;
+
+  /* find the end of the run of regions which overlap or touch the range */
+  size_t last = first;
+  while (last < list->count && list->regions[last].start <= end + 1)
+  {
+    if (list->regions[last].start < start)
+      start = list->regions[last].start;
+    if (list->regions[last].end > end)
+      end = list->regions[last].end;
+    last++;
+  }
+
+  /* replace regions first to last (exclusive) with the merged region */
+  size_t merged = last - first;
+  if (merged != 1)
+  {
+    size_t tail = list->count - last;
+    memmove(&list->regions[first + 1], &list->regions[last], tail * sizeof(*list->regions));
+    list->count = list->count + 1 - merged;
+  }
+
+  list->regions[first].start = start;
+  list->regions[first].end = end;
+  return true;
+}
+
+/* removes a range from a list, splitting a region if required */
+static bool memblock_remove(memblock_list_t *list, uintptr_t start, uintptr_t end)
+{
+  if (list->count == list->capacity && !memblock_grow(list))
+    return false;
+
+  for (size_t i = 0; i < list->count;)
+  {
+    memblock_region_t *region = &list->regions[i];
+    if (region->end < start || region->start > end)
+    {
+      i++;
+      continue;
+    }
+
+    if (region->start < start && region->end > end)
+    {
+      /* the range is in the middle of the region, so split it in two */
+      memmove(&list->regions[i + 1], &list->regions[i], (list->count - i) * sizeof(*list->regions));
+      list->count++;
+
+      list->regions[i].end = start - 1;
+      list->regions[i + 1].start = end + 1;
+      return true;
+    }
+
+    if (region->start < start)
+    {
+      region->end = start - 1;
+      i++;
+    }
+    else if (region->end > end)
+    {
+      region->start = end + 1;
+      i++;
+    }
+    else
+    {
+      memmove(&list->regions[i], &list->regions[i + 1], (list->count - i - 1) * sizeof(*list->regions));
+      list->count--;
+    }
+  }
+
+  return true;
+}
+
+static void memblock_reserve(uintptr_t start, uintptr_t end)
+{
+  if (!memblock_add(&memblock_reserved, start, end))
+    panic("failed to reserve early memory region");
+}
+
+void memblock_init(multiboot_t *multiboot)
+{
+  /* find the mmap multiboot tag */
+  multiboot_tag_t *mmap_tag = multiboot_get(multiboot, MULTIBOOT_TAG_MMAP);
+  if (!mmap_tag)
+    panic("no multiboot mmap tag");
+
+  uintptr_t entry_addr = (uintptr_t) mmap_tag + sizeof(mmap_tag->type)
+    + sizeof(mmap_tag->size) + sizeof(mmap_tag->mmap.entry_size)
+    + sizeof(mmap_tag->mmap.entry_version);
+
+  uintptr_t entry_limit = (uintptr_t) mmap_tag + mmap_tag->size;
+
+  /*
+   * reserve the IVT and BIOS data area - it runs from 0x000-0x4FF inclusive,
+   * however, 0x000-0xFFF is reserved as we can't allocate a page from this
+   * area anyway as it conflicts with the null pointer value
+   *
+   * some values from the BDA are useful e.g. we need it to find the EBDA,
+   * which can then be used to find the ACPI or MP tables
+   *
+   * this is done first, so nothing can be allocated before the rest of the
+   * reserved regions are known
+   */
+  memblock_reserve(0x000000, 0x000FFF);
+
+  /*
+   * reserve kernel memory, rounded out to the 2M pages start.s maps it with
+   * so nothing else can be accessed through the kernel image
+   */
+  extern int _start, _end;
+  uintptr_t start_addr = PAGE_ALIGN_REVERSE_2M((uintptr_t) &_start - VM_KERNEL_IMAGE);
+  uintptr_t end_addr   = PAGE_ALIGN_2M((uintptr_t) &_end - VM_KERNEL_IMAGE) - 1;
+  memblock_reserve(start_addr, end_addr);
+
+  /* reserve SMP trampoline area */
+  extern int trampoline_start, trampoline_end;
+  size_t trampoline_len = (uintptr_t) &trampoline_end - (uintptr_t) &trampoline_start;
+  memblock_reserve(0x001000, 0x001000 + trampoline_len - 1);
+
+  /* reserve multiboot information structure memory */
+  start_addr = (uintptr_t) multiboot - PHY32_OFFSET;
+  end_addr   = start_addr + multiboot->total_size - 1;
+  memblock_reserve(start_addr, end_addr);
+
+  /* reserve multiboot module(s) memory */
+  multiboot_tag_t *mod_tag = multiboot_get(multiboot, MULTIBOOT_TAG_MODULE);
+  while (mod_tag)
+  {
+    memblock_reserve(mod_tag->module.mod_start, mod_tag->module.mod_end - 1);
+    mod_tag = multiboot_get_after(multiboot, mod_tag, MULTIBOOT_TAG_MODULE);
+  }
+
+  /* add the available entries from the e820 map given to us by GRUB */
+  for (uintptr_t addr = entry_addr; addr < entry_limit; addr += mmap_tag->mmap.entry_size)
+  {
+    multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *) addr;
+    if (entry->length > 0 && entry->type == MULTIBOOT_MMAP_AVAILABLE)
+    {
+      if (!memblock_add(&memblock_memory, entry->base_addr, entry->base_addr + entry->length - 1))
+        panic("failed to add memory map entry");
+    }
+  }
+
+  /* then take out any other entries, which take precedence if they overlap */
+  for (uintptr_t addr = entry_addr; addr < entry_limit; addr += mmap_tag->mmap.entry_size)
+  {
+    multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *) addr;
+    if (entry->length > 0 && entry->type != MULTIBOOT_MMAP_AVAILABLE)
+    {
+      if (!memblock_remove(&memblock_memory, entry->base_addr, entry->base_addr + entry->length - 1))
+        panic("failed to remove memory map entry");
+    }
+  }
+}
+
+void *memblock_alloc(size_t len)
+{
+  if (memblock_released || len == 0)
+    return 0;
+
+  len = (len + MEMBLOCK_ALIGN - 1) & ~(MEMBLOCK_ALIGN - 1);
+
+  uintptr_t addr = memblock_find(len, MEMBLOCK_ALIGN);
+  if (!addr || !memblock_add(&memblock_reserved, addr, addr + len - 1))
+    return 0;
+
+  memblock_used += len;
+  if (memblock_used > memblock_peak)
+    memblock_peak = memblock_used;
+
+  return (void *) aphy32_to_virt(addr);
+}
+
+void memblock_free(void *ptr, size_t len)
+{
+  /* once the physical memory manager has taken over, the memory is leaked */
+  if (memblock_released || len == 0)
+    return;
+
+  len = (len + MEMBLOCK_ALIGN - 1) & ~(MEMBLOCK_ALIGN - 1);
+
+  uintptr_t addr = (uintptr_t) ptr - PHY32_OFFSET;
+  if (!memblock_remove(&memblock_reserved, addr, addr + len - 1))
+    panic("failed to free early memory");
+
+  memblock_used -= len;
+}
+
+void memblock_release(memblock_func_t func)
+{
+  memblock_released = true;
+
+  /* hand over the gaps between the reserved regions in each memory region */
+  size_t j = 0;
+  for (size_t i = 0; i < memblock_memory.count; i++)
+  {
+    memblock_region_t *mem = &memblock_memory.regions[i];
+    uintptr_t start = mem->start;
+    bool covered = false;
+
+    /* skip reserved regions which end before this memory region */
+    while (j < memblock_reserved.count && memblock_reserved.regions[j].end < start)
+      j++;
+
+    for (; j < memblock_reserved.count && memblock_reserved.regions[j].start <= mem->end; j++)
+    {
+      memblock_region_t *res = &memblock_reserved.regions[j];
+      if (res->start > start)
+        func(start, res->start - 1);
+
+      /* this reserved region might overlap the next memory region too */
+      if (res->end >= mem->end)
+      {
+        covered = true;
+        break;
+      }
+
+      start = res->end + 1;
+    }
+
+    if (!covered)
+      func(start, mem->end);
+  }
+
+  trace_printf(" => Early allocator used %d bytes (peak %d), %d/%d regions\n",
+    memblock_used, memblock_peak, memblock_memory.count + memblock_reserved.count,
+    memblock_memory.capacity + memblock_reserved.capacity);
+}
+
+static void memblock_trace_list(memblock_list_t *list)
+{
+  for (size_t i = 0; i < list->count; i++)
+  {
+    memblock_region_t *region = &list->regions[i];
+    trace_printf(" => %0#18x -> %0#18x (%s)\n", region->start, region->end, list->name);
+  }
+}
+
+void memblock_trace(void)
+{
+  memblock_trace_list(&memblock_memory);
+  memblock_trace_list(&memblock_reserved);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_MM_MEMBLOCK_H
+#define ARC_MM_MEMBLOCK_H
+
+#include <arc/multiboot.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The early memory allocator, which is used before the physical memory
+ * manager has been set up (e.g. for the command line.) It keeps two lists of
+ * physical memory regions: the usable memory from the multiboot memory map,
+ * and the reserved memory (the kernel, modules and multiboot structures, and
+ * anything allocated with memblock_alloc().) Both lists live in a small static
+ * array to start with, and are moved to memory allocated from the lists
+ * themselves if they fill up.
+ *
+ * Memory is allocated from the top of the 32-bit physical address space
+ * downwards, so it can be accessed through phy32_to_virt().
+ */
+void memblock_init(multiboot_t *multiboot);
+
+/*
+ * Allocates 'len' bytes of memory, or returns zero if there is none left or
+ * the memory has already been handed to the physical memory manager. Memory
+ * which is still allocated then is never freed.
+ */
+void *memblock_alloc(size_t len);
+
+/* Frees memory returned by memblock_alloc(). */
+void memblock_free(void *ptr, size_t len);
+
+/*
+ * Calls 'func' with the first and last byte (inclusive) of every range of
+ * memory which isn't reserved, in order, and stops any more memory from being
+ * allocated. Called by the physical memory manager to take over the memory.
+ */
+typedef void (*memblock_func_t)(uintptr_t start, uintptr_t end);
+void memblock_release(memblock_func_t func);
+
+/* Prints out the usable and reserved memory regions. */
+void memblock_trace(void);
+
+#endif
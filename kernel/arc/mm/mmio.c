@@ -16,43 +16,325 @@
 
 #include <arc/mm/mmio.h>
 #include <arc/mm/align.h>
-#include <arc/mm/heap.h>
+#include <arc/mm/phy32.h>
+#include <arc/mm/pmm.h>
+#include <arc/mm/slab.h>
 #include <arc/mm/vmm.h>
+#include <arc/cpu/features.h>
+#include <arc/lock/spinlock.h>
+#include <arc/util/container.h>
+#include <arc/util/tree.h>
+#include <arc/panic.h>
+#include <stdbool.h>
 
-void *mmio_map(uintptr_t phy, size_t len, vm_acc_t flags)
+/*
+ * a mapping in the MMIO region. mappings of the same physical memory with the
+ * same flags are shared, so each one is reference counted.
+ */
+typedef struct
+{
+  tree_node_t virt_node; /* used by mmio_virt_tree */
+  tree_node_t phy_node;  /* used by mmio_phy_tree */
+  uintptr_t virt;
+  uintptr_t phy;
+  size_t len;
+  vm_acc_t flags;
+  int refs;
+
+  /* the free space between the previous mapping (or the region start) and us */
+  size_t gap;
+
+  /* the largest gap in the subtree rooted at this mapping */
+  size_t max_gap;
+} mmio_area_t;
+
+static int mmio_virt_compare(const void *left, const void *right);
+static int mmio_phy_compare(const void *left, const void *right);
+static void mmio_augment(tree_node_t *node);
+
+static kmem_cache_t mmio_area_cache = KMEM_CACHE("mmio_area", sizeof(mmio_area_t), _Alignof(mmio_area_t), 0);
+
+/* every mapping, ordered by virtual address */
+static tree_t mmio_virt_tree = TREE_EMPTY_AUGMENTED(&mmio_virt_compare, &mmio_augment);
+
+/* every mapping, ordered by physical address (and then virtual address) */
+static tree_t mmio_phy_tree = TREE_EMPTY(&mmio_phy_compare);
+
+static spinlock_t mmio_lock = SPIN_UNLOCKED;
+
+static int mmio_virt_compare(const void *left, const void *right)
+{
+  mmio_area_t *left_area = container_of(left, mmio_area_t, virt_node);
+  mmio_area_t *right_area = container_of(right, mmio_area_t, virt_node);
+
+  if (left_area->virt < right_area->virt)
+    return -1;
+  else if (left_area->virt > right_area->virt)
+    return 1;
+
+  return 0;
+}
+
+static int mmio_phy_compare(const void *left, const void *right)
+{
+  mmio_area_t *left_area = container_of(left, mmio_area_t, phy_node);
+  mmio_area_t *right_area = container_of(right, mmio_area_t, phy_node);
+
+  if (left_area->phy < right_area->phy)
+    return -1;
+  else if (left_area->phy > right_area->phy)
+    return 1;
+
+  if (left_area->virt < right_area->virt)
+    return -1;
+  else if (left_area->virt > right_area->virt)
+    return 1;
+
+  return 0;
+}
+
+static size_t mmio_subtree_max_gap(tree_node_t *node)
+{
+  if (!node)
+    return 0;
+
+  return container_of(node, mmio_area_t, virt_node)->max_gap;
+}
+
+static void mmio_augment(tree_node_t *node)
+{
+  mmio_area_t *area = container_of(node, mmio_area_t, virt_node);
+
+  size_t max_gap = area->gap;
+
+  size_t left_max_gap = mmio_subtree_max_gap(node->left);
+  if (left_max_gap > max_gap)
+    max_gap = left_max_gap;
+
+  size_t right_max_gap = mmio_subtree_max_gap(node->right);
+  if (right_max_gap > max_gap)
+    max_gap = right_max_gap;
+
+  area->max_gap = max_gap;
+}
+
+/*
+ * returns the lowest address in [start, end] which is congruent to 'off'
+ * modulo 'align' and is followed by 'len' free bytes, or zero
+ */
+static uintptr_t mmio_fit(uintptr_t start, uintptr_t end, size_t len, size_t align, size_t off)
+{
+  uintptr_t virt = (start - off + align - 1) / align * align + off;
+
+  if (virt > end || end - virt + 1 < len)
+    return 0;
+
+  return virt;
+}
+
+/* finds the lowest suitable address in the gaps before mappings in a subtree */
+static uintptr_t mmio_find_gap(tree_node_t *node, size_t len, size_t align, size_t off)
+{
+  if (mmio_subtree_max_gap(node) < len)
+    return 0;
+
+  uintptr_t virt = mmio_find_gap(node->left, len, align, off);
+  if (virt)
+    return virt;
+
+  mmio_area_t *area = container_of(node, mmio_area_t, virt_node);
+  if (area->gap >= len)
+  {
+    virt = mmio_fit(area->virt - area->gap, area->virt - 1, len, align, off);
+    if (virt)
+      return virt;
+  }
+
+  return mmio_find_gap(node->right, len, align, off);
+}
+
+/* finds some free address space, which is aligned for large pages if possible */
+static uintptr_t mmio_find_space(uintptr_t phy, size_t len)
+{
+  size_t align = FRAME_SIZE;
+  if (len >= FRAME_SIZE_1G && cpu_feature_supported(FEATURE_1G_PAGE))
+    align = FRAME_SIZE_1G;
+  else if (len >= FRAME_SIZE_2M)
+    align = FRAME_SIZE_2M;
+
+  size_t off = phy % align;
+
+  uintptr_t virt = mmio_find_gap(mmio_virt_tree.root, len, align, off);
+  if (virt)
+    return virt;
+
+  /* try the space after the last mapping */
+  uintptr_t start = VM_MMIO_START;
+  tree_node_t *last = tree_last(&mmio_virt_tree);
+  if (last)
+  {
+    mmio_area_t *area = container_of(last, mmio_area_t, virt_node);
+    start = area->virt + area->len;
+  }
+
+  return mmio_fit(start, VM_MMIO_END, len, align, off);
+}
+
+/* sets the gap before a mapping, from the end of the mapping before it */
+static void mmio_update_gap(mmio_area_t *area)
+{
+  uintptr_t start = VM_MMIO_START;
+  tree_node_t *prev = tree_prev(&area->virt_node);
+  if (prev)
+  {
+    mmio_area_t *prev_area = container_of(prev, mmio_area_t, virt_node);
+    start = prev_area->virt + prev_area->len;
+  }
+
+  area->gap = area->virt - start;
+  tree_update(&mmio_virt_tree, &area->virt_node);
+}
+
+/* finds an existing mapping of the same flags which covers a physical range */
+static mmio_area_t *mmio_find_phy(uintptr_t phy, size_t len, vm_acc_t flags)
+{
+  mmio_area_t key;
+  key.phy = phy;
+  key.virt = UINTPTR_MAX;
+
+  /* only the mappings which start at the same address as the closest are tried */
+  tree_node_t *node = tree_floor(&mmio_phy_tree, &key.phy_node);
+  uintptr_t floor_phy = node ? container_of(node, mmio_area_t, phy_node)->phy : 0;
+
+  for (; node; node = tree_prev(node))
+  {
+    mmio_area_t *area = container_of(node, mmio_area_t, phy_node);
+    if (area->phy != floor_phy)
+      break;
+
+    if (area->flags == flags && phy + len <= area->phy + area->len)
+      return area;
+  }
+
+  return 0;
+}
+
+/* finds the mapping which contains a virtual address */
+static mmio_area_t *mmio_find_virt(uintptr_t virt)
+{
+  mmio_area_t key;
+  key.virt = virt;
+
+  tree_node_t *node = tree_floor(&mmio_virt_tree, &key.virt_node);
+  if (!node)
+    return 0;
+
+  mmio_area_t *area = container_of(node, mmio_area_t, virt_node);
+  if (virt >= area->virt + area->len)
+    return 0;
+
+  return area;
+}
+
+static void *_mmio_map(uintptr_t phy, size_t len, vm_acc_t flags)
 {
   /* align the address and pad with extra length */
   uintptr_t aligned_phy = PAGE_ALIGN_REVERSE(phy);
-  size_t off = phy - aligned_phy;
-  len += off;
+  len = PAGE_ALIGN(len + phy - aligned_phy);
 
-  /* reserve some virtual memory in the heap */
-  uintptr_t aligned_virt = (uintptr_t) heap_reserve(len);
-  if (!aligned_virt)
+  /* share an existing mapping if there is one */
+  mmio_area_t *area = mmio_find_phy(aligned_phy, len, flags);
+  if (area)
+  {
+    area->refs++;
+    return (void *) (area->virt + phy - area->phy);
+  }
+
+  /* reserve some virtual memory in the MMIO region */
+  uintptr_t virt = mmio_find_space(aligned_phy, len);
+  if (!virt)
+    return 0;
+
+  area = kmem_cache_alloc(&mmio_area_cache);
+  if (!area)
     return 0;
 
   /* map the physical memory into virtual memory */
-  if (!vmm_map_range(aligned_virt, aligned_phy, len, flags))
+  if (!vmm_map_range(virt, aligned_phy, len, flags))
   {
-    heap_free((void *) aligned_virt);
+    kmem_cache_free(&mmio_area_cache, area);
     return 0;
   }
 
+  area->virt = virt;
+  area->phy = aligned_phy;
+  area->len = len;
+  area->flags = flags;
+  area->refs = 1;
+  area->gap = 0;
+
+  tree_insert(&mmio_virt_tree, &area->virt_node);
+  tree_insert(&mmio_phy_tree, &area->phy_node);
+
+  /* fill in our gap, and shrink the gap of the mapping after us */
+  mmio_update_gap(area);
+
+  tree_node_t *next = tree_next(&area->virt_node);
+  if (next)
+    mmio_update_gap(container_of(next, mmio_area_t, virt_node));
+
   /* return where the memory is mapped */
-  return (void *) (aligned_virt + off);
+  return (void *) (virt + phy - aligned_phy);
+}
+
+static void _mmio_unmap(void *virt, size_t len)
+{
+  mmio_area_t *area = mmio_find_virt((uintptr_t) virt);
+  if (!area || (uintptr_t) virt + len > area->virt + area->len)
+    panic("mmio_unmap() called with invalid pointer %0#18x", virt);
+
+  if (--area->refs > 0)
+    return;
+
+  /* unmap the physical memory */
+  vmm_unmap_range(area->virt, area->len);
+
+  /* the mapping after us absorbs our space into its gap */
+  tree_node_t *next = tree_next(&area->virt_node);
 
+  tree_remove(&mmio_virt_tree, &area->virt_node);
+  tree_remove(&mmio_phy_tree, &area->phy_node);
+  kmem_cache_free(&mmio_area_cache, area);
+
+  if (next)
+    mmio_update_gap(container_of(next, mmio_area_t, virt_node));
+}
+
+void *mmio_map(uintptr_t phy, size_t len, vm_acc_t flags)
+{
+  spin_lock(&mmio_lock);
+  void *ptr = _mmio_map(phy, len, flags);
+  spin_unlock(&mmio_lock);
+  return ptr;
 }
 
 void mmio_unmap(void *virt, size_t len)
 {
-  /* align the address and pad with extra length */
-  uintptr_t aligned_virt = PAGE_ALIGN_REVERSE((uintptr_t) virt);
-  size_t off = (uintptr_t) virt - aligned_virt;
-  len += off;
+  spin_lock(&mmio_lock);
+  _mmio_unmap(virt, len);
+  spin_unlock(&mmio_lock);
+}
 
-  /* unmap the physical memory */
-  vmm_unmap_range(aligned_virt, len);
+void *mmio_map_frame(uintptr_t frame)
+{
+  if (frame + FRAME_SIZE - 1 <= ZONE_LIMIT_DMA32)
+    return (void *) aphy32_to_virt(frame);
 
-  /* unreserve the virtual memory in the heap */
-  heap_free((void *) aligned_virt);
+  return mmio_map(frame, FRAME_SIZE, VM_R | VM_W);
+}
+
+void mmio_unmap_frame(uintptr_t frame, void *virt)
+{
+  if (frame + FRAME_SIZE - 1 > ZONE_LIMIT_DMA32)
+    mmio_unmap(virt, FRAME_SIZE);
 }
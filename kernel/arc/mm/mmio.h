@@ -21,6 +21,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* the MMIO region lives between the heap node pool and the heap (inclusive) */
+#define VM_MMIO_START (VM_HIGHER_HALF + FRAME_SIZE_1G)
+#define VM_MMIO_END   (VM_MMIO_START + FRAME_SIZE_512G - 1)
+
 /*
  * Maps an arbitrary physical address into the kernel's virtual address space.
  * This address and length do not need to be page aligned, this is dealt with
@@ -31,10 +35,26 @@
  * into the kernel's virtual memory, however, it is also used in a few other
  * miscellaneous ways e.g. for mapping another task's PML4 table into virtual
  * memory temporarily to copy from it.
+ *
+ * Device registers should be mapped with VM_UC and framebuffers with VM_WC,
+ * see the memory types in vm_acc_t.
+ *
+ * Mappings are made in their own region rather than on the heap. If the range
+ * is already mapped with the same flags, the existing mapping is shared (and
+ * reference counted), and ranges of 2M or more are placed so they can be
+ * mapped with large pages.
  */
 void *mmio_map(uintptr_t phy, size_t len, vm_acc_t flags);
 
-/* Unmaps a memory-mapped I/O area. */
+/* Unmaps a memory-mapped I/O area, once every user of it has done so. */
 void mmio_unmap(void *virt, size_t len);
 
+/*
+ * Maps a single 4K frame so the kernel can access its contents, using the
+ * existing mapping of the low 4 gigabytes if possible. It must be unmapped
+ * with mmio_unmap_frame().
+ */
+void *mmio_map_frame(uintptr_t frame);
+void mmio_unmap_frame(uintptr_t frame, void *virt);
+
 #endif
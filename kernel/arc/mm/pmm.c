@@ -17,10 +17,13 @@
 #include <arc/mm/pmm.h>
 #include <arc/mm/align.h>
 #include <arc/mm/common.h>
-#include <arc/mm/map.h>
+#include <arc/mm/memblock.h>
+#include <arc/mm/reclaim.h>
 #include <arc/cpu/tlb.h>
+#include <arc/cpu/features.h>
 #include <arc/lock/spinlock.h>
 #include <arc/util/container.h>
+#include <arc/cmdline.h>
 #include <arc/trace.h>
 #include <string.h>
 
@@ -29,6 +32,18 @@
 #define PMM_STACK_SIZE (TABLE_SIZE - 2)
 #define SZ_TO_IDX(s,z) ((s) * ZONE_COUNT + (z))
 
+/* the largest number of frames the huge page pools can hold */
+#define HUGE_POOL_SIZE_2M 8192 /* 16 GiB */
+#define HUGE_POOL_SIZE_1G 64   /* 64 GiB */
+
+/* cache colouring limits */
+#define COLOUR_MAX      256 /* the largest number of colours supported */
+#define COLOUR_BIN_SIZE 16  /* the number of frames kept for each colour */
+#define COLOUR_SCAN     64  /* frames searched before settling for any colour */
+
+/* the min watermark of each zone, as a fraction of the zone's free frames */
+#define WATERMARK_MIN_DIV 128
+
 typedef struct
 {
   uint64_t next;
@@ -41,6 +56,57 @@ static pmm_stack_t *pmm_stacks = (pmm_stack_t *) VM_STACK_OFFSET;
 static uint64_t *pmm_page_table = (uint64_t *) PAGE_TABLE_OFFSET;
 static spinlock_t pmm_lock = SPIN_UNLOCKED;
 static uint64_t pmm_counts[STACKS];
+static uintptr_t pmm_end_addr;
+
+/*
+ * frames set aside at boot for explicit huge page allocations, so they can
+ * still be satisfied once the free large frames have been split up. freed
+ * large frames top the pools back up to their target sizes
+ */
+typedef struct
+{
+  uint64_t count, target, capacity;
+  uint64_t *frames;
+} pmm_huge_pool_t;
+
+static uint64_t pmm_huge_frames_2m[HUGE_POOL_SIZE_2M];
+static uint64_t pmm_huge_frames_1g[HUGE_POOL_SIZE_1G];
+
+static pmm_huge_pool_t pmm_huge_pools[SIZE_COUNT] =
+{
+  [SIZE_2M] = { .capacity = HUGE_POOL_SIZE_2M, .frames = pmm_huge_frames_2m },
+  [SIZE_1G] = { .capacity = HUGE_POOL_SIZE_1G, .frames = pmm_huge_frames_1g }
+};
+
+/*
+ * frames whose addresses map to the same sets in the last level cache have
+ * the same colour. a small bin of free ZONE_STD 4K frames is kept for each
+ * colour in front of the stacks, so pmm_alloc_colour() can usually find a
+ * frame of the requested colour without searching
+ */
+typedef struct
+{
+  uint64_t count;
+  uint64_t frames[COLOUR_BIN_SIZE];
+} pmm_colour_bin_t;
+
+static pmm_colour_bin_t pmm_colour_bins[COLOUR_MAX];
+static uint64_t pmm_colours = 1;
+
+/*
+ * the number of free 4K frames in each zone (counting large frames as the 4K
+ * frames they contain), and the watermarks they are compared against. user
+ * allocations can't take a zone below min, which leaves a reserve for the
+ * kernel, and the reclaim thread is woken when a zone drops below low and
+ * keeps going until it is back above high
+ */
+typedef struct
+{
+  uint64_t min, low, high;
+} pmm_watermark_t;
+
+static uint64_t pmm_free_frames[ZONE_COUNT];
+static pmm_watermark_t pmm_watermarks[ZONE_COUNT];
 
 static const char *get_zone_str(int zone)
 {
@@ -101,6 +167,57 @@ static int get_zone(int size, uintptr_t addr)
     return ZONE_STD;
 }
 
+static uint64_t get_frames(int size)
+{
+  switch (size)
+  {
+    case SIZE_2M:
+      return FRAME_SIZE_2M / FRAME_SIZE;
+
+    case SIZE_1G:
+      return FRAME_SIZE_1G / FRAME_SIZE;
+  }
+
+  return 1;
+}
+
+/* records that a frame has been taken from or given back to the free stacks */
+static void account_alloc(int size, uintptr_t addr)
+{
+  uint64_t *free_frames = &pmm_free_frames[get_zone(size, addr)];
+  uint64_t frames = get_frames(size);
+  *free_frames = *free_frames > frames ? *free_frames - frames : 0;
+}
+
+static void account_free(int size, uintptr_t addr)
+{
+  pmm_free_frames[get_zone(size, addr)] += get_frames(size);
+}
+
+/* checks if taking 'frames' frames would leave every zone above its min */
+static bool above_min(uint64_t frames)
+{
+  uint64_t free_frames = 0, min = 0;
+  for (int zone = 0; zone < ZONE_COUNT; zone++)
+  {
+    free_frames += pmm_free_frames[zone];
+    min += pmm_watermarks[zone].min;
+  }
+
+  return free_frames >= min + frames;
+}
+
+static bool below_low(void)
+{
+  for (int zone = 0; zone < ZONE_COUNT; zone++)
+  {
+    if (pmm_free_frames[zone] < pmm_watermarks[zone].low)
+      return true;
+  }
+
+  return false;
+}
+
 static uintptr_t stack_switch(int size, int zone, uintptr_t addr)
 {
   int idx = SZ_TO_IDX(size, zone);
@@ -115,7 +232,40 @@ static uintptr_t stack_switch(int size, int zone, uintptr_t addr)
 
 static void _pmm_free(int size, int zone, uintptr_t addr);
 
-static uintptr_t _pmm_alloc(int size, int zone)
+static uint64_t get_colour(uintptr_t addr)
+{
+  return (addr / FRAME_SIZE) & (pmm_colours - 1);
+}
+
+/* puts a free 4K frame in its colour's bin, if there is room for it */
+static bool colour_bin_put(uintptr_t addr)
+{
+  if (pmm_colours == 1 || get_zone(SIZE_4K, addr) != ZONE_STD)
+    return false;
+
+  pmm_colour_bin_t *bin = &pmm_colour_bins[get_colour(addr)];
+  if (bin->count == COLOUR_BIN_SIZE)
+    return false;
+
+  bin->frames[bin->count++] = addr;
+  return true;
+}
+
+/* takes a frame of any colour from the bins, for when the stacks are empty */
+static uintptr_t colour_bin_take_any(void)
+{
+  for (uint64_t colour = 0; colour < pmm_colours; colour++)
+  {
+    pmm_colour_bin_t *bin = &pmm_colour_bins[colour];
+    if (bin->count > 0)
+      return bin->frames[--bin->count];
+  }
+
+  return 0;
+}
+
+/* allocates a frame from one zone, without falling back to the lower zones */
+static uintptr_t _pmm_alloc_zone(int size, int zone)
 {
   int idx = SZ_TO_IDX(size, zone);
   pmm_stack_t *stack = &pmm_stacks[idx];
@@ -136,13 +286,13 @@ static uintptr_t _pmm_alloc(int size, int zone)
     else
     {
       _pmm_free(SIZE_4K, stack_zone, addr);
-      return _pmm_alloc(size, zone);
+      return _pmm_alloc_zone(size, zone);
     }
   }
 
   if (size == SIZE_2M)
   {
-    uintptr_t addr = _pmm_alloc(SIZE_1G, zone);
+    uintptr_t addr = _pmm_alloc_zone(SIZE_1G, zone);
     if (addr)
     {
       for (uintptr_t off = FRAME_SIZE_2M; off < FRAME_SIZE_1G; off += FRAME_SIZE_2M)
@@ -153,7 +303,7 @@ static uintptr_t _pmm_alloc(int size, int zone)
   }
   else if (size == SIZE_4K)
   {
-    uintptr_t addr = _pmm_alloc(SIZE_2M, zone);
+    uintptr_t addr = _pmm_alloc_zone(SIZE_2M, zone);
     if (addr)
     {
       for (uintptr_t off = FRAME_SIZE; off < FRAME_SIZE_2M; off += FRAME_SIZE)
@@ -163,9 +313,17 @@ static uintptr_t _pmm_alloc(int size, int zone)
     }
   }
 
-  if (zone > ZONE_DMA)
+  return 0;
+}
+
+/* allocates a frame from the zone, or from the lower zones if it is empty */
+static uintptr_t _pmm_alloc(int size, int zone)
+{
+  for (; zone >= ZONE_DMA; zone--)
   {
-    return _pmm_alloc(size, zone - 1);
+    uintptr_t addr = _pmm_alloc_zone(size, zone);
+    if (addr)
+      return addr;
   }
 
   return 0;
@@ -247,66 +405,162 @@ static void pmm_push_range(uintptr_t start, uintptr_t end, int size)
     int idx = SZ_TO_IDX(size, zone);
     _pmm_free(size, zone, addr);
     pmm_counts[idx]++;
+    account_free(size, addr);
   }
 }
 
-void pmm_init(list_t *map)
+/* parses a decimal command line value, returning zero if it is malformed */
+static uint64_t pmm_parse_count(const char *str)
 {
-  for (int size = 0; size < SIZE_COUNT; size++)
+  if (!str)
+    return 0;
+
+  uint64_t count = 0;
+  for (; *str; str++)
   {
-    for (int zone = 0; zone < ZONE_COUNT; zone++)
-    {
-      int idx = SZ_TO_IDX(size, zone);
-      stack_switch(size, zone, (uintptr_t) &pmm_phy_stacks[idx] - VM_KERNEL_IMAGE);
-      memset(&pmm_stacks[idx], 0, sizeof(*pmm_stacks));
-    }
+    if (*str < '0' || *str > '9')
+      return 0;
+
+    count = count * 10 + (*str - '0');
   }
 
-  list_for_each(map, node)
+  return count;
+}
+
+static void pmm_huge_reserve(int size, const char *key)
+{
+  pmm_huge_pool_t *pool = &pmm_huge_pools[size];
+
+  uint64_t target = pmm_parse_count(cmdline_get(key));
+  if (target > pool->capacity)
+    target = pool->capacity;
+
+  /* 1G frames can't be mapped as 1G pages without CPU support, so don't waste them */
+  if (size == SIZE_1G && target > 0 && !cpu_feature_supported(FEATURE_1G_PAGE))
   {
-    mm_map_entry_t *entry = container_of(node, mm_map_entry_t, node);
+    trace_printf(" => Not reserving 1G huge pages, as the CPU doesn't support them\n");
+    return;
+  }
 
-    uintptr_t start = PAGE_ALIGN(entry->addr_start);
-    uintptr_t end = PAGE_ALIGN_REVERSE(entry->addr_end + 1);
+  /* only take frames from ZONE_STD, to spare the DMA zones */
+  while (pool->count < target)
+  {
+    uintptr_t addr = _pmm_alloc_zone(size, ZONE_STD);
+    if (!addr)
+      break;
 
-    uintptr_t start_2m = PAGE_ALIGN_2M(entry->addr_start);
-    uintptr_t end_2m = PAGE_ALIGN_REVERSE_2M(entry->addr_end + 1);
+    pool->frames[pool->count++] = addr;
+    account_alloc(size, addr);
+  }
 
-    uintptr_t start_1g = PAGE_ALIGN_1G(entry->addr_start);
-    uintptr_t end_1g = PAGE_ALIGN_REVERSE_1G(entry->addr_end + 1);
+  pool->target = pool->count;
+  if (pool->count > 0)
+    trace_printf(" => Reserved %d %s huge pages\n", pool->count, get_size_str(size));
+  if (pool->count < target)
+    trace_printf(" => Only %d of %d %s huge pages could be reserved\n", pool->count, target, get_size_str(size));
+}
 
-    if (start_1g <= end_1g)
-    {
-      if (start <= start_2m)
-        pmm_push_range(start, start_2m, SIZE_4K);
+static void pmm_watermark_init(void)
+{
+  for (int zone = 0; zone < ZONE_COUNT; zone++)
+  {
+    uint64_t frames = pmm_free_frames[zone];
+    if (!frames)
+      continue;
 
-      if (end_2m <= end)
-        pmm_push_range(end_2m, end, SIZE_4K);
+    pmm_watermark_t *mark = &pmm_watermarks[zone];
+    mark->min = frames / WATERMARK_MIN_DIV;
+    mark->low = mark->min * 5 / 4;
+    mark->high = mark->min * 3 / 2;
 
-      if (start_2m <= start_1g)
-        pmm_push_range(start_2m, start_1g, SIZE_2M);
+    trace_printf(" => Zone %s watermarks: min %d, low %d, high %d frames\n", get_zone_str(zone), mark->min, mark->low, mark->high);
+  }
+}
 
-      if (end_1g <= end_2m)
-        pmm_push_range(end_1g, end_2m, SIZE_2M);
+static void pmm_colour_init(void)
+{
+  const char *colour = cmdline_get("colour");
+  if (colour && strcmp(colour, "off") == 0)
+    return;
 
-      pmm_push_range(start_1g, end_1g, SIZE_1G);
-    }
-    else if (start_2m <= end_2m)
-    {
-      if (start <= start_2m)
-        pmm_push_range(start, start_2m, SIZE_4K);
+  /* there is a colour for each page in one way of the cache */
+  uint64_t colours = cpu_cache_way_size() / FRAME_SIZE;
+  if (colours > COLOUR_MAX)
+    colours = COLOUR_MAX;
 
-      if (end_2m <= end)
-        pmm_push_range(end_2m, end, SIZE_4K);
+  /* round down to a power of two, so colours can be found with a mask */
+  while (colours & (colours - 1))
+    colours &= colours - 1;
 
-      pmm_push_range(start_2m, end_2m, SIZE_2M);
-    }
-    else if (start <= end)
+  if (colours > 1)
+  {
+    pmm_colours = colours;
+    trace_printf(" => Cache colouring with %d colours\n", colours);
+  }
+}
+
+/* pushes the frames in a range of free memory handed over by memblock_release() */
+static void pmm_add_range(uintptr_t addr_start, uintptr_t addr_end)
+{
+  uintptr_t start = PAGE_ALIGN(addr_start);
+  uintptr_t end = PAGE_ALIGN_REVERSE(addr_end + 1);
+
+  if (end > pmm_end_addr)
+    pmm_end_addr = end;
+
+  uintptr_t start_2m = PAGE_ALIGN_2M(addr_start);
+  uintptr_t end_2m = PAGE_ALIGN_REVERSE_2M(addr_end + 1);
+
+  uintptr_t start_1g = PAGE_ALIGN_1G(addr_start);
+  uintptr_t end_1g = PAGE_ALIGN_REVERSE_1G(addr_end + 1);
+
+  if (start_1g <= end_1g)
+  {
+    if (start <= start_2m)
+      pmm_push_range(start, start_2m, SIZE_4K);
+
+    if (end_2m <= end)
+      pmm_push_range(end_2m, end, SIZE_4K);
+
+    if (start_2m <= start_1g)
+      pmm_push_range(start_2m, start_1g, SIZE_2M);
+
+    if (end_1g <= end_2m)
+      pmm_push_range(end_1g, end_2m, SIZE_2M);
+
+    pmm_push_range(start_1g, end_1g, SIZE_1G);
+  }
+  else if (start_2m <= end_2m)
+  {
+    if (start <= start_2m)
+      pmm_push_range(start, start_2m, SIZE_4K);
+
+    if (end_2m <= end)
+      pmm_push_range(end_2m, end, SIZE_4K);
+
+    pmm_push_range(start_2m, end_2m, SIZE_2M);
+  }
+  else if (start <= end)
+  {
+    pmm_push_range(start, end, SIZE_4K);
+  }
+}
+
+void pmm_init(void)
+{
+  for (int size = 0; size < SIZE_COUNT; size++)
+  {
+    for (int zone = 0; zone < ZONE_COUNT; zone++)
     {
-      pmm_push_range(start, end, SIZE_4K);
+      int idx = SZ_TO_IDX(size, zone);
+      stack_switch(size, zone, (uintptr_t) &pmm_phy_stacks[idx] - VM_KERNEL_IMAGE);
+      memset(&pmm_stacks[idx], 0, sizeof(*pmm_stacks));
     }
   }
 
+  /* take over all of the memory the early allocator isn't using */
+  memblock_release(&pmm_add_range);
+
   for (int zone = 0; zone < ZONE_COUNT; zone++)
   {
     for (int size = 0; size < SIZE_COUNT; size++)
@@ -321,6 +575,13 @@ void pmm_init(list_t *map)
       }
     }
   }
+
+  /* reserve 1G frames first, as reserving 2M frames might split them */
+  pmm_huge_reserve(SIZE_1G, "hugepages_1g");
+  pmm_huge_reserve(SIZE_2M, "hugepages");
+
+  pmm_watermark_init();
+  pmm_colour_init();
 }
 
 uintptr_t pmm_alloc(void)
@@ -338,12 +599,197 @@ uintptr_t pmm_allocz(int zone)
   return pmm_allocsz(SIZE_4K, zone);
 }
 
+/*
+ * finishes off an allocation by accounting for the frame and dropping the
+ * lock, waking the reclaim thread if a zone has fallen below its low mark
+ */
+static uintptr_t pmm_alloc_done(int size, uintptr_t addr)
+{
+  if (addr)
+    account_alloc(size, addr);
+
+  bool wake = below_low();
+  spin_unlock(&pmm_lock);
+
+  if (wake)
+    reclaim_wake();
+
+  return addr;
+}
+
 uintptr_t pmm_allocsz(int size, int zone)
 {
   spin_lock(&pmm_lock);
+
   uintptr_t addr = _pmm_alloc(size, zone);
+  if (!addr && size == SIZE_4K && zone == ZONE_STD)
+    addr = colour_bin_take_any();
+
+  return pmm_alloc_done(size, addr);
+}
+
+static uintptr_t _pmm_alloc_colour(uint64_t colour)
+{
+  if (pmm_colours == 1)
+    return _pmm_alloc(SIZE_4K, ZONE_STD);
+
+  colour &= pmm_colours - 1;
+
+  /* try the bin first */
+  pmm_colour_bin_t *bin = &pmm_colour_bins[colour];
+  if (bin->count > 0)
+    return bin->frames[--bin->count];
+
+  /*
+   * search the ZONE_STD stack, sorting the frames of other colours into their
+   * bins. only ZONE_STD frames are binned, so the lower zones aren't searched,
+   * and the search stops at the first frame whose bin is full - popping more
+   * would only shuffle the stack
+   */
+  for (int i = 0; i < COLOUR_SCAN; i++)
+  {
+    uintptr_t frame = _pmm_alloc_zone(SIZE_4K, ZONE_STD);
+    if (!frame)
+      break;
+
+    if (get_colour(frame) == colour || !colour_bin_put(frame))
+      return frame;
+  }
+
+  /* settle for another colour if there are none of this one */
+  uintptr_t addr = colour_bin_take_any();
+  if (addr)
+    return addr;
+
+  /* ZONE_STD is empty, so fall back to the lower zones without colouring */
+  return _pmm_alloc(SIZE_4K, ZONE_STD);
+}
+
+uintptr_t pmm_alloc_colour(uint64_t colour)
+{
+  spin_lock(&pmm_lock);
+
+  uintptr_t addr = _pmm_alloc_colour(colour);
+  return pmm_alloc_done(SIZE_4K, addr);
+}
+
+uintptr_t pmm_alloc_user(int size, uint64_t colour)
+{
+  spin_lock(&pmm_lock);
+
+  /* leave the frames below the min watermarks for the kernel */
+  uintptr_t addr = 0;
+  if (above_min(get_frames(size)))
+  {
+    if (size == SIZE_4K)
+      addr = _pmm_alloc_colour(colour);
+    else
+      addr = _pmm_alloc(size, ZONE_STD);
+  }
+
+  return pmm_alloc_done(size, addr);
+}
+
+uintptr_t pmm_huge_alloc(int size)
+{
+  spin_lock(&pmm_lock);
+
+  /* the pool's frames aren't counted as free, so don't account for them */
+  pmm_huge_pool_t *pool = &pmm_huge_pools[size];
+  if (size != SIZE_4K && pool->count > 0)
+  {
+    uintptr_t addr = pool->frames[--pool->count];
+    spin_unlock(&pmm_lock);
+    return addr;
+  }
+
+  uintptr_t addr = _pmm_alloc(size, ZONE_STD);
+  return pmm_alloc_done(size, addr);
+}
+
+uint64_t pmm_shortfall(void)
+{
+  spin_lock(&pmm_lock);
+
+  uint64_t frames = 0;
+  for (int zone = 0; zone < ZONE_COUNT; zone++)
+  {
+    uint64_t high = pmm_watermarks[zone].high;
+    if (pmm_free_frames[zone] < high)
+      frames += high - pmm_free_frames[zone];
+  }
+
   spin_unlock(&pmm_lock);
-  return addr;
+  return frames;
+}
+
+/*
+ * walks every page of a stack, calling func for each frame and removing the
+ * frames it returns true for. pages in the middle of the chain may be left
+ * partially full, which _pmm_alloc() copes with as each page has its own count
+ */
+static void stack_filter(int size, int zone, pmm_filter_t func, void *arg)
+{
+  int idx = SZ_TO_IDX(size, zone);
+  int table_idx = TABLE_SIZE - STACKS + idx;
+  pmm_stack_t *stack = &pmm_stacks[idx];
+
+  uintptr_t top = pmm_page_table[table_idx] & PG_ADDR_MASK;
+  for (;;)
+  {
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < stack->count; i++)
+    {
+      uintptr_t addr = stack->frames[i];
+      if (!func(addr, size, arg))
+        stack->frames[kept++] = addr;
+      else
+        account_alloc(size, addr);
+    }
+    stack->count = kept;
+
+    if (!stack->next)
+      break;
+
+    stack_switch(size, zone, stack->next);
+  }
+
+  /* put the top of the stack back in the window */
+  stack_switch(size, zone, top);
+}
+
+void pmm_filter(pmm_filter_t func, void *arg)
+{
+  spin_lock(&pmm_lock);
+
+  for (int zone = 0; zone < ZONE_COUNT; zone++)
+  {
+    stack_filter(SIZE_4K, zone, func, arg);
+    stack_filter(SIZE_2M, zone, func, arg);
+  }
+
+  for (uint64_t colour = 0; colour < pmm_colours; colour++)
+  {
+    pmm_colour_bin_t *bin = &pmm_colour_bins[colour];
+
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < bin->count; i++)
+    {
+      uintptr_t addr = bin->frames[i];
+      if (!func(addr, SIZE_4K, arg))
+        bin->frames[kept++] = addr;
+      else
+        account_alloc(SIZE_4K, addr);
+    }
+    bin->count = kept;
+  }
+
+  spin_unlock(&pmm_lock);
+}
+
+uintptr_t pmm_end(void)
+{
+  return pmm_end_addr;
 }
 
 void pmm_free(uintptr_t addr)
@@ -354,6 +800,20 @@ void pmm_free(uintptr_t addr)
 void pmm_frees(int size, uintptr_t addr)
 {
   spin_lock(&pmm_lock);
-  _pmm_free(size, get_zone(size, addr), addr);
+
+  /* top up the huge page pool if it has been drawn on */
+  pmm_huge_pool_t *pool = &pmm_huge_pools[size];
+  if (size != SIZE_4K && pool->count < pool->target)
+  {
+    pool->frames[pool->count++] = addr;
+  }
+  else
+  {
+    if (size != SIZE_4K || !colour_bin_put(addr))
+      _pmm_free(size, get_zone(size, addr), addr);
+
+    account_free(size, addr);
+  }
+
   spin_unlock(&pmm_lock);
 }
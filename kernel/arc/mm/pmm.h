@@ -17,7 +17,7 @@
 #ifndef ARC_MM_PMM_H
 #define ARC_MM_PMM_H
 
-#include <arc/util/list.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* where the stacks start in virtual memory */
@@ -33,12 +33,51 @@
 #define ZONE_LIMIT_DMA   0xFFFFFF   /* 2^24 - 1 */
 #define ZONE_LIMIT_DMA32 0xFFFFFFFF /* 2^32 - 1 */
 
-void pmm_init(list_t *map);
+void pmm_init(void);
 uintptr_t pmm_alloc(void);
 uintptr_t pmm_allocs(int size);
 uintptr_t pmm_allocz(int zone);
 uintptr_t pmm_allocsz(int size, int zone);
+
+/*
+ * allocates a 4K frame of the given cache colour (any value can be passed,
+ * it is reduced modulo the number of colours), falling back to any colour if
+ * none is free. this is the same as pmm_alloc() if colouring is disabled
+ */
+uintptr_t pmm_alloc_colour(uint64_t colour);
+
+/*
+ * allocates a frame to back user memory, which fails rather than taking the
+ * free frames below the min watermarks - they are kept in reserve for the
+ * kernel. the colour is only used for 4K frames
+ */
+uintptr_t pmm_alloc_user(int size, uint64_t colour);
+
+/*
+ * allocates a 2M or 1G frame for an explicit huge page request, using the
+ * pool reserved with the hugepages and hugepages_1g command line options
+ * before falling back to the regular free frames
+ */
+uintptr_t pmm_huge_alloc(int size);
+
 void pmm_free(uintptr_t addr);
 void pmm_frees(int size, uintptr_t addr);
 
+/*
+ * calls func for every free 4K and 2M frame, removing the frames it returns
+ * true for from the free stacks (so they belong to the caller.) func is called
+ * with the PMM locked, so it must not allocate or free any frames
+ */
+typedef bool (*pmm_filter_t)(uintptr_t addr, int size, void *arg);
+void pmm_filter(pmm_filter_t func, void *arg);
+
+/*
+ * returns the number of 4K frames which must be freed to bring every zone back
+ * above its high watermark, which is zero if there is no memory pressure
+ */
+uint64_t pmm_shortfall(void);
+
+/* returns the address just past the highest usable physical frame */
+uintptr_t pmm_end(void);
+
 #endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/mm/reclaim.h>
+#include <arc/mm/compact.h>
+#include <arc/mm/kstack.h>
+#include <arc/mm/malloc.h>
+#include <arc/mm/pmm.h>
+#include <arc/mm/slab.h>
+#include <arc/mm/swap.h>
+#include <arc/proc/kthread.h>
+#include <arc/proc/thread.h>
+#include <arc/panic.h>
+#include <arc/trace.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdnoreturn.h>
+
+/* the number of milliseconds between checks if the thread isn't woken */
+#define RECLAIM_INTERVAL 1000
+
+/* the most user pages swapped out in one go, so faults can get a look in */
+#define RECLAIM_BATCH 256
+
+static thread_t *reclaim_thread;
+static int reclaim_pending;
+
+/* frees some memory, returning false if nothing could be freed */
+static bool reclaim_shrink(uint64_t shortfall, size_t *freed)
+{
+  /* the kernel's caches are cheap to refill, so shrink them first */
+  size_t frames = kmem_reap() + kstack_reap();
+  bool trimmed = malloc_reclaim() > 0;
+
+  /* then swap out cold user pages for whatever is left */
+  if (frames < shortfall)
+  {
+    uint64_t target = shortfall - frames;
+    if (target > RECLAIM_BATCH)
+      target = RECLAIM_BATCH;
+
+    frames += swap_reclaim(target);
+  }
+
+  *freed += frames;
+  return frames > 0 || trimmed;
+}
+
+static void reclaim_balance(void)
+{
+  size_t freed = 0;
+
+  uint64_t shortfall;
+  while ((shortfall = pmm_shortfall()) > 0)
+  {
+    if (!reclaim_shrink(shortfall, &freed))
+      break;
+  }
+
+  if (freed > 0)
+    trace_printf("reclaim: freed %d frames\n", freed);
+}
+
+static noreturn void reclaim_daemon(void)
+{
+  for (;;)
+  {
+    thread_sleep(RECLAIM_INTERVAL);
+    __sync_lock_release(&reclaim_pending);
+    reclaim_balance();
+    compact_run();
+  }
+}
+
+void reclaim_init(void)
+{
+  thread_t *thread = kthread_create(&reclaim_daemon);
+  if (!thread)
+    panic("couldn't create reclaim thread");
+
+  reclaim_thread = thread;
+}
+
+void reclaim_wake(void)
+{
+  /* the PMM is up long before threads are, so the thread may not exist yet */
+  thread_t *thread = reclaim_thread;
+  if (!thread)
+    return;
+
+  /* only wake the thread once until it gets round to running */
+  if (__sync_lock_test_and_set(&reclaim_pending, 1))
+    return;
+
+  thread_wake(thread);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_MM_RECLAIM_H
+#define ARC_MM_RECLAIM_H
+
+/*
+ * Asynchronous reclaim. The PMM wakes a kernel thread when a zone falls below
+ * its low watermark, which shrinks the kernel's caches and swaps out cold
+ * user pages until every zone is back above its high watermark (or nothing
+ * more can be freed.) The thread also runs any compaction asked for with
+ * compact_request().
+ */
+void reclaim_init(void);
+
+/* wakes the reclaim thread, if it has been started */
+void reclaim_wake(void);
+
+#endif
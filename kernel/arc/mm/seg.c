@@ -17,178 +17,657 @@
 #include <arc/mm/seg.h>
 #include <arc/mm/align.h>
 #include <arc/mm/common.h>
+#include <arc/mm/compact.h>
+#include <arc/mm/ksm.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/phy32.h>
+#include <arc/mm/pmm.h>
 #include <arc/mm/range.h>
+#include <arc/mm/reclaim.h>
+#include <arc/mm/slab.h>
+#include <arc/mm/swap.h>
+#include <arc/mm/vmm.h>
 #include <arc/proc/proc.h>
+#include <arc/proc/thread.h>
+#include <arc/lock/intr.h>
+#include <arc/cpu/features.h>
+#include <arc/smp/cpu.h>
 #include <arc/util/container.h>
 #include <arc/trace.h>
 #include <assert.h>
-#include <stdlib.h>
+#include <string.h>
 
-static bool _seg_alloc_at(seg_t *segments, void *ptr, size_t size, vm_acc_t flags)
+/* the number of times a fault or map waits for the reclaim thread when out of frames */
+#define SEG_WAIT_RETRIES 10
+
+/* the number of milliseconds spent waiting for the reclaim thread each time */
+#define SEG_WAIT_MS 10
+
+/* the number of pages after a fault which are mapped in sequential blocks */
+#define SEG_FAULT_AROUND 15
+
+/* the colour offset given to each new address space is this far from the last */
+#define SEG_COLOUR_STEP 17
+
+static kmem_cache_t seg_block_cache = KMEM_CACHE("seg_block", sizeof(seg_block_t), _Alignof(seg_block_t), 0);
+static uint64_t seg_next_colour;
+
+static int seg_block_compare(const void *left, const void *right)
 {
-  uintptr_t addr = (uintptr_t) ptr;
-  assert((size % FRAME_SIZE) == 0);
+  seg_block_t *left_block = container_of(left, seg_block_t, node);
+  seg_block_t *right_block = container_of(right, seg_block_t, node);
+
+  if (left_block->start < right_block->start)
+    return -1;
+  else if (left_block->start > right_block->start)
+    return 1;
+
+  return 0;
+}
+
+static size_t seg_subtree_max_free(tree_node_t *node)
+{
+  if (!node)
+    return 0;
+
+  return container_of(node, seg_block_t, node)->max_free;
+}
+
+static void seg_block_augment(tree_node_t *node)
+{
+  seg_block_t *block = container_of(node, seg_block_t, node);
+
+  size_t max_free = 0;
+  if (block->state == SEG_FREE)
+    max_free = block->end - block->start + 1;
+
+  size_t left_max_free = seg_subtree_max_free(node->left);
+  if (left_max_free > max_free)
+    max_free = left_max_free;
+
+  size_t right_max_free = seg_subtree_max_free(node->right);
+  if (right_max_free > max_free)
+    max_free = right_max_free;
 
-  list_for_each(&segments->block_list, node)
+  block->max_free = max_free;
+}
+
+/* finds the block which contains the given address */
+static seg_block_t *_seg_find(seg_t *segments, uintptr_t addr)
+{
+  seg_block_t key;
+  key.start = addr;
+
+  tree_node_t *node = tree_floor(&segments->block_tree, &key.node);
+  if (!node)
+    return 0;
+
+  seg_block_t *block = container_of(node, seg_block_t, node);
+  if (addr > block->end)
+    return 0;
+
+  return block;
+}
+
+/* finds the free block with the lowest address which is at least 'size' bytes */
+static seg_block_t *_seg_find_free(seg_t *segments, size_t size)
+{
+  tree_node_t *node = segments->block_tree.root;
+  while (node && seg_subtree_max_free(node) >= size)
   {
-    seg_block_t *block = container_of(node, seg_block_t, node);
-    if (addr >= block->start && (addr + size - 1) <= block->end)
+    /* prefer the left subtree, as it has lower addresses */
+    if (seg_subtree_max_free(node->left) >= size)
     {
-      seg_block_t *left_block = 0, *right_block = 0;
+      node = node->left;
+      continue;
+    }
 
-      /* allocate underlying page frames and map the region into memory */
-      if (!range_alloc(addr, size, flags))
-        return false;
+    seg_block_t *block = container_of(node, seg_block_t, node);
+    if (block->state == SEG_FREE && (block->end - block->start + 1) >= size)
+      return block;
 
-      /* determine if left and right parts of the block can be split away */
-      bool left_split = addr != block->start;
-      bool right_split = (addr + size - 1) != block->end;
+    node = node->right;
+  }
 
-      /* allocate block node for the left side */
-      if (left_split)
-      {
-        left_block = malloc(sizeof(*left_block));
-        if (!left_block)
-        {
-          range_free(addr, size);
-          return false;
-        }
-      }
+  return 0;
+}
 
-      /* allocate block node for the right side */
-      if (right_split)
-      {
-        right_block = malloc(sizeof(*right_block));
-        if (!right_block)
-        {
-          range_free(addr, size);
-          if (left_split)
-            free(left_block);
-          return false;
-        }
-      }
+/* makes sure a block starts at the given address, splitting one if required */
+static bool _seg_split(seg_t *segments, uintptr_t addr)
+{
+  seg_block_t *block = _seg_find(segments, addr);
+  if (!block || block->start == addr)
+    return true;
 
-      /* split the left side of the block away */
-      if (left_split)
-      {
-        left_block->start = block->start;
-        left_block->end = addr - 1;
-        left_block->state = SEG_FREE;
-        block->start = addr;
+  /* large pages can't be split between two blocks */
+  if (block->state == SEG_ALLOCATED)
+  {
+    int size = vmm_size(addr);
+    if (size == SIZE_2M && (addr % FRAME_SIZE_2M) != 0)
+      return false;
+    if (size == SIZE_1G && (addr % FRAME_SIZE_1G) != 0)
+      return false;
+  }
 
-        list_insert_before(&segments->block_list, &block->node, &left_block->node);
-      }
+  seg_block_t *right_block = kmem_cache_alloc(&seg_block_cache);
+  if (!right_block)
+    return false;
 
-      /* split the right side of the block away */
-      if (right_split)
-      {
-        right_block->start = addr + size;
-        right_block->end = block->end;
-        right_block->state = SEG_FREE;
-        block->end = addr + size - 1;
+  right_block->start = addr;
+  right_block->end = block->end;
+  right_block->state = block->state;
+  right_block->flags = block->flags;
+  right_block->map_flags = block->map_flags;
 
-        list_insert_after(&segments->block_list, &block->node, &right_block->node);
-      }
+  /*
+   * shrinking the block keeps it in the same position relative to the other
+   * blocks, so only the free sizes need updating before the new block is
+   * inserted
+   */
+  block->end = addr - 1;
+  tree_update(&segments->block_tree, &block->node);
+  tree_insert(&segments->block_tree, &right_block->node);
+  return true;
+}
 
-      /* mark this block as allocated */
-      block->state = SEG_ALLOCATED;
-      block->flags = flags;
-      return true;
+/* merges a free block with its neighbours, if they are also free */
+static void _seg_merge(seg_t *segments, seg_block_t *block)
+{
+  assert(block->state == SEG_FREE);
+
+  /* try to merge with the left block */
+  tree_node_t *left_node = tree_prev(&block->node);
+  if (left_node)
+  {
+    seg_block_t *left_block = container_of(left_node, seg_block_t, node);
+    if (left_block->state == SEG_FREE)
+    {
+      tree_remove(&segments->block_tree, &left_block->node);
+      block->start = left_block->start;
+      kmem_cache_free(&seg_block_cache, left_block);
     }
   }
 
+  /* try to merge with the right block */
+  tree_node_t *right_node = tree_next(&block->node);
+  if (right_node)
+  {
+    seg_block_t *right_block = container_of(right_node, seg_block_t, node);
+    if (right_block->state == SEG_FREE)
+    {
+      tree_remove(&segments->block_tree, &right_block->node);
+      block->end = right_block->end;
+      kmem_cache_free(&seg_block_cache, right_block);
+    }
+  }
+
+  tree_update(&segments->block_tree, &block->node);
+}
+
+/* frees the frames behind a block and marks it as free */
+static void _seg_release(seg_t *segments, seg_block_t *block)
+{
+  if (block->state == SEG_ALLOCATED)
+  {
+    size_t block_size = block->end - block->start + 1;
+    range_free(block->start, block_size);
+  }
+
+  block->state = SEG_FREE;
+  _seg_merge(segments, block);
+}
+
+/* marks a region as allocated, without allocating any physical frames */
+static seg_block_t *_seg_reserve_at(seg_t *segments, uintptr_t addr, size_t size)
+{
+  assert((addr % FRAME_SIZE) == 0 && (size % FRAME_SIZE) == 0);
+
+  /* find the free block which contains the requested region */
+  seg_block_t *block = _seg_find(segments, addr);
+  if (!block || block->state != SEG_FREE || size == 0 || (addr + size - 1) > block->end)
+    return 0;
+
+  /* split the parts either side of the region away */
+  if (!_seg_split(segments, addr) || !_seg_split(segments, addr + size))
+  {
+    _seg_merge(segments, _seg_find(segments, addr));
+    return 0;
+  }
+
+  /* mark the region as allocated */
+  block = _seg_find(segments, addr);
+  block->state = SEG_ALLOCATED;
+  block->flags = 0;
+  block->map_flags = 0;
+  tree_update(&segments->block_tree, &block->node);
+  return block;
+}
+
+/*
+ * as above, but the region is placed at the lowest free address which is a
+ * multiple of 'align'
+ */
+static seg_block_t *_seg_reserve(seg_t *segments, size_t size, size_t align)
+{
+  /* leave enough room to round the start of the free block up */
+  seg_block_t *block = _seg_find_free(segments, size + align - FRAME_SIZE);
+  if (!block)
+    return 0;
+
+  uintptr_t addr = block->start + align - 1;
+  addr -= addr % align;
+  return _seg_reserve_at(segments, addr, size);
+}
+
+/* zeroes a newly allocated frame before it is mapped into user space */
+static bool seg_clear_frame(uintptr_t frame, size_t len)
+{
+  if (frame + len - 1 <= ZONE_LIMIT_DMA32)
+  {
+    memclr((void *) aphy32_to_virt(frame), len);
+    return true;
+  }
+
+  void *ptr = mmio_map(frame, len, VM_R | VM_W);
+  if (!ptr)
+    return false;
+
+  memclr(ptr, len);
+  mmio_unmap(ptr, len);
+  return true;
+}
+
+/*
+ * maps a zeroed large page over addr, if the block covers the whole page.
+ * blocks which asked for large pages explicitly draw on the huge page pool,
+ * and ask for physical memory to be compacted in the background if that is
+ * empty
+ */
+static bool _seg_fault_in_large(seg_block_t *block, uintptr_t addr, int size)
+{
+  if (size == SIZE_1G && !cpu_feature_supported(FEATURE_1G_PAGE))
+    return false;
+
+  size_t len = size == SIZE_1G ? FRAME_SIZE_1G : FRAME_SIZE_2M;
+  uintptr_t page = addr - (addr % len);
+  if (page < block->start || (page + len - 1) > block->end)
+    return false;
+
+  uintptr_t frame;
+  if (block->map_flags & (SEG_HUGE_2M | SEG_HUGE_1G))
+  {
+    frame = pmm_huge_alloc(size);
+    if (!frame)
+      compact_request(size);
+  }
+  else
+  {
+    frame = pmm_alloc_user(size, 0);
+  }
+
+  if (!frame)
+    return false;
+
+  if (seg_clear_frame(frame, len) && vmm_maps(page, frame, block->flags, size))
+    return true;
+
+  pmm_frees(size, frame);
   return false;
 }
 
+/*
+ * allocates a frame for the page containing addr, if it isn't mapped, which
+ * is either zeroed or filled with the page's contents if it was swapped out
+ */
+static bool _seg_fault_in(seg_t *segments, seg_block_t *block, uintptr_t addr)
+{
+  /* another thread may have faulted the page in already */
+  if (vmm_size(addr) != -1)
+    return true;
+
+  /* use a large page if the block asks for one and covers the whole page */
+  if ((block->map_flags & SEG_HUGE_1G) && _seg_fault_in_large(block, addr, SIZE_1G))
+    return true;
+  if ((block->map_flags & (SEG_HUGE | SEG_HUGE_2M)) && _seg_fault_in_large(block, addr, SIZE_2M))
+    return true;
+
+  /*
+   * otherwise use a 4K page. the colour is offset per process, so the same
+   * virtual address in different processes doesn't map to the same cache sets
+   */
+  uintptr_t page = PAGE_ALIGN_REVERSE(addr);
+  uintptr_t colour = page / FRAME_SIZE + segments->colour;
+  uintptr_t frame = pmm_alloc_user(SIZE_4K, colour);
+  if (!frame)
+    return false;
+
+  switch (swap_in(page, frame, block->flags))
+  {
+    case SWAP_IN_DONE:
+      return true;
+
+    case SWAP_IN_FAILED:
+      pmm_free(frame);
+      return false;
+
+    case SWAP_IN_NONE:
+      break;
+  }
+
+  if (!seg_clear_frame(frame, FRAME_SIZE) || !vmm_map(page, frame, block->flags))
+  {
+    pmm_free(frame);
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * faults in every page of a block up front, using large pages wherever the
+ * block covers a whole aligned one. as with demand faults, each frame is
+ * zeroed before it is mapped, so read-only blocks can be populated too
+ */
+static bool _seg_populate(seg_t *segments, seg_block_t *block)
+{
+  for (uintptr_t page = block->start; page < block->end;)
+  {
+    if ((page % FRAME_SIZE_1G) == 0 && _seg_fault_in_large(block, page, SIZE_1G))
+      page += FRAME_SIZE_1G;
+    else if ((page % FRAME_SIZE_2M) == 0 && _seg_fault_in_large(block, page, SIZE_2M))
+      page += FRAME_SIZE_2M;
+    else if (_seg_fault_in(segments, block, page))
+      page += FRAME_SIZE;
+    else
+      return false;
+  }
+
+  return true;
+}
+
+static bool _seg_alloc_at(seg_t *segments, void *ptr, size_t size, vm_acc_t flags)
+{
+  uintptr_t addr = (uintptr_t) ptr;
+  assert((size % FRAME_SIZE) == 0);
+
+  seg_block_t *block = _seg_reserve_at(segments, addr, size);
+  if (!block)
+    return false;
+
+  block->flags = flags;
+
+  /* allocate zeroed frames and map the region into memory */
+  if (!_seg_populate(segments, block))
+  {
+    _seg_release(segments, block);
+    return false;
+  }
+
+  return true;
+}
+
 static void *_seg_alloc(seg_t *segments, size_t size, vm_acc_t flags)
 {
   assert((size % FRAME_SIZE) == 0);
 
-  list_for_each(&segments->block_list, node)
+  seg_block_t *block = _seg_reserve(segments, size, FRAME_SIZE);
+  if (!block)
+    return 0;
+
+  block->flags = flags;
+
+  /* allocate zeroed frames and map the region into memory */
+  if (!_seg_populate(segments, block))
   {
-    seg_block_t *block = container_of(node, seg_block_t, node);
-    size_t block_size = block->end - block->start + 1;
-    if (block->state == SEG_FREE && block_size >= size)
-    {
-      uintptr_t addr = (uintptr_t) block->start;
+    _seg_release(segments, block);
+    return 0;
+  }
 
-      /* allocate underlying page frames and map the region into memory */
-      if (!range_alloc(addr, size, flags))
-        return 0;
+  return (void *) block->start;
+}
 
-      /* split the right part of the block away */
-      if (block_size != size)
-      {
-        seg_block_t *right_block = malloc(sizeof(*block));
-        if (!right_block)
-        {
-          range_free(addr, size);
-          return 0;
-        }
+static void _seg_free(seg_t *segments, void *ptr)
+{
+  uintptr_t addr = (uintptr_t) ptr;
 
-        right_block->start = addr + size;
-        right_block->end = block->end;
-        right_block->state = SEG_FREE;
-        block->end = addr + size - 1;
+  /* find the allocated block which starts at this address */
+  seg_block_t *block = _seg_find(segments, addr);
+  if (!block || block->state == SEG_FREE || block->start != addr)
+    return;
 
-        list_insert_after(&segments->block_list, &block->node, &right_block->node);
+  _seg_release(segments, block);
+}
+
+/* as well as returning null, sets no_mem if the block couldn't be backed */
+static void *_seg_map(seg_t *segments, void *ptr, size_t size, vm_acc_t flags, int map_flags, bool *no_mem)
+{
+  /* blocks backed by large pages must be made up of whole, aligned pages */
+  int page_size = SIZE_4K;
+  size_t align = FRAME_SIZE;
+  if (map_flags & SEG_HUGE_1G)
+  {
+    /* the block could never be backed if the CPU doesn't support 1G pages */
+    if (!cpu_feature_supported(FEATURE_1G_PAGE))
+      return 0;
+
+    page_size = SIZE_1G;
+    align = FRAME_SIZE_1G;
+    size = PAGE_ALIGN_1G(size);
+  }
+  else if (map_flags & SEG_HUGE_2M)
+  {
+    page_size = SIZE_2M;
+    align = FRAME_SIZE_2M;
+    size = PAGE_ALIGN_2M(size);
+  }
+
+  /* try to place the block at the requested address first */
+  seg_block_t *block = 0;
+  if (ptr && ((uintptr_t) ptr % align) == 0)
+    block = _seg_reserve_at(segments, (uintptr_t) ptr, size);
+
+  if (!block)
+  {
+    if (map_flags & SEG_FIXED)
+      return 0;
+
+    block = _seg_reserve(segments, size, align);
+    if (!block)
+      return 0;
+  }
+
+  block->flags = flags;
+  block->map_flags = map_flags;
+
+  /* allocate every large page now, so the block's backing is guaranteed */
+  if (page_size != SIZE_4K && (flags & VM_R))
+  {
+    for (uintptr_t page = block->start; page < block->end; page += align)
+    {
+      if (!_seg_fault_in_large(block, page, page_size))
+      {
+        _seg_release(segments, block);
+        *no_mem = true;
+        return 0;
       }
+    }
+
+    return (void *) block->start;
+  }
+
+  /* allocate the frames now if asked to (and if the memory can be accessed) */
+  if ((map_flags & SEG_POPULATE) && (flags & VM_R) && !_seg_populate(segments, block))
+  {
+    _seg_release(segments, block);
+    *no_mem = true;
+    return 0;
+  }
+
+  return (void *) block->start;
+}
 
-      /* mark this block as allocated and return a pointer to it */
-      block->state = SEG_ALLOCATED;
-      block->flags = flags;
-      return (void *) block->start;
+static bool _seg_unmap(seg_t *segments, uintptr_t addr, size_t size)
+{
+  uintptr_t end = addr + size;
+  if (!_seg_split(segments, addr) || !_seg_split(segments, end))
+    return false;
+
+  /* release every allocated block in the range */
+  while (addr < end)
+  {
+    seg_block_t *block = _seg_find(segments, addr);
+    if (!block)
+      break;
+
+    addr = block->end + 1;
+    if (block->state == SEG_ALLOCATED)
+      _seg_release(segments, block);
+  }
+
+  return true;
+}
+
+/*
+ * checks a range is entirely allocated, and splits the blocks at either end so
+ * the range is covered by whole blocks
+ */
+static bool _seg_isolate(seg_t *segments, uintptr_t addr, size_t size)
+{
+  uintptr_t end = addr + size;
+
+  /* check the whole range is allocated before changing anything */
+  for (uintptr_t cur = addr; cur < end;)
+  {
+    seg_block_t *block = _seg_find(segments, cur);
+    if (!block || block->state != SEG_ALLOCATED)
+      return false;
+
+    cur = block->end + 1;
+  }
+
+  return _seg_split(segments, addr) && _seg_split(segments, end);
+}
+
+static bool _seg_protect(seg_t *segments, uintptr_t addr, size_t size, vm_acc_t flags)
+{
+  uintptr_t end = addr + size;
+  if (!_seg_isolate(segments, addr, size))
+    return false;
+
+  /* update the blocks */
+  for (uintptr_t cur = addr; cur < end;)
+  {
+    seg_block_t *block = _seg_find(segments, cur);
+    block->flags = flags;
+    cur = block->end + 1;
+  }
+
+  /* update the page tables in one go */
+  vmm_protect_range(addr, size, flags);
+  return true;
+}
+
+/* the outcome of a fault */
+typedef enum
+{
+  SEG_FAULT_DONE,    /* the page is mapped */
+  SEG_FAULT_INVALID, /* the access isn't allowed */
+  SEG_FAULT_NO_MEM   /* the access is allowed, but a frame couldn't be allocated */
+} seg_fault_t;
+
+static seg_fault_t _seg_fault(seg_t *segments, uintptr_t addr, bool write, bool exec)
+{
+  seg_block_t *block = _seg_find(segments, addr);
+  if (!block || block->state != SEG_ALLOCATED)
+    return SEG_FAULT_INVALID;
+
+  /* check the block allows this type of access */
+  if (!(block->flags & VM_R))
+    return SEG_FAULT_INVALID;
+  if (write && !(block->flags & VM_W))
+    return SEG_FAULT_INVALID;
+  if (exec && !(block->flags & VM_X))
+    return SEG_FAULT_INVALID;
+
+  /* writes to merged pages fault, so the writer can be given its own copy */
+  uintptr_t page = PAGE_ALIGN_REVERSE(addr);
+  if (write && !ksm_unshare(page, page / FRAME_SIZE + segments->colour, block->flags))
+    return SEG_FAULT_NO_MEM;
+
+  if (!_seg_fault_in(segments, block, addr))
+    return SEG_FAULT_NO_MEM;
+
+  /*
+   * if the block is accessed sequentially, fault in the following pages now
+   * to save taking a fault for each of them. this is only an optimisation, so
+   * failures are ignored
+   */
+  if (block->map_flags & SEG_SEQUENTIAL)
+  {
+    for (int i = 1; i <= SEG_FAULT_AROUND; i++)
+    {
+      uintptr_t next_page = page + i * FRAME_SIZE;
+      if (next_page > block->end || !_seg_fault_in(segments, block, next_page))
+        break;
     }
   }
 
-  return 0;
+  return SEG_FAULT_DONE;
 }
 
-static void _seg_free(seg_t *segments, void *ptr)
+static bool _seg_advise(seg_t *segments, uintptr_t addr, size_t size, seg_advice_t advice)
 {
-  uintptr_t addr = (uintptr_t) ptr;
+  uintptr_t end = addr + size;
+  if (!_seg_isolate(segments, addr, size))
+    return false;
 
-  list_for_each(&segments->block_list, node)
+  for (uintptr_t cur = addr; cur < end;)
   {
-    seg_block_t *block = container_of(node, seg_block_t, node);
-    if (block->state != SEG_FREE && block->start == addr)
+    seg_block_t *block = _seg_find(segments, cur);
+    size_t block_size = block->end - block->start + 1;
+    cur = block->end + 1;
+
+    switch (advice)
     {
-      /* free the underlying page frames and unmap the virtual memory */
-      size_t block_size = block->end - block->start + 1;
-      range_free(addr, block_size);
+      case SEG_ADV_NORMAL:
+        block->map_flags &= ~SEG_SEQUENTIAL;
+        break;
 
-      /* unmark this block as being allocated */
-      block->state = SEG_FREE;
+      case SEG_ADV_SEQUENTIAL:
+        block->map_flags |= SEG_SEQUENTIAL;
+        break;
 
-      /* try to merge with the left block */
-      if (block->node.prev)
-      {
-        seg_block_t *left_block = container_of(block->node.prev, seg_block_t, node);
-        if (left_block->state == SEG_FREE)
-        {
-          block->start = left_block->start;
+      case SEG_ADV_HUGEPAGE:
+        block->map_flags |= SEG_HUGE;
+        break;
 
-          list_remove(&segments->block_list, &left_block->node);
-          free(left_block);
-        }
-      }
+      case SEG_ADV_NOHUGEPAGE:
+        block->map_flags &= ~SEG_HUGE;
+        break;
 
-      /* try to merge with the right block */
-      if (block->node.next)
-      {
-        seg_block_t *right_block = container_of(block->node.next, seg_block_t, node);
-        if (right_block->state == SEG_FREE)
-        {
-          block->end = right_block->end;
+      case SEG_ADV_WILLNEED:
+        /* inaccessible blocks are skipped, as their pages can't be mapped */
+        if (!(block->flags & VM_R))
+          break;
 
-          list_remove(&segments->block_list, &right_block->node);
-          free(right_block);
+        for (uintptr_t page = block->start; page < block->end; page += FRAME_SIZE)
+        {
+          if (!_seg_fault_in(segments, block, page))
+            return false;
         }
-      }
-
-      return;
+        break;
+
+      case SEG_ADV_DONTNEED:
+        /*
+         * the block stays allocated, so the pages are faulted back in (and
+         * zeroed) if they are used again
+         */
+        range_free(block->start, block_size);
+        break;
     }
   }
+
+  return true;
 }
 
 static seg_t *seg_get(void)
@@ -203,21 +682,26 @@ static seg_t *seg_get(void)
 bool seg_init(seg_t *segments)
 {
   /* allocate head block */
-  seg_block_t *block = malloc(sizeof(*block));
+  seg_block_t *block = kmem_cache_alloc(&seg_block_cache);
   if (!block)
     return false;
 
   /* set the first last user-space address */
   block->start = 0x1000; /* so NULL pointer isn't included */
-  block->end = VM_USER_END;
+  block->end = vmm_user_end();
   block->state = SEG_FREE;
+  block->flags = 0;
+  block->map_flags = 0;
 
   /* init the spinlock */
   segments->lock = SPIN_UNLOCKED;
 
-  /* init the block list and add the block to the head */
-  list_init(&segments->block_list);
-  list_add_head(&segments->block_list, &block->node);
+  /* pick a colour offset, so each process's pages start on different cache sets */
+  segments->colour = __sync_fetch_and_add(&seg_next_colour, SEG_COLOUR_STEP);
+
+  /* init the block tree and add the block to it */
+  tree_init(&segments->block_tree, &seg_block_compare, &seg_block_augment);
+  tree_insert(&segments->block_tree, &block->node);
   return true;
 }
 
@@ -229,7 +713,8 @@ void seg_destroy(void)
   spin_lock(&segments->lock);
 
   /* iterate through every block in this seg */
-  list_for_each(&segments->block_list, node)
+  tree_node_t *node;
+  while ((node = tree_first(&segments->block_tree)))
   {
     seg_block_t *block = container_of(node, seg_block_t, node);
 
@@ -244,15 +729,15 @@ void seg_destroy(void)
     }
 
     /*
-     * remove the block from the list and free the memory the kernel uses to
+     * remove the block from the tree and free the memory the kernel uses to
      * keep track of it
      */
-    list_remove(&segments->block_list, node);
-    free(block);
+    tree_remove(&segments->block_tree, node);
+    kmem_cache_free(&seg_block_cache, block);
   }
 
   /* a sanity check to ensure we really have emptied the seg */
-  assert(segments->block_list.size == 0);
+  assert(segments->block_tree.size == 0);
 
   /*
    * release the lock, any further operations on the seg _will_ fail as it is
@@ -300,6 +785,117 @@ void seg_free(void *ptr)
   }
 }
 
+/*
+ * wakes the reclaim thread and gives it some time to free memory, or compact
+ * it if large pages ran out. the fault and map paths can't do either
+ * themselves, as both take locks which are held across TLB shootdowns, and
+ * these paths hold the segment lock with interrupts masked so they couldn't
+ * answer one.
+ *
+ * sleeping is only possible if interrupts are masked just by the caller: the
+ * page fault handler masks them once, and seg_map() is called with them
+ * enabled from system calls. otherwise false is returned
+ */
+static bool seg_wait(bool fault)
+{
+  reclaim_wake();
+
+  if (!thread_get() || cpu_get()->intr_mask_count != (fault ? 1 : 0))
+    return false;
+
+  if (fault)
+    intr_unlock();
+
+  thread_sleep(SEG_WAIT_MS);
+
+  if (fault)
+    intr_lock();
+
+  return true;
+}
+
+void *seg_map(void *ptr, size_t size, vm_acc_t flags, int map_flags)
+{
+  seg_t *segments = seg_get();
+  if (!segments)
+    return 0;
+
+  for (int retries = 0;; retries++)
+  {
+    bool no_mem = false;
+    spin_lock(&segments->lock);
+    void *block = _seg_map(segments, ptr, size, flags, map_flags, &no_mem);
+    spin_unlock(&segments->lock);
+
+    if (block || !no_mem)
+      return block;
+
+    /* retry once the reclaim thread has had a chance to free some frames */
+    if (retries == SEG_WAIT_RETRIES || !seg_wait(false))
+      return 0;
+  }
+}
+
+bool seg_unmap(void *ptr, size_t size)
+{
+  seg_t *segments = seg_get();
+  if (!segments)
+    return false;
+
+  spin_lock(&segments->lock);
+  bool ok = _seg_unmap(segments, (uintptr_t) ptr, size);
+  spin_unlock(&segments->lock);
+
+  return ok;
+}
+
+bool seg_protect(void *ptr, size_t size, vm_acc_t flags)
+{
+  seg_t *segments = seg_get();
+  if (!segments)
+    return false;
+
+  spin_lock(&segments->lock);
+  bool ok = _seg_protect(segments, (uintptr_t) ptr, size, flags);
+  spin_unlock(&segments->lock);
+
+  return ok;
+}
+
+bool seg_fault(uintptr_t addr, bool write, bool exec)
+{
+  seg_t *segments = seg_get();
+  if (!segments || addr > vmm_user_end())
+    return false;
+
+  for (int retries = 0;; retries++)
+  {
+    spin_lock(&segments->lock);
+    seg_fault_t result = _seg_fault(segments, addr, write, exec);
+    spin_unlock(&segments->lock);
+
+    if (result != SEG_FAULT_NO_MEM)
+      return result == SEG_FAULT_DONE;
+
+    /* retry once the reclaim thread has had a chance to free some frames */
+    if (retries == SEG_WAIT_RETRIES || !seg_wait(true))
+      return false;
+  }
+}
+
+bool seg_advise(void *ptr, size_t size, seg_advice_t advice)
+{
+  seg_t *segments = seg_get();
+  if (!segments)
+    return false;
+
+  spin_lock(&segments->lock);
+  bool ok = _seg_advise(segments, (uintptr_t) ptr, size, advice);
+  spin_unlock(&segments->lock);
+
+  return ok;
+}
+
 void seg_trace(void)
 {
   seg_t *segments = seg_get();
@@ -308,7 +904,7 @@ void seg_trace(void)
     spin_lock(&segments->lock);
 
     trace_printf("Tracing user segments...\n");
-    list_for_each(&segments->block_list, node)
+    tree_for_each(&segments->block_tree, node)
     {
       seg_block_t *block = container_of(node, seg_block_t, node);
       const char *state = block->state == SEG_ALLOCATED ? "allocated " : "free";
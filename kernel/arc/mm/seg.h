@@ -19,7 +19,7 @@
 
 #include <arc/mm/common.h>
 #include <arc/lock/spinlock.h>
-#include <arc/util/list.h>
+#include <arc/util/tree.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -29,26 +29,93 @@ typedef enum
   SEG_ALLOCATED
 } seg_state_t;
 
+/* seg_map() flags */
+#define SEG_FIXED    0x1 /* the block must be placed at exactly the given address */
+#define SEG_POPULATE 0x2 /* allocate frames straight away rather than on demand */
+#define SEG_HUGE     0x4 /* prefer large pages when frames are allocated on demand */
+#define SEG_HUGE_2M  0x10 /* back the whole block with 2M pages straight away */
+#define SEG_HUGE_1G  0x20 /* back the whole block with 1G pages straight away */
+
+/* set by seg_advise(), rather than seg_map() */
+#define SEG_SEQUENTIAL 0x8 /* fault in the following pages too on a page fault */
+
+/* seg_advise() hints */
+typedef enum
+{
+  SEG_ADV_NORMAL,     /* undo SEG_ADV_SEQUENTIAL */
+  SEG_ADV_SEQUENTIAL, /* the memory will be accessed sequentially */
+  SEG_ADV_WILLNEED,   /* allocate any frames which aren't allocated yet */
+  SEG_ADV_DONTNEED,   /* free the frames, they are zeroed if used again */
+  SEG_ADV_HUGEPAGE,   /* prefer large pages when faulting pages in */
+  SEG_ADV_NOHUGEPAGE  /* only use small pages when faulting pages in */
+} seg_advice_t;
+
 typedef struct seg_block
 {
-  list_node_t node;
+  tree_node_t node;
   uintptr_t start;
   uintptr_t end;
   seg_state_t state;
   vm_acc_t flags;
+  int map_flags;
+
+  /* the size of the largest free block in the subtree rooted at this block */
+  size_t max_free;
 } seg_block_t;
 
 typedef struct
 {
   spinlock_t lock;
-  list_t block_list;
+  tree_t block_tree; /* every block, ordered by address */
+  uint64_t colour;   /* added to the page number to pick a frame's colour */
 } seg_t;
 
 bool seg_init(seg_t *segments);
 void seg_destroy(void);
+
+/*
+ * Allocates a block and maps every page of it straight away. Like every frame
+ * given to user space, the frames are zeroed before they are mapped.
+ */
 bool seg_alloc_at(void *ptr, size_t size, vm_acc_t flags);
 void *seg_alloc(size_t size, vm_acc_t flags);
 void seg_free(void *ptr);
+
+/*
+ * Reserves a block of 'size' bytes at 'ptr' (or anywhere, if 'ptr' is null or
+ * the address is in use and SEG_FIXED isn't set.) Unless SEG_POPULATE is set,
+ * physical frames are only allocated when the memory is first accessed.
+ * Memory returned by this function is always zeroed.
+ *
+ * With SEG_HUGE_2M or SEG_HUGE_1G the block is aligned to and rounded up to a
+ * whole number of large pages, which are allocated from the PMM's huge page
+ * pool up front. If they can't all be allocated, the call waits for the
+ * reclaim thread to compact physical memory, failing if that doesn't help.
+ */
+void *seg_map(void *ptr, size_t size, vm_acc_t flags, int map_flags);
+
+/*
+ * Unmaps or changes the access flags of every allocated block in a range,
+ * splitting blocks which straddle the ends of the range. These fail if the
+ * range would need to split a large page.
+ */
+bool seg_unmap(void *ptr, size_t size);
+bool seg_protect(void *ptr, size_t size, vm_acc_t flags);
+
+/*
+ * Called by the page fault handler. Allocates a frame for the page containing
+ * 'addr' if it is in a block which allows the access, returning false if the
+ * fault was not caused by a lazily allocated page. If no frame is free, the
+ * faulting thread waits for the reclaim thread and tries again.
+ */
+bool seg_fault(uintptr_t addr, bool write, bool exec);
+
+/*
+ * Applies a hint to every block in a range, which must be entirely allocated
+ * (blocks are split at the ends of the range, as with seg_protect().)
+ */
+bool seg_advise(void *ptr, size_t size, seg_advice_t advice);
+
 void seg_trace(void);
 
 #endif
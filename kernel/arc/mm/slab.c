@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/mm/slab.h>
+#include <arc/mm/heap.h>
+#include <arc/mm/align.h>
+#include <arc/lock/intr.h>
+#include <arc/smp/cpu.h>
+#include <arc/util/container.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+/* every cache which has allocated a slab, for kmem_reap() */
+static list_t kmem_caches = LIST_EMPTY;
+static spinlock_t kmem_caches_lock = SPIN_UNLOCKED;
+
+/* each slab is a single page, starting with this header */
+typedef struct
+{
+  list_node_t node;
+  void *free_obj; /* the first free object in this slab */
+  size_t used;    /* the number of allocated objects */
+  size_t total;   /* the number of objects in this slab */
+} kmem_slab_t;
+
+static size_t obj_align(kmem_cache_t *cache)
+{
+  if (cache->align < sizeof(void *))
+    return sizeof(void *);
+
+  return cache->align;
+}
+
+/*
+ * free objects are linked together with a pointer which is placed after the
+ * object itself, so it doesn't clobber the state set up by the constructor
+ */
+static void **obj_link(kmem_cache_t *cache, void *obj)
+{
+  return (void **) ((uintptr_t) obj + ALIGN_UP(cache->size, sizeof(void *)));
+}
+
+static size_t obj_slot_size(kmem_cache_t *cache)
+{
+  size_t size = ALIGN_UP(cache->size, sizeof(void *)) + sizeof(void *);
+  return ALIGN_UP(size, obj_align(cache));
+}
+
+static kmem_slab_t *slab_create(kmem_cache_t *cache)
+{
+  size_t align = obj_align(cache);
+  size_t slot_size = obj_slot_size(cache);
+
+  /* check at least one object fits in a slab */
+  uintptr_t off = ALIGN_UP(sizeof(kmem_slab_t), align);
+  if (off + slot_size > FRAME_SIZE)
+    return 0;
+
+  /*
+   * use the space left over at the end of the slab to offset the objects by a
+   * different number of cache lines in each slab, so objects at the same index
+   * in different slabs don't all compete for the same cache sets
+   */
+  size_t total = (FRAME_SIZE - off) / slot_size;
+  size_t spare = FRAME_SIZE - off - total * slot_size;
+  size_t colour_align = align > KMEM_COLOUR_ALIGN ? align : KMEM_COLOUR_ALIGN;
+  size_t colours = spare / colour_align + 1;
+
+  if (cache->colour >= colours)
+    cache->colour = 0;
+
+  off += cache->colour++ * colour_align;
+
+  /* allocate the slab itself */
+  kmem_slab_t *slab = heap_alloc(FRAME_SIZE, VM_R | VM_W);
+  if (!slab)
+    return 0;
+
+  slab->free_obj = 0;
+  slab->used = 0;
+  slab->total = total;
+
+  /* construct the objects and build the free list, lowest address first */
+  for (size_t i = total; i > 0; i--)
+  {
+    void *obj = (void *) ((uintptr_t) slab + off + (i - 1) * slot_size);
+    if (cache->ctor)
+      cache->ctor(obj);
+
+    *obj_link(cache, obj) = slab->free_obj;
+    slab->free_obj = obj;
+  }
+
+  return slab;
+}
+
+static void *_kmem_cache_alloc(kmem_cache_t *cache)
+{
+  /* create a new slab if all the existing ones are full */
+  if (!cache->partial_slabs.head)
+  {
+    kmem_slab_t *slab = slab_create(cache);
+    if (!slab)
+      return 0;
+
+    list_add_head(&cache->partial_slabs, &slab->node);
+    cache->empty_slabs++;
+  }
+
+  kmem_slab_t *slab = container_of(cache->partial_slabs.head, kmem_slab_t, node);
+  if (slab->used == 0)
+    cache->empty_slabs--;
+
+  /* take the first free object */
+  void *obj = slab->free_obj;
+  slab->free_obj = *obj_link(cache, obj);
+
+  /* move the slab to the full list if that was the last free object */
+  if (++slab->used == slab->total)
+  {
+    list_remove(&cache->partial_slabs, &slab->node);
+    list_add_head(&cache->full_slabs, &slab->node);
+  }
+
+  return obj;
+}
+
+static void _kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+  /* slabs are page-aligned, so the header can be found from any object */
+  kmem_slab_t *slab = (kmem_slab_t *) PAGE_ALIGN_REVERSE((uintptr_t) obj);
+  assert(slab->used != 0);
+
+  /* move the slab back to the partial list if it was full */
+  if (slab->used == slab->total)
+  {
+    list_remove(&cache->full_slabs, &slab->node);
+    list_add_head(&cache->partial_slabs, &slab->node);
+  }
+
+  /* add the object to the free list */
+  *obj_link(cache, obj) = slab->free_obj;
+  slab->free_obj = obj;
+
+  if (--slab->used == 0)
+  {
+    list_remove(&cache->partial_slabs, &slab->node);
+
+    /* keep one empty slab around, release any others */
+    if (cache->empty_slabs)
+    {
+      heap_free(slab);
+    }
+    else
+    {
+      /* empty slabs go at the end so partially used slabs are filled first */
+      list_add_tail(&cache->partial_slabs, &slab->node);
+      cache->empty_slabs++;
+    }
+  }
+}
+
+/* adds a cache to the list kmem_reap() walks, the first time it is used */
+static void kmem_register(kmem_cache_t *cache)
+{
+  spin_lock(&kmem_caches_lock);
+
+  if (!cache->registered)
+  {
+    list_add_tail(&kmem_caches, &cache->node);
+    cache->registered = true;
+  }
+
+  spin_unlock(&kmem_caches_lock);
+}
+
+/* must be called with interrupts masked */
+static kmem_magazine_t *magazine_get(kmem_cache_t *cache)
+{
+  uint32_t id = cpu_get()->id;
+  if (id >= KMEM_CPUS)
+    return 0;
+
+  return &cache->magazines[id];
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor)
+{
+  /* the alignment must be a power of two */
+  assert(align && !(align & (align - 1)));
+
+  kmem_cache_t *cache = malloc(sizeof(*cache));
+  if (!cache)
+    return 0;
+
+  *cache = (kmem_cache_t) KMEM_CACHE(name, size, align, ctor);
+  return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+  /* try to take an object from this cpu's magazine without locking */
+  intr_lock();
+
+  kmem_magazine_t *magazine = magazine_get(cache);
+  if (magazine && magazine->count)
+  {
+    void *obj = magazine->objs[--magazine->count];
+    intr_unlock();
+    return obj;
+  }
+
+  intr_unlock();
+
+  if (!cache->registered)
+    kmem_register(cache);
+
+  /* otherwise take one from the slabs, and refill the magazine at the same time */
+  spin_lock(&cache->lock);
+
+  void *obj = _kmem_cache_alloc(cache);
+  if (obj)
+  {
+    magazine = magazine_get(cache);
+    while (magazine && magazine->count < KMEM_MAGAZINE_SIZE / 2)
+    {
+      void *extra_obj = _kmem_cache_alloc(cache);
+      if (!extra_obj)
+        break;
+
+      magazine->objs[magazine->count++] = extra_obj;
+    }
+  }
+
+  spin_unlock(&cache->lock);
+  return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+  /* try to put the object in this cpu's magazine without locking */
+  intr_lock();
+
+  kmem_magazine_t *magazine = magazine_get(cache);
+  if (magazine && magazine->count < KMEM_MAGAZINE_SIZE)
+  {
+    magazine->objs[magazine->count++] = obj;
+    intr_unlock();
+    return;
+  }
+
+  intr_unlock();
+
+  /* otherwise return it to its slab, and drain half of the magazine too */
+  spin_lock(&cache->lock);
+
+  _kmem_cache_free(cache, obj);
+
+  magazine = magazine_get(cache);
+  while (magazine && magazine->count > KMEM_MAGAZINE_SIZE / 2)
+    _kmem_cache_free(cache, magazine->objs[--magazine->count]);
+
+  spin_unlock(&cache->lock);
+}
+
+size_t kmem_reap(void)
+{
+  size_t pages = 0;
+
+  spin_lock(&kmem_caches_lock);
+
+  list_for_each(&kmem_caches, node)
+  {
+    kmem_cache_t *cache = container_of(node, kmem_cache_t, node);
+    spin_lock(&cache->lock);
+
+    /* other cpus' magazines can't be touched, but this one's can */
+    kmem_magazine_t *magazine = magazine_get(cache);
+    while (magazine && magazine->count)
+      _kmem_cache_free(cache, magazine->objs[--magazine->count]);
+
+    /* the empty slab is always at the end of the partial list */
+    if (cache->empty_slabs)
+    {
+      kmem_slab_t *slab = container_of(cache->partial_slabs.tail, kmem_slab_t, node);
+      assert(slab->used == 0);
+
+      list_remove(&cache->partial_slabs, &slab->node);
+      cache->empty_slabs--;
+
+      heap_free(slab);
+      pages++;
+    }
+
+    spin_unlock(&cache->lock);
+  }
+
+  spin_unlock(&kmem_caches_lock);
+  return pages;
+}
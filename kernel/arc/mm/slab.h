@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ARC_MM_SLAB_H
+#define ARC_MM_SLAB_H
+
+#include <arc/lock/spinlock.h>
+#include <arc/util/list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* the number of objects each cpu can hold on to without taking a lock */
+#define KMEM_MAGAZINE_SIZE 16
+
+/* cpus with an id beyond this limit always go straight to the slabs */
+#define KMEM_CPUS 64
+
+/* slabs are coloured in steps of one cache line */
+#define KMEM_COLOUR_ALIGN 64
+
+/* called once per object, when the slab it lives in is created */
+typedef void (*kmem_ctor_t)(void *obj);
+
+typedef struct
+{
+  size_t count;
+  void *objs[KMEM_MAGAZINE_SIZE];
+} kmem_magazine_t;
+
+typedef struct kmem_cache
+{
+  const char *name;
+  size_t size;
+  size_t align;
+  kmem_ctor_t ctor;
+
+  /* protects the slab lists */
+  spinlock_t lock;
+
+  /* slabs with at least one free object, and slabs with none */
+  list_t partial_slabs;
+  list_t full_slabs;
+  size_t empty_slabs;
+
+  /* the colour offset of the next slab, in units of KMEM_COLOUR_ALIGN */
+  size_t colour;
+
+  /* per-cpu object magazines, indexed by cpu id */
+  kmem_magazine_t magazines[KMEM_CPUS];
+
+  /* the node in the list of caches kmem_reap() walks */
+  list_node_t node;
+  bool registered;
+} kmem_cache_t;
+
+#define KMEM_CACHE(n, s, a, c) { .name = (n), .size = (s), .align = (a), .ctor = (c), .lock = SPIN_UNLOCKED, .partial_slabs = LIST_EMPTY, .full_slabs = LIST_EMPTY }
+
+/*
+ * Creates a cache of objects which are 'size' bytes long and aligned to
+ * 'align' bytes, which must be a power of two. If 'ctor' is not null, it is
+ * called on every object when it is first created - objects should be returned
+ * to the cache in their constructed state. Statically allocated caches can be
+ * set up with the KMEM_CACHE() initializer instead.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+
+/* allocates an object from a cache, returning a null pointer on failure */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/* returns an object to the cache it was allocated from */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/*
+ * Releases the empty slab every cache keeps around, after returning the objects
+ * in this cpu's magazines to their slabs. Returns the number of pages freed.
+ */
+size_t kmem_reap(void);
+
+#endif
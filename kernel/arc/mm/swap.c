@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/mm/swap.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/pmm.h>
+#include <arc/mm/vmm.h>
+#include <arc/proc/proc.h>
+#include <arc/lock/spinlock.h>
+#include <arc/cpu/cr.h>
+#include <arc/smp/cpu.h>
+#include <arc/util/container.h>
+#include <arc/util/lz.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the number of pages looked at in each step of a reclaim */
+#define SWAP_BATCH 32
+
+/* pages which don't compress to this size or smaller aren't worth swapping */
+#define SWAP_MAX_LEN (FRAME_SIZE * 3 / 4)
+
+/* marks the end of the free slot list */
+#define SWAP_NO_SLOT UINT64_MAX
+
+typedef struct
+{
+  void *data;    /* the compressed page, or null if the slot is free */
+  size_t len;
+  uint64_t next; /* the next free slot, if this slot is free */
+} swap_slot_t;
+
+/* protects the slot table, never held while calling the VMM */
+static spinlock_t swap_lock = SPIN_UNLOCKED;
+static swap_slot_t *swap_slots;
+static uint64_t swap_slot_capacity;
+static uint64_t swap_free_slot = SWAP_NO_SLOT;
+
+/* only one reclaim runs at a time, which owns the buffers below */
+static spinlock_t swap_reclaim_lock = SPIN_UNLOCKED;
+static vmm_swap_page_t swap_batch[SWAP_BATCH];
+static size_t swap_batch_count;
+static uintptr_t swap_cursor;
+static uint8_t swap_buffer[SWAP_MAX_LEN];
+static lz_state_t swap_lz;
+
+/* stores a compressed page in a free slot, growing the table if needed */
+static bool swap_slot_alloc(void *data, size_t len, uint64_t *slot)
+{
+  spin_lock(&swap_lock);
+
+  if (swap_free_slot == SWAP_NO_SLOT)
+  {
+    uint64_t capacity = swap_slot_capacity ? swap_slot_capacity * 2 : FRAME_SIZE / sizeof(swap_slot_t);
+    swap_slot_t *slots = realloc(swap_slots, capacity * sizeof(*slots));
+    if (!slots)
+    {
+      spin_unlock(&swap_lock);
+      return false;
+    }
+
+    for (uint64_t i = swap_slot_capacity; i < capacity; i++)
+    {
+      slots[i].data = 0;
+      slots[i].next = (i + 1 < capacity) ? i + 1 : SWAP_NO_SLOT;
+    }
+
+    swap_free_slot = swap_slot_capacity;
+    swap_slots = slots;
+    swap_slot_capacity = capacity;
+  }
+
+  *slot = swap_free_slot;
+  swap_slot_t *s = &swap_slots[*slot];
+  swap_free_slot = s->next;
+  s->data = data;
+  s->len = len;
+
+  spin_unlock(&swap_lock);
+  return true;
+}
+
+void swap_discard(uint64_t slot)
+{
+  spin_lock(&swap_lock);
+
+  swap_slot_t *s = &swap_slots[slot];
+  free(s->data);
+  s->data = 0;
+  s->next = swap_free_slot;
+  swap_free_slot = slot;
+
+  spin_unlock(&swap_lock);
+}
+
+/*
+ * compresses a cold page into a new slot. the page is read through its frame
+ * rather than its user address, which would set the accessed bit and fault if
+ * the page was unmapped concurrently (the copy is thrown away in that case)
+ */
+static void swap_compress(vmm_swap_page_t *page)
+{
+  void *ptr = mmio_map_frame(page->frame);
+  if (!ptr)
+  {
+    page->cold = false;
+    return;
+  }
+
+  size_t len = lz_compress(&swap_lz, ptr, FRAME_SIZE, swap_buffer, sizeof(swap_buffer));
+  mmio_unmap_frame(page->frame, ptr);
+
+  void *data = len ? malloc(len) : 0;
+  if (!data)
+  {
+    page->cold = false;
+    return;
+  }
+
+  memcpy(data, swap_buffer, len);
+  if (!swap_slot_alloc(data, len, &page->slot))
+  {
+    free(data);
+    page->cold = false;
+  }
+}
+
+static void swap_find_pages(uintptr_t virt, uintptr_t frame, int size, void *arg)
+{
+  /* only 4K pages are swapped, large pages are presumably in use */
+  if (size != SIZE_4K || virt < swap_cursor || swap_batch_count == SWAP_BATCH)
+    return;
+
+  vmm_swap_page_t *page = &swap_batch[swap_batch_count++];
+  page->virt = virt;
+  page->frame = frame;
+  page->slot = SWAP_NO_SLOT;
+}
+
+/* swaps out cold pages in the current address space */
+static size_t swap_reclaim_proc(size_t frames)
+{
+  size_t freed = 0;
+  swap_cursor = 0;
+
+  while (freed < frames)
+  {
+    swap_batch_count = 0;
+    vmm_scan_user(&swap_find_pages, 0);
+    if (swap_batch_count == 0)
+      break;
+
+    swap_cursor = swap_batch[swap_batch_count - 1].virt + FRAME_SIZE;
+
+    vmm_swap_age(swap_batch, swap_batch_count);
+
+    for (size_t i = 0; i < swap_batch_count; i++)
+    {
+      if (swap_batch[i].cold)
+        swap_compress(&swap_batch[i]);
+    }
+
+    vmm_swap_out(swap_batch, swap_batch_count);
+
+    /*
+     * vmm_swap_out() clears cold if the page was used after it was compressed,
+     * otherwise the page now lives in its slot and the frame can be freed
+     */
+    for (size_t i = 0; i < swap_batch_count; i++)
+    {
+      vmm_swap_page_t *page = &swap_batch[i];
+      if (page->cold)
+      {
+        pmm_free(page->frame);
+        freed++;
+      }
+      else if (page->slot != SWAP_NO_SLOT)
+      {
+        swap_discard(page->slot);
+      }
+    }
+  }
+
+  return freed;
+}
+
+size_t swap_reclaim(size_t frames)
+{
+  spin_lock(&swap_reclaim_lock);
+  spin_lock(&proc_list_lock);
+
+  cpu_t *cpu = cpu_get();
+  proc_t *old_proc = cpu->proc;
+  uintptr_t old_pml4_table = cr3_read();
+
+  /*
+   * the first pass only clears the accessed bits of pages which have been
+   * used, so they can be taken on the second pass if they aren't used again
+   */
+  size_t freed = 0;
+  for (int pass = 0; pass < 2 && freed < frames; pass++)
+  {
+    list_for_each(&proc_list, node)
+    {
+      proc_t *proc = container_of(node, proc_t, node);
+      if (proc->state == PROC_DEAD)
+        continue;
+
+      proc_switch(proc);
+
+      freed += swap_reclaim_proc(frames - freed);
+      if (freed >= frames)
+        break;
+    }
+  }
+
+  cpu->proc = old_proc;
+  cr3_write(old_pml4_table);
+
+  spin_unlock(&proc_list_lock);
+  spin_unlock(&swap_reclaim_lock);
+  return freed;
+}
+
+swap_in_t swap_in(uintptr_t virt, uintptr_t frame, vm_acc_t flags)
+{
+  uint64_t slot;
+  if (!vmm_swapped(virt, &slot))
+    return SWAP_IN_NONE;
+
+  /*
+   * the entry can't be discarded while we use it, as faults and unmaps in a
+   * process are serialized by its seg lock
+   */
+  spin_lock(&swap_lock);
+  swap_slot_t *s = &swap_slots[slot];
+  void *data = s->data;
+  size_t len = s->len;
+  spin_unlock(&swap_lock);
+
+  void *ptr = mmio_map_frame(frame);
+  if (!ptr)
+    return SWAP_IN_FAILED;
+
+  bool ok = lz_decompress(data, len, ptr, FRAME_SIZE);
+  mmio_unmap_frame(frame, ptr);
+
+  if (!ok || !vmm_swap_in(virt, slot, frame, flags))
+    return SWAP_IN_FAILED;
+
+  swap_discard(slot);
+  return SWAP_IN_DONE;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ARC_MM_SWAP_H
+#define ARC_MM_SWAP_H
+
+#include <arc/mm/common.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compressed swap, held in kernel memory. When physical memory runs out,
+ * swap_reclaim() compresses cold 4K user pages, replaces their page table
+ * entries with swap entries (see PG_SWAP) and frees their frames. The pages
+ * are decompressed by swap_in() when they fault back in.
+ */
+
+/* tries to free the given number of frames, returning the number freed */
+size_t swap_reclaim(size_t frames);
+
+typedef enum
+{
+  SWAP_IN_NONE,  /* the page wasn't swapped out */
+  SWAP_IN_DONE,  /* the page was decompressed into the frame and mapped */
+  SWAP_IN_FAILED /* the page was swapped out but couldn't be restored */
+} swap_in_t;
+
+/* if the page at virt is swapped out, restores its contents into frame */
+swap_in_t swap_in(uintptr_t virt, uintptr_t frame, vm_acc_t flags);
+
+/* frees a slot whose swap entry has been removed, called by the VMM */
+void swap_discard(uint64_t slot);
+
+#endif
@@ -16,20 +16,23 @@
 
 #include <arc/mm/validate.h>
 #include <arc/mm/common.h>
+#include <arc/mm/vmm.h>
 #include <stdint.h>
 
 bool valid_buffer(const void *ptr, size_t len)
 {
   uintptr_t addr_start = (uintptr_t) ptr;
   uintptr_t addr_end = addr_start + len;
-  return addr_start <= VM_USER_END && addr_end <= VM_USER_END && addr_start <= addr_end;
+  uintptr_t user_end = vmm_user_end();
+  return addr_start <= user_end && addr_end <= user_end && addr_start <= addr_end;
 }
 
 bool valid_string(const char *str)
 {
+  uintptr_t user_end = vmm_user_end();
   for (;;)
   {
-    if ((uintptr_t) str > VM_USER_END)
+    if ((uintptr_t) str > user_end)
       return false;
 
     if (*str++ == 0)
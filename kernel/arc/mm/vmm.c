@@ -21,9 +21,13 @@
 #include <arc/mm/align.h>
 #include <arc/mm/pmm.h>
 #include <arc/mm/mmio.h>
+#include <arc/mm/swap.h>
+#include <arc/mm/ksm.h>
 #include <arc/panic.h>
 #include <arc/cpu/tlb.h>
+#include <arc/cpu/cr.h>
 #include <arc/cpu/features.h>
+#include <arc/trace.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -32,13 +36,34 @@
 #define PML3_OFFSET 0xFFFFFF7FBFC00000
 #define PML4_OFFSET 0xFFFFFF7FBFDFE000
 
+/*
+ * with five-level paging the kernel's PML4 table is mapped by the last PML5
+ * entry, so the layout of the higher half doesn't change. the PML5 table is
+ * mapped into itself with the second to last entry, like the PML4 table is
+ * with four levels, which gives these windows onto the tables
+ */
+#define PML1_OFFSET_LA57 0xFFFE000000000000
+#define PML2_OFFSET_LA57 0xFFFEFF0000000000
+#define PML3_OFFSET_LA57 0xFFFEFF7F80000000
+#define PML4_OFFSET_LA57 0xFFFEFF7FBFC00000
+#define PML5_OFFSET_LA57 0xFFFEFF7FBFDFE000
+
+/* the address bits used by the page walk, without the sign extension */
+#define VM_ADDR_MASK      0x0000FFFFFFFFFFFF
+#define VM_ADDR_MASK_LA57 0x01FFFFFFFFFFFFFF
+
 typedef struct
 {
-  uint64_t *pml4, *pml3, *pml2, *pml1;
-  size_t pml4e, pml3e, pml2e, pml1e;
+  uint64_t *pml5, *pml4, *pml3, *pml2, *pml1;
+  size_t pml5e, pml4e, pml3e, pml2e, pml1e;
+  bool user; /* if the address is in the lower half */
 } page_index_t;
 
 static bool vmm_1g_pages;
+
+/* if there are five levels of page tables, and the windows onto each level */
+static bool vmm_la57;
+static uintptr_t vmm_pml_offsets[] = { PML1_OFFSET, PML2_OFFSET, PML3_OFFSET, PML4_OFFSET, 0 };
 static spinlock_t kernel_vmm_lock = SPIN_UNLOCKED;
 
 /* forward declarations of internal vmm functions with no locking */
@@ -50,6 +75,18 @@ static uintptr_t _vmm_unmaps(uintptr_t virt, int size);
 static void _vmm_untouch(uintptr_t virt, int size);
 static bool _vmm_map_range(uintptr_t virt, uintptr_t phy, size_t len, vm_acc_t flags);
 static void _vmm_unmap_range(uintptr_t virt, size_t len);
+static bool _vmm_alloc_range(uintptr_t virt, size_t len, vm_acc_t flags);
+static void _vmm_free_range(uintptr_t virt, size_t len);
+static void _vmm_protect_range(uintptr_t virt, size_t len, vm_acc_t flags);
+static bool _vmm_move_range(uintptr_t from, uintptr_t to, size_t len, vm_acc_t flags);
+static void _vmm_scan(uintptr_t start, uintptr_t end, vmm_scan_t func, void *arg);
+static bool _vmm_migrate(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr);
+static void _vmm_swap_age(vmm_swap_page_t *pages, size_t count);
+static void _vmm_swap_out(vmm_swap_page_t *pages, size_t count);
+static bool _vmm_swap_in(uintptr_t virt, uint64_t slot, uintptr_t frame, vm_acc_t flags);
+static bool _vmm_merge(uintptr_t virt, uintptr_t frame, uintptr_t stable_frame, const void *stable_ptr);
+static bool _vmm_unshare(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr, vm_acc_t flags);
+static bool _vmm_map_shared(uintptr_t virt, const uintptr_t *frames, size_t count, vm_acc_t flags);
 static int _vmm_size(uintptr_t virt);
 
 static void vmm_lock(uintptr_t addr)
@@ -72,40 +109,40 @@ static void vmm_unlock(uintptr_t addr)
 
 static void addr_to_index(page_index_t *index, uintptr_t addr)
 {
-  /* calculate pml4 pointer */
-  index->pml4 = (uint64_t *) PML4_OFFSET;
+  index->user = addr <= vmm_user_end();
 
-  /* calculate pml4 index */
-  if (addr >= VM_HIGHER_HALF)
-  {
-    addr -= VM_HIGHER_HALF;
-    index->pml4e = (TABLE_SIZE / 2) + addr / FRAME_SIZE_512G;
-  }
-  else
-  {
-    index->pml4e = addr / FRAME_SIZE_512G;
-  }
-  addr %= FRAME_SIZE_512G;
+  /*
+   * strip the sign extension, after which the tables at each level are laid
+   * out one after the other in their windows - so the table which maps an
+   * address is found by dividing the page number by the area each table covers
+   */
+  uint64_t page = (addr & (vmm_la57 ? VM_ADDR_MASK_LA57 : VM_ADDR_MASK)) / FRAME_SIZE;
 
-  /* calculate pml3 pointer */
-  index->pml3 = (uint64_t *) (PML3_OFFSET + index->pml4e * FRAME_SIZE);
+  index->pml1 = (uint64_t *) (vmm_pml_offsets[0] + (page / TABLE_SIZE) * FRAME_SIZE);
+  index->pml1e = page % TABLE_SIZE;
+  page /= TABLE_SIZE;
 
-  /* calculate pml3 index */
-  index->pml3e = addr / FRAME_SIZE_1G;
-  addr %= FRAME_SIZE_1G;
+  index->pml2 = (uint64_t *) (vmm_pml_offsets[1] + (page / TABLE_SIZE) * FRAME_SIZE);
+  index->pml2e = page % TABLE_SIZE;
+  page /= TABLE_SIZE;
 
-  /* calculate pml2 pointer */
-  index->pml2 = (uint64_t *) (PML2_OFFSET + index->pml4e * FRAME_SIZE_2M + index->pml3e * FRAME_SIZE);
+  index->pml3 = (uint64_t *) (vmm_pml_offsets[2] + (page / TABLE_SIZE) * FRAME_SIZE);
+  index->pml3e = page % TABLE_SIZE;
+  page /= TABLE_SIZE;
 
-  /* calculate pml2 index */
-  index->pml2e = addr / FRAME_SIZE_2M;
-  addr %= FRAME_SIZE_2M;
+  index->pml4 = (uint64_t *) (vmm_pml_offsets[3] + (page / TABLE_SIZE) * FRAME_SIZE);
+  index->pml4e = page % TABLE_SIZE;
+  page /= TABLE_SIZE;
 
-  /* calculate pml1 pointer */
-  index->pml1 = (uint64_t *) (PML1_OFFSET + index->pml4e * FRAME_SIZE_1G + index->pml3e * FRAME_SIZE_2M + index->pml2e * FRAME_SIZE);
+  /* with four levels there is no PML5 table, and this isn't used */
+  index->pml5 = (uint64_t *) vmm_pml_offsets[4];
+  index->pml5e = page % TABLE_SIZE;
+}
 
-  /* calculate pml1 index */
-  index->pml1e = addr / FRAME_SIZE;
+/* returns the table cr3 points to */
+static uint64_t *vmm_top_table(void)
+{
+  return (uint64_t *) vmm_pml_offsets[vmm_la57 ? 4 : 3];
 }
 
 void vmm_init(void)
@@ -113,6 +150,18 @@ void vmm_init(void)
   /* set 1g support flag */
   vmm_1g_pages = cpu_feature_supported(FEATURE_1G_PAGE);
 
+  /* start.s turns on five-level paging if the cpu supports it */
+  if (cr4_read() & CR4_LA57)
+  {
+    vmm_la57 = true;
+    vmm_pml_offsets[0] = PML1_OFFSET_LA57;
+    vmm_pml_offsets[1] = PML2_OFFSET_LA57;
+    vmm_pml_offsets[2] = PML3_OFFSET_LA57;
+    vmm_pml_offsets[3] = PML4_OFFSET_LA57;
+    vmm_pml_offsets[4] = PML5_OFFSET_LA57;
+    trace_puts(" => Using five-level paging\n");
+  }
+
   /*
    * touch all higher half pml4 entries, this means when we have multiple
    * address spaces, we can easily keep the higher half mapped in exactly the
@@ -126,6 +175,11 @@ void vmm_init(void)
   }
 }
 
+uintptr_t vmm_user_end(void)
+{
+  return vmm_la57 ? VM_USER_END_LA57 : VM_USER_END;
+}
+
 bool vmm_init_pml4(uintptr_t pml4_table_addr)
 {
   // TODO: pre-allocate this MMIO area so this call always succeeds
@@ -133,7 +187,8 @@ bool vmm_init_pml4(uintptr_t pml4_table_addr)
   if (!pml4_table)
     return false;
 
-  uint64_t *master_pml4_table = (uint64_t *) PML4_OFFSET;
+  /* this is a PML5 table if five-level paging is enabled, but works the same */
+  uint64_t *master_pml4_table = vmm_top_table();
 
   /* reset the lower half PML4 entries */
   memset(pml4_table, 0, FRAME_SIZE / 2);
@@ -151,29 +206,147 @@ bool vmm_init_pml4(uintptr_t pml4_table_addr)
   return true;
 }
 
+static uint64_t vm_acc_to_pg_flags(page_index_t *index, vm_acc_t flags)
+{
+  uint64_t pg_flags = 0;
+  if (flags & VM_W)
+    pg_flags |= PG_WRITABLE;
+  if (!(flags & VM_X))
+    pg_flags |= PG_NO_EXEC;
+  if (index->user)
+    pg_flags |= PG_USER;
+
+  if (flags & VM_UC)
+    pg_flags |= PG_CACHE_UC;
+  else if (flags & VM_WC)
+    pg_flags |= PG_CACHE_WC;
+  else if (flags & VM_WT)
+    pg_flags |= PG_CACHE_WT;
+
+  return pg_flags;
+}
+
+/*
+ * returns the size of the page mapped at virt, or if nothing is mapped, the
+ * size of the largest aligned region around virt which has no page tables (so
+ * loops over sparse ranges can skip past it in one go)
+ */
+static size_t _vmm_extent(uintptr_t virt)
+{
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  if (vmm_la57 && !(index.pml5[index.pml5e] & PG_PRESENT))
+    return FRAME_SIZE_256T;
+
+  uint64_t pml4 = index.pml4[index.pml4e];
+  if (!(pml4 & PG_PRESENT))
+    return FRAME_SIZE_512G;
+
+  uint64_t pml3 = index.pml3[index.pml3e];
+  if (!(pml3 & PG_PRESENT) || (pml3 & PG_BIG))
+    return FRAME_SIZE_1G;
+
+  uint64_t pml2 = index.pml2[index.pml2e];
+  if (!(pml2 & PG_PRESENT) || (pml2 & PG_BIG))
+    return FRAME_SIZE_2M;
+
+  return FRAME_SIZE;
+}
+
+/* returns the entry which maps a page of the given size */
+static uint64_t *vmm_entry(page_index_t *index, int size)
+{
+  switch (size)
+  {
+    case SIZE_4K:
+      return &index->pml1[index->pml1e];
+
+    case SIZE_2M:
+      return &index->pml2[index->pml2e];
+
+    case SIZE_1G:
+      return &index->pml3[index->pml3e];
+  }
+
+  return 0;
+}
+
+/* returns the swap entry at virt, or null if there isn't one */
+static uint64_t *_vmm_swap_entry(uintptr_t virt)
+{
+  if (_vmm_extent(virt) != FRAME_SIZE)
+    return 0;
+
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  uint64_t *entry = vmm_entry(&index, SIZE_4K);
+  if ((*entry & (PG_PRESENT | PG_SWAP)) != PG_SWAP)
+    return 0;
+
+  return entry;
+}
+
+/* returns the 4K entry which maps virt to frame, or null if it has changed */
+static uint64_t *_vmm_swap_page(vmm_swap_page_t *page)
+{
+  if (_vmm_size(page->virt) != SIZE_4K)
+    return 0;
+
+  page_index_t index;
+  addr_to_index(&index, page->virt);
+
+  uint64_t *entry = vmm_entry(&index, SIZE_4K);
+  if ((*entry & (PG_ADDR_MASK | PG_SHARED)) != page->frame)
+    return 0;
+
+  return entry;
+}
+
+/* returns the entry of the merged 4K page at virt, or null if there isn't one */
+static uint64_t *_vmm_shared_entry(uintptr_t virt)
+{
+  if (_vmm_size(virt) != SIZE_4K)
+    return 0;
+
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  uint64_t *entry = vmm_entry(&index, SIZE_4K);
+  if (!(*entry & PG_SHARED))
+    return 0;
+
+  return entry;
+}
+
 static int _vmm_size(uintptr_t virt)
 {
   page_index_t index;
   addr_to_index(&index, virt);
 
+  if (vmm_la57 && !(index.pml5[index.pml5e] & PG_PRESENT))
+    return -1;
+
   uint64_t pml4 = index.pml4[index.pml4e];
   if (!(pml4 & PG_PRESENT))
     return -1;
 
+  /* pages which access has been denied to are still mapped, as they own a frame */
   uint64_t pml3 = index.pml3[index.pml3e];
-  if (!(pml3 & PG_PRESENT))
+  if (!(pml3 & (PG_PRESENT | PG_DENIED)))
     return -1;
   if (pml3 & PG_BIG)
     return SIZE_1G;
 
   uint64_t pml2 = index.pml2[index.pml2e];
-  if (!(pml2 & PG_PRESENT))
+  if (!(pml2 & (PG_PRESENT | PG_DENIED)))
     return -1;
   if (pml2 & PG_BIG)
     return SIZE_2M;
 
   uint64_t pml1 = index.pml1[index.pml1e];
-  if (!(pml1 & PG_PRESENT))
+  if (!(pml1 & (PG_PRESENT | PG_DENIED)))
     return -1;
 
   return SIZE_4K;
@@ -184,16 +357,32 @@ static bool _vmm_touch(uintptr_t virt, int size)
   page_index_t index;
   addr_to_index(&index, virt);  
 
+  uintptr_t frame4 = 0;
+  if (vmm_la57 && !(index.pml5[index.pml5e] & PG_PRESENT))
+  {
+    frame4 = pmm_alloc();
+    if (!frame4)
+      return false;
+
+    uint64_t pml5 = frame4 | PG_WRITABLE | PG_PRESENT;
+    if (index.user)
+      pml5 |= PG_USER;
+
+    index.pml5[index.pml5e] = pml5;
+    tlb_transaction_queue_invlpg((uintptr_t) index.pml4);
+    memset(index.pml4, 0, FRAME_SIZE);
+  }
+
   uint64_t pml4 = index.pml4[index.pml4e];
   uintptr_t frame3 = 0;
   if (!(pml4 & PG_PRESENT))
   {
     frame3 = pmm_alloc();
     if (!frame3)
-      return false;
+      goto rollback_pml5;
 
     pml4 = frame3 | PG_WRITABLE | PG_PRESENT;
-    if (index.pml4e < (TABLE_SIZE / 2))
+    if (index.user)
       pml4 |= PG_USER;
 
     index.pml4[index.pml4e] = pml4;
@@ -215,7 +404,7 @@ static bool _vmm_touch(uintptr_t virt, int size)
       goto rollback_pml4;
 
     pml3 = frame2 | PG_WRITABLE | PG_PRESENT;
-    if (index.pml4e < (TABLE_SIZE / 2))
+    if (index.user)
       pml3 |= PG_USER;
 
     index.pml3[index.pml3e] = pml3;
@@ -236,7 +425,7 @@ static bool _vmm_touch(uintptr_t virt, int size)
       goto rollback_pml3;
 
     pml2 = frame1 | PG_WRITABLE | PG_PRESENT;
-    if (index.pml4e < (TABLE_SIZE / 2))
+    if (index.user)
       pml2 |= PG_USER;
 
     index.pml2[index.pml2e] = pml2;
@@ -260,6 +449,13 @@ rollback_pml4:
     tlb_transaction_queue_invlpg((uintptr_t) index.pml3);
     pmm_free(frame3);
   }
+rollback_pml5:
+  if (frame4)
+  {
+    index.pml5[index.pml5e] = 0;
+    tlb_transaction_queue_invlpg((uintptr_t) index.pml4);
+    pmm_free(frame4);
+  }
   return false;
 }
 
@@ -279,13 +475,13 @@ static bool _vmm_maps(uintptr_t virt, uintptr_t phy, vm_acc_t flags, int size)
   page_index_t index;
   addr_to_index(&index, virt);
 
-  uint64_t pg_flags = 0;
-  if (flags & VM_W)
-    pg_flags |= PG_WRITABLE;
-  if (!(flags & VM_X))
-    pg_flags |= PG_NO_EXEC;
-  if (index.pml4e < (TABLE_SIZE / 2))
-    pg_flags |= PG_USER;
+  /* don't replace a lower level table with a large page, it would be leaked */
+  if (size == SIZE_2M && (index.pml2[index.pml2e] & (PG_PRESENT | PG_DENIED)))
+    return false;
+  if (size == SIZE_1G && (index.pml3[index.pml3e] & (PG_PRESENT | PG_DENIED)))
+    return false;
+
+  uint64_t pg_flags = vm_acc_to_pg_flags(&index, flags);
 
   switch (size)
   {
@@ -320,19 +516,19 @@ static uintptr_t _vmm_unmaps(uintptr_t virt, int size)
   switch (size)
   {
     case SIZE_4K:
-      if (index.pml1[index.pml1e] & PG_PRESENT)
+      if (index.pml1[index.pml1e] & (PG_PRESENT | PG_DENIED))
         frame = index.pml1[index.pml1e] & PG_ADDR_MASK;
       index.pml1[index.pml1e] = 0;
       break;
 
     case SIZE_2M:
-      if (index.pml2[index.pml2e] & PG_PRESENT)
+      if (index.pml2[index.pml2e] & (PG_PRESENT | PG_DENIED))
         frame = index.pml2[index.pml2e] & PG_ADDR_MASK;
       index.pml2[index.pml2e] = 0;
       break;
 
     case SIZE_1G:
-      if (index.pml3[index.pml3e] & PG_PRESENT)
+      if (index.pml3[index.pml3e] & (PG_PRESENT | PG_DENIED))
         frame = index.pml3[index.pml3e] & PG_ADDR_MASK;
       index.pml3[index.pml3e] = 0;
       break;
@@ -350,10 +546,11 @@ static void _vmm_untouch(uintptr_t virt, int size)
 
   if (size == SIZE_4K)
   {
+    /* swap entries keep the table in use, as they are mapped back in later */
     bool empty = true;
     for (size_t i = 0; i < TABLE_SIZE; i++)
     {
-      if (index.pml1[i] & PG_PRESENT)
+      if (index.pml1[i] & (PG_PRESENT | PG_SWAP | PG_DENIED))
       {
         empty = false;
         break;
@@ -373,7 +570,7 @@ static void _vmm_untouch(uintptr_t virt, int size)
     bool empty = true;
     for (size_t i = 0; i < TABLE_SIZE; i++)
     {
-      if (index.pml2[i] & PG_PRESENT)
+      if (index.pml2[i] & (PG_PRESENT | PG_DENIED))
       {
         empty = false;
         break;
@@ -388,12 +585,12 @@ static void _vmm_untouch(uintptr_t virt, int size)
     }
   }
 
-  if ((size == SIZE_4K || size == SIZE_2M || size == SIZE_1G) && (index.pml4e < (TABLE_SIZE / 2)))
+  if ((size == SIZE_4K || size == SIZE_2M || size == SIZE_1G) && index.user)
   {
     bool empty = true;
     for (size_t i = 0; i < TABLE_SIZE; i++)
     {
-      if (index.pml3[i] & PG_PRESENT)
+      if (index.pml3[i] & (PG_PRESENT | PG_DENIED))
       {
         empty = false;
         break;
@@ -407,6 +604,26 @@ static void _vmm_untouch(uintptr_t virt, int size)
       tlb_transaction_queue_invlpg((uintptr_t) index.pml3);
     }
   }
+
+  if (vmm_la57 && index.user)
+  {
+    bool empty = true;
+    for (size_t i = 0; i < TABLE_SIZE; i++)
+    {
+      if (index.pml4[i] & PG_PRESENT)
+      {
+        empty = false;
+        break;
+      }
+    }
+
+    if (empty)
+    {
+      pmm_free(index.pml5[index.pml5e] & PG_ADDR_MASK);
+      index.pml5[index.pml5e] = 0;
+      tlb_transaction_queue_invlpg((uintptr_t) index.pml4);
+    }
+  }
 }
 
 static bool _vmm_map_range(uintptr_t virt, uintptr_t phy, size_t len, vm_acc_t flags)
@@ -414,8 +631,10 @@ static bool _vmm_map_range(uintptr_t virt, uintptr_t phy, size_t len, vm_acc_t f
   len = PAGE_ALIGN(len);
   for (size_t off = 0; off < len;)
   {
+    /* large pages need both addresses to be aligned */
     size_t remaining = len - off;
-    if ((PAGE_ALIGN_1G(virt + off) == (virt + off)) && remaining >= FRAME_SIZE_1G)
+    uintptr_t both = (virt + off) | (phy + off);
+    if ((PAGE_ALIGN_1G(both) == both) && remaining >= FRAME_SIZE_1G)
     {
       if (_vmm_maps(virt + off, phy + off, flags, SIZE_1G))
       {
@@ -424,7 +643,7 @@ static bool _vmm_map_range(uintptr_t virt, uintptr_t phy, size_t len, vm_acc_t f
       }
     }
 
-    if ((PAGE_ALIGN_2M(virt + off) == (virt + off)) && remaining >= FRAME_SIZE_2M)
+    if ((PAGE_ALIGN_2M(both) == both) && remaining >= FRAME_SIZE_2M)
     {
       if (_vmm_maps(virt + off, phy + off, flags, SIZE_2M))
       {
@@ -451,7 +670,7 @@ static void _vmm_unmap_range(uintptr_t virt, size_t len)
   {
     int size = _vmm_size(virt + off);
     if (size != -1)
-      _vmm_unmaps(size, virt + off);
+      _vmm_unmaps(virt + off, size);
 
     if (size == SIZE_1G)
       off += FRAME_SIZE_1G;
@@ -462,6 +681,432 @@ static void _vmm_unmap_range(uintptr_t virt, size_t len)
   }
 }
 
+static bool _vmm_alloc_range(uintptr_t virt, size_t len, vm_acc_t flags)
+{
+  len = PAGE_ALIGN(len);
+  for (size_t off = 0; off < len;)
+  {
+    uintptr_t addr = virt + off;
+    size_t remaining = len - off;
+
+    /* try to use a 1G frame */
+    if ((addr % FRAME_SIZE_1G) == 0 && remaining >= FRAME_SIZE_1G)
+    {
+      uintptr_t frame = pmm_allocs(SIZE_1G);
+      if (frame)
+      {
+        if (_vmm_maps(addr, frame, flags, SIZE_1G))
+        {
+          off += FRAME_SIZE_1G;
+          continue;
+        }
+
+        pmm_frees(SIZE_1G, frame);
+      }
+    }
+
+    /* try to use a 2M frame */
+    if ((addr % FRAME_SIZE_2M) == 0 && remaining >= FRAME_SIZE_2M)
+    {
+      uintptr_t frame = pmm_allocs(SIZE_2M);
+      if (frame)
+      {
+        if (_vmm_maps(addr, frame, flags, SIZE_2M))
+        {
+          off += FRAME_SIZE_2M;
+          continue;
+        }
+
+        pmm_frees(SIZE_2M, frame);
+      }
+    }
+
+    /* fall back to a 4K frame, coloured so consecutive pages use different cache sets */
+    uintptr_t frame = pmm_alloc_colour(addr / FRAME_SIZE);
+    if (!frame)
+    {
+      _vmm_free_range(virt, off);
+      return false;
+    }
+
+    if (!_vmm_map(addr, frame, flags))
+    {
+      pmm_free(frame);
+      _vmm_free_range(virt, off);
+      return false;
+    }
+
+    off += FRAME_SIZE;
+  }
+
+  return true;
+}
+
+static void _vmm_free_range(uintptr_t virt, size_t len)
+{
+  len = PAGE_ALIGN(len);
+  for (size_t off = 0; off < len;)
+  {
+    uintptr_t addr = virt + off;
+    size_t extent = _vmm_extent(addr);
+
+    /* merged pages are only freed when the last mapping of them goes */
+    int size = _vmm_size(addr);
+    if (size == SIZE_4K && _vmm_shared_entry(addr))
+      ksm_put(_vmm_unmaps(addr, size));
+    else if (size != -1)
+      pmm_frees(size, _vmm_unmaps(addr, size));
+
+    /* discard the contents of swapped out pages */
+    uint64_t *swap_entry = _vmm_swap_entry(addr);
+    if (swap_entry)
+    {
+      swap_discard(*swap_entry >> PG_SWAP_SHIFT);
+      *swap_entry = 0;
+      _vmm_untouch(addr, SIZE_4K);
+    }
+
+    /* skip to the end of the page or hole */
+    off += extent - (addr % extent);
+  }
+}
+
+static void _vmm_protect_range(uintptr_t virt, size_t len, vm_acc_t flags)
+{
+  len = PAGE_ALIGN(len);
+  for (size_t off = 0; off < len;)
+  {
+    uintptr_t addr = virt + off;
+    size_t extent = _vmm_extent(addr);
+
+    page_index_t index;
+    addr_to_index(&index, addr);
+
+    /* find the entry which maps this address, if there is one */
+    uint64_t *entry = vmm_entry(&index, _vmm_size(addr));
+
+    /* rewrite the access flags */
+    if (entry)
+    {
+      *entry &= ~(PG_PRESENT | PG_DENIED | PG_WRITABLE | PG_NO_EXEC | PG_CACHE_MASK);
+      *entry |= vm_acc_to_pg_flags(&index, flags);
+
+      /* without read access the page is kept, but marked not present */
+      if (flags & VM_R)
+        *entry |= PG_PRESENT;
+      else
+        *entry |= PG_DENIED;
+
+      /* merged pages stay read-only, writes to them are caught to copy them */
+      if (*entry & PG_SHARED)
+        *entry &= ~PG_WRITABLE;
+
+      tlb_transaction_queue_invlpg(addr);
+    }
+
+    off += extent - (addr % extent);
+  }
+}
+
+/* returns the number of bytes in a page of the given size */
+static size_t vmm_page_bytes(int size)
+{
+  switch (size)
+  {
+    case SIZE_2M:
+      return FRAME_SIZE_2M;
+
+    case SIZE_1G:
+      return FRAME_SIZE_1G;
+
+    default:
+      return FRAME_SIZE;
+  }
+}
+
+/* frees any empty page tables covering a range, checking each table once */
+static void _vmm_untouch_range(uintptr_t virt, size_t len)
+{
+  for (size_t off = 0; off < len;)
+  {
+    uintptr_t addr = virt + off;
+
+    /* find the lowest level table which exists and the area it covers */
+    size_t table_len;
+    switch (_vmm_extent(addr))
+    {
+      case FRAME_SIZE:
+        _vmm_untouch(addr, SIZE_4K);
+        table_len = FRAME_SIZE_2M;
+        break;
+
+      case FRAME_SIZE_2M:
+        _vmm_untouch(addr, SIZE_2M);
+        table_len = FRAME_SIZE_1G;
+        break;
+
+      case FRAME_SIZE_1G:
+        _vmm_untouch(addr, SIZE_1G);
+        table_len = FRAME_SIZE_512G;
+        break;
+
+      case FRAME_SIZE_512G:
+        table_len = FRAME_SIZE_512G;
+        break;
+
+      default:
+        table_len = FRAME_SIZE_256T;
+        break;
+    }
+
+    off += table_len - (addr % table_len);
+  }
+}
+
+/*
+ * the size of page used at the destination of a move: large pages keep their
+ * size if the destination is suitably aligned, otherwise they are split into
+ * 4K pages (the frames are contiguous, so this is always possible)
+ */
+static int vmm_move_size(uintptr_t to, int size)
+{
+  if (to % vmm_page_bytes(size) == 0)
+    return size;
+
+  return SIZE_4K;
+}
+
+static bool _vmm_move_range(uintptr_t from, uintptr_t to, size_t len, vm_acc_t flags)
+{
+  len = PAGE_ALIGN(len);
+
+  /* create the destination's page tables first, so the move itself can't fail */
+  for (size_t off = 0; off < len;)
+  {
+    uintptr_t addr = from + off;
+    size_t extent = _vmm_extent(addr);
+
+    int size = _vmm_size(addr);
+    if (size != -1)
+    {
+      uintptr_t dest = to + off;
+      size_t page_len = vmm_page_bytes(size);
+      int dest_size = vmm_move_size(dest, size);
+
+      /* touch each 4K page table a split page ends up in */
+      bool ok = true;
+      if (dest_size == size)
+        ok = _vmm_touch(dest, size);
+      else
+      {
+        for (uintptr_t cur = dest; ok && cur < dest + page_len; cur = PAGE_ALIGN_2M(cur + 1))
+          ok = _vmm_touch(cur, SIZE_4K);
+      }
+
+      if (!ok)
+      {
+        _vmm_untouch_range(to, len);
+        return false;
+      }
+    }
+
+    off += extent - (addr % extent);
+  }
+
+  /* move the frames */
+  for (size_t off = 0; off < len;)
+  {
+    uintptr_t addr = from + off;
+    size_t extent = _vmm_extent(addr);
+
+    int size = _vmm_size(addr);
+    if (size != -1)
+    {
+      uintptr_t dest = to + off;
+      int dest_size = vmm_move_size(dest, size);
+
+      uintptr_t frame = _vmm_unmaps(addr, size);
+      if (dest_size == size)
+      {
+        _vmm_maps(dest, frame, flags, size);
+      }
+      else
+      {
+        for (size_t page_off = 0; page_off < extent; page_off += FRAME_SIZE)
+          _vmm_map(dest + page_off, frame + page_off, flags);
+      }
+    }
+
+    off += extent - (addr % extent);
+  }
+
+  return true;
+}
+
+static void _vmm_scan(uintptr_t start, uintptr_t end, vmm_scan_t func, void *arg)
+{
+  for (uintptr_t addr = start; addr >= start && addr <= end;)
+  {
+    size_t extent = _vmm_extent(addr);
+
+    int size = _vmm_size(addr);
+    if (size != -1)
+    {
+      page_index_t index;
+      addr_to_index(&index, addr);
+
+      /* merged pages and pages which can't be accessed are left alone */
+      uint64_t entry = *vmm_entry(&index, size);
+      if (!(entry & (PG_SHARED | PG_DENIED)))
+        func(addr, entry & PG_ADDR_MASK, size, arg);
+    }
+
+    addr += extent - (addr % extent);
+  }
+}
+
+static bool _vmm_migrate(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr)
+{
+  /* check the page hasn't changed since the caller looked at it */
+  if (_vmm_size(virt) != SIZE_4K)
+    return false;
+
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  uint64_t *entry = vmm_entry(&index, SIZE_4K);
+  if ((*entry & (PG_ADDR_MASK | PG_PRESENT)) != (frame | PG_PRESENT))
+    return false;
+
+  /*
+   * the other CPUs wait in the TLB shootdown IPI handler until the transaction
+   * is committed, so nothing can write to the page while it is being copied
+   */
+  memcpy(new_ptr, (void *) virt, FRAME_SIZE);
+
+  *entry = (*entry & ~PG_ADDR_MASK) | new_frame;
+  tlb_transaction_queue_invlpg(virt);
+  return true;
+}
+
+static void _vmm_swap_age(vmm_swap_page_t *pages, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    vmm_swap_page_t *page = &pages[i];
+    page->cold = false;
+
+    uint64_t *entry = _vmm_swap_page(page);
+    if (!entry)
+      continue;
+
+    /*
+     * recently used pages get a second chance, otherwise the dirty bit is
+     * cleared so _vmm_swap_out() can tell if the page was written to after
+     * the caller copied it
+     */
+    if (*entry & PG_ACCESSED)
+      *entry &= ~PG_ACCESSED;
+    else
+    {
+      *entry &= ~PG_DIRTY;
+      page->cold = true;
+    }
+
+    tlb_transaction_queue_invlpg(page->virt);
+  }
+}
+
+static void _vmm_swap_out(vmm_swap_page_t *pages, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    vmm_swap_page_t *page = &pages[i];
+    if (!page->cold)
+      continue;
+
+    uint64_t *entry = _vmm_swap_page(page);
+    if (!entry || (*entry & PG_DIRTY))
+    {
+      page->cold = false;
+      continue;
+    }
+
+    *entry = (page->slot << PG_SWAP_SHIFT) | PG_SWAP;
+    tlb_transaction_queue_invlpg(page->virt);
+  }
+}
+
+static bool _vmm_swap_in(uintptr_t virt, uint64_t slot, uintptr_t frame, vm_acc_t flags)
+{
+  uint64_t *entry = _vmm_swap_entry(virt);
+  if (!entry || (*entry >> PG_SWAP_SHIFT) != slot)
+    return false;
+
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  *entry = frame | PG_PRESENT | vm_acc_to_pg_flags(&index, flags);
+  tlb_transaction_queue_invlpg(virt);
+  return true;
+}
+
+static bool _vmm_merge(uintptr_t virt, uintptr_t frame, uintptr_t stable_frame, const void *stable_ptr)
+{
+  if (_vmm_size(virt) != SIZE_4K)
+    return false;
+
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  uint64_t *entry = vmm_entry(&index, SIZE_4K);
+  if ((*entry & (PG_ADDR_MASK | PG_SHARED | PG_PRESENT)) != (frame | PG_PRESENT))
+    return false;
+
+  /* as in _vmm_migrate(), nothing can write to the page while we compare it */
+  if (stable_ptr && memcmp((void *) virt, stable_ptr, FRAME_SIZE) != 0)
+    return false;
+
+  *entry = (*entry & ~(PG_ADDR_MASK | PG_WRITABLE)) | stable_frame | PG_SHARED;
+  tlb_transaction_queue_invlpg(virt);
+  return true;
+}
+
+static bool _vmm_unshare(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr, vm_acc_t flags)
+{
+  uint64_t *entry = _vmm_shared_entry(virt);
+  if (!entry || (*entry & PG_ADDR_MASK) != frame)
+    return false;
+
+  memcpy(new_ptr, (void *) virt, FRAME_SIZE);
+
+  page_index_t index;
+  addr_to_index(&index, virt);
+
+  *entry = new_frame | PG_PRESENT | vm_acc_to_pg_flags(&index, flags);
+  tlb_transaction_queue_invlpg(virt);
+  return true;
+}
+
+static bool _vmm_map_shared(uintptr_t virt, const uintptr_t *frames, size_t count, vm_acc_t flags)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uintptr_t addr = virt + i * FRAME_SIZE;
+    if (!_vmm_map(addr, frames[i], flags & ~VM_W))
+    {
+      _vmm_unmap_range(virt, i * FRAME_SIZE);
+      return false;
+    }
+
+    page_index_t index;
+    addr_to_index(&index, addr);
+    index.pml1[index.pml1e] |= PG_SHARED;
+  }
+
+  return true;
+}
+
 bool vmm_touch(uintptr_t virt, int size)
 {
   vmm_lock(virt);
@@ -560,6 +1205,157 @@ void vmm_unmap_range(uintptr_t virt, size_t len)
   vmm_unlock(virt);
 }
 
+bool vmm_alloc_range(uintptr_t virt, size_t len, vm_acc_t flags)
+{
+  vmm_lock(virt);
+
+  tlb_transaction_init();
+  bool ok = _vmm_alloc_range(virt, len, flags);
+  tlb_transaction_commit();
+
+  vmm_unlock(virt);
+  return ok;
+}
+
+void vmm_free_range(uintptr_t virt, size_t len)
+{
+  vmm_lock(virt);
+  tlb_transaction_init();
+  _vmm_free_range(virt, len);
+  tlb_transaction_commit();
+  vmm_unlock(virt);
+}
+
+void vmm_protect_range(uintptr_t virt, size_t len, vm_acc_t flags)
+{
+  vmm_lock(virt);
+  tlb_transaction_init();
+  _vmm_protect_range(virt, len, flags);
+  tlb_transaction_commit();
+  vmm_unlock(virt);
+}
+
+bool vmm_move_range(uintptr_t from, uintptr_t to, size_t len, vm_acc_t flags)
+{
+  vmm_lock(from);
+
+  tlb_transaction_init();
+  bool ok = _vmm_move_range(from, to, len, flags);
+  tlb_transaction_commit();
+
+  vmm_unlock(from);
+  return ok;
+}
+
+void vmm_scan_user(vmm_scan_t func, void *arg)
+{
+  vmm_lock(0);
+  _vmm_scan(0, vmm_user_end(), func, arg);
+  vmm_unlock(0);
+}
+
+bool vmm_migrate(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr)
+{
+  vmm_lock(virt);
+
+  tlb_transaction_init();
+  bool ok = _vmm_migrate(virt, frame, new_frame, new_ptr);
+  tlb_transaction_commit();
+
+  vmm_unlock(virt);
+  return ok;
+}
+
+void vmm_swap_age(vmm_swap_page_t *pages, size_t count)
+{
+  vmm_lock(0);
+  tlb_transaction_init();
+  _vmm_swap_age(pages, count);
+  tlb_transaction_commit();
+  vmm_unlock(0);
+}
+
+void vmm_swap_out(vmm_swap_page_t *pages, size_t count)
+{
+  vmm_lock(0);
+  tlb_transaction_init();
+  _vmm_swap_out(pages, count);
+  tlb_transaction_commit();
+  vmm_unlock(0);
+}
+
+bool vmm_swapped(uintptr_t virt, uint64_t *slot)
+{
+  vmm_lock(virt);
+
+  uint64_t *entry = _vmm_swap_entry(virt);
+  if (entry)
+    *slot = *entry >> PG_SWAP_SHIFT;
+
+  vmm_unlock(virt);
+  return entry != 0;
+}
+
+bool vmm_swap_in(uintptr_t virt, uint64_t slot, uintptr_t frame, vm_acc_t flags)
+{
+  vmm_lock(virt);
+
+  tlb_transaction_init();
+  bool ok = _vmm_swap_in(virt, slot, frame, flags);
+  tlb_transaction_commit();
+
+  vmm_unlock(virt);
+  return ok;
+}
+
+bool vmm_merge(uintptr_t virt, uintptr_t frame, uintptr_t stable_frame, const void *stable_ptr)
+{
+  vmm_lock(virt);
+
+  tlb_transaction_init();
+  bool ok = _vmm_merge(virt, frame, stable_frame, stable_ptr);
+  tlb_transaction_commit();
+
+  vmm_unlock(virt);
+  return ok;
+}
+
+bool vmm_shared(uintptr_t virt, uintptr_t *frame)
+{
+  vmm_lock(virt);
+
+  uint64_t *entry = _vmm_shared_entry(virt);
+  if (entry)
+    *frame = *entry & PG_ADDR_MASK;
+
+  vmm_unlock(virt);
+  return entry != 0;
+}
+
+bool vmm_unshare(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr, vm_acc_t flags)
+{
+  vmm_lock(virt);
+
+  tlb_transaction_init();
+  bool ok = _vmm_unshare(virt, frame, new_frame, new_ptr, flags);
+  tlb_transaction_commit();
+
+  vmm_unlock(virt);
+  return ok;
+}
+
+bool vmm_map_shared(uintptr_t virt, const uintptr_t *frames, size_t count, vm_acc_t flags)
+{
+  vmm_lock(virt);
+
+  tlb_transaction_init();
+  bool ok = _vmm_map_shared(virt, frames, count, flags);
+  tlb_transaction_commit();
+
+  vmm_unlock(virt);
+  return ok;
+}
+
 int vmm_size(uintptr_t virt)
 {
   vmm_lock(virt);
@@ -23,8 +23,16 @@
 #include <stdint.h>
 
 void vmm_init(void);
+
+/*
+ * sets up a new address space's top level table, which is a PML5 table if
+ * five-level paging is enabled
+ */
 bool vmm_init_pml4(uintptr_t pml4_table_addr);
 
+/* returns the last user-space address, which depends on the paging mode */
+uintptr_t vmm_user_end(void);
+
 bool vmm_touch(uintptr_t virt, int size);
 
 bool vmm_map(uintptr_t virt, uintptr_t phy, vm_acc_t flags);
@@ -38,6 +46,85 @@ void vmm_untouch(uintptr_t virt, int size);
 bool vmm_map_range(uintptr_t virt, uintptr_t phy, size_t len, vm_acc_t flags);
 void vmm_unmap_range(uintptr_t virt, size_t len);
 
+/*
+ * these functions operate on a whole range in a single TLB transaction:
+ * vmm_alloc_range() allocates and maps physical frames (using large pages
+ * where possible), vmm_free_range() unmaps and frees any frames within the
+ * range and vmm_protect_range() changes the access flags of any mapped pages
+ */
+bool vmm_alloc_range(uintptr_t virt, size_t len, vm_acc_t flags);
+void vmm_free_range(uintptr_t virt, size_t len);
+void vmm_protect_range(uintptr_t virt, size_t len, vm_acc_t flags);
+
+/*
+ * moves the frames mapped in one range to another, which must not have
+ * anything mapped in it, without copying their contents
+ */
+bool vmm_move_range(uintptr_t from, uintptr_t to, size_t len, vm_acc_t flags);
+
+/*
+ * calls func for every page mapped in the user half of the current address
+ * space, with the address space locked (so func must not call the VMM).
+ * merged pages are skipped, as they can't be moved or swapped out
+ */
+typedef void (*vmm_scan_t)(uintptr_t virt, uintptr_t frame, int size, void *arg);
+void vmm_scan_user(vmm_scan_t func, void *arg);
+
+/*
+ * copies the 4K page at virt into new_frame (which must be mapped at new_ptr)
+ * and remaps virt to it, failing if virt is no longer mapped to frame
+ */
+bool vmm_migrate(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr);
+
+/*
+ * swapping out a batch of user pages is done in two steps, so the pages can be
+ * compressed outside of a TLB transaction: vmm_swap_age() gives each page a
+ * second chance if it has been accessed, otherwise it is marked as cold and
+ * its dirty bit is cleared. the caller then copies the cold pages and
+ * vmm_swap_out() replaces them with swap entries, unless they have been
+ * written to (or remapped) in the meantime
+ */
+typedef struct
+{
+  uintptr_t virt, frame;
+  uint64_t slot;
+  bool cold;
+} vmm_swap_page_t;
+
+void vmm_swap_age(vmm_swap_page_t *pages, size_t count);
+void vmm_swap_out(vmm_swap_page_t *pages, size_t count);
+
+/* reads the swap entry at virt, returning false if there isn't one */
+bool vmm_swapped(uintptr_t virt, uint64_t *slot);
+
+/* replaces the swap entry at virt with a mapping of frame, if it is unchanged */
+bool vmm_swap_in(uintptr_t virt, uint64_t slot, uintptr_t frame, vm_acc_t flags);
+
+/*
+ * replaces the 4K page at virt, if it is still mapped to frame, with a
+ * read-only mapping of stable_frame marked as merged (PG_SHARED). if
+ * stable_ptr is given the page must have the same contents as it. passing
+ * frame as stable_frame marks the page as merged without replacing it
+ */
+bool vmm_merge(uintptr_t virt, uintptr_t frame, uintptr_t stable_frame, const void *stable_ptr);
+
+/* reads the frame of the merged page at virt, returning false if there isn't one */
+bool vmm_shared(uintptr_t virt, uintptr_t *frame);
+
+/*
+ * copies the merged page at virt into new_frame (which must be mapped at
+ * new_ptr) and maps it privately with the given flags, failing if virt is no
+ * longer a merged page of frame
+ */
+bool vmm_unshare(uintptr_t virt, uintptr_t frame, uintptr_t new_frame, void *new_ptr, vm_acc_t flags);
+
+/*
+ * maps count 4K frames read-only at virt, marked as merged so they are
+ * copied when written to and released with ksm_put() when unmapped. the caller
+ * must have taken a reference to each frame for the mapping with ksm_get()
+ */
+bool vmm_map_shared(uintptr_t virt, const uintptr_t *frames, size_t count, vm_acc_t flags);
+
 int vmm_size(uintptr_t virt);
 
 #endif
@@ -17,6 +17,8 @@
 #include <arc/proc/elf64.h>
 #include <arc/mm/align.h>
 #include <arc/mm/seg.h>
+#include <arc/proc/image.h>
+#include <arc/proc/proc.h>
 #include <string.h>
 
 static bool elf64_ehdr_valid(elf64_ehdr_t *ehdr)
@@ -59,6 +61,9 @@ bool elf64_load(elf64_ehdr_t *elf, size_t size)
   if (!elf64_ehdr_valid(elf))
     return false;
 
+  /* read-only segments are shared with other processes running the image */
+  image_t *image = proc_get()->image;
+
   elf64_phdr_t *phdrs = (elf64_phdr_t *) ((uintptr_t) elf + elf->e_phoff);
   size_t i;
   for (i = 0; i < elf->e_phnum; i++)
@@ -84,8 +89,26 @@ bool elf64_load(elf64_ehdr_t *elf, size_t size)
     if (PAGE_ALIGN_REVERSE(seg_addr) != seg_addr)
       goto rollback;
 
-    /* allocate segment on user heap */
-    if (!seg_alloc_at((void *) seg_addr, seg_len, flags))
+    if (image && !(flags & VM_W))
+    {
+      /* reserve the segment and map the image's frames into it */
+      if (!seg_map((void *) seg_addr, seg_len, flags, SEG_FIXED))
+        goto rollback;
+
+      if (!image_map(image, phdr, seg_addr, seg_len, flags))
+      {
+        seg_free((void *) seg_addr);
+        goto rollback;
+      }
+
+      continue;
+    }
+
+    /*
+     * allocate segment on user heap, writable for now as the kernel can't
+     * write to read-only pages either
+     */
+    if (!seg_alloc_at((void *) seg_addr, seg_len, flags | VM_W))
       goto rollback;
 
     /* copy data from the ELF file into memory */
@@ -94,6 +117,13 @@ bool elf64_load(elf64_ehdr_t *elf, size_t size)
 
     /* reset any remaining memory in the section */
     memclr((void *) (phdr->p_vaddr + phdr->p_filesz), phdr->p_memsz - phdr->p_filesz);
+
+    /* now drop write access if the segment shouldn't have it */
+    if (!(flags & VM_W) && !seg_protect((void *) seg_addr, seg_len, flags))
+    {
+      seg_free((void *) seg_addr);
+      goto rollback;
+    }
   }
   return true;
 
@@ -47,7 +47,7 @@ void idle_init(void)
   list_for_each(&cpu_list, node)
   {
     cpu_t *cpu = container_of(node, cpu_t, node);
-    thread_t *thread = thread_create(idle_proc, THREAD_KERNEL);
+    thread_t *thread = thread_create(idle_proc, THREAD_KERNEL, 0);
     if (!thread)
       panic("couldn't create idle thread");
 
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <arc/proc/image.h>
+#include <arc/mm/ksm.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/pmm.h>
+#include <arc/mm/slab.h>
+#include <arc/mm/vmm.h>
+#include <arc/lock/spinlock.h>
+#include <arc/util/container.h>
+#include <arc/util/list.h>
+#include <arc/util/refcnt.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a read-only segment of an image */
+typedef struct
+{
+  list_node_t node;
+  uintptr_t start;
+  size_t pages;
+  uintptr_t frames[];
+} image_seg_t;
+
+struct image
+{
+  list_node_t node;
+  const void *file;
+  size_t size;
+  refcnt_t users;
+  list_t segs;
+};
+
+static kmem_cache_t image_cache = KMEM_CACHE("image", sizeof(image_t), _Alignof(image_t), 0);
+
+static spinlock_t image_lock = SPIN_UNLOCKED;
+static list_t image_list = LIST_EMPTY;
+
+/* drops the image's references to the frames of a segment */
+static void image_seg_free(image_seg_t *seg)
+{
+  for (size_t i = 0; i < seg->pages; i++)
+    ksm_disown(seg->frames[i]);
+
+  free(seg);
+}
+
+/* copies the part of the segment's file data which overlaps a page into it */
+static void image_seg_fill(void *ptr, uintptr_t page, const void *file, elf64_phdr_t *phdr)
+{
+  memclr(ptr, FRAME_SIZE);
+
+  uintptr_t start = page > phdr->p_vaddr ? page : phdr->p_vaddr;
+  uintptr_t end = page + FRAME_SIZE;
+  if (end > phdr->p_vaddr + phdr->p_filesz)
+    end = phdr->p_vaddr + phdr->p_filesz;
+
+  if (start < end)
+  {
+    const char *data = (const char *) file + phdr->p_offset + (start - phdr->p_vaddr);
+    memcpy((char *) ptr + (start - page), data, end - start);
+  }
+}
+
+static image_seg_t *_image_seg(image_t *image, elf64_phdr_t *phdr, uintptr_t start, size_t len)
+{
+  list_for_each(&image->segs, node)
+  {
+    image_seg_t *seg = container_of(node, image_seg_t, node);
+    if (seg->start == start)
+      return seg;
+  }
+
+  size_t pages = len / FRAME_SIZE;
+  image_seg_t *seg = malloc(sizeof(*seg) + pages * sizeof(*seg->frames));
+  if (!seg)
+    return 0;
+
+  seg->start = start;
+  for (seg->pages = 0; seg->pages < pages; seg->pages++)
+  {
+    uintptr_t page = start + seg->pages * FRAME_SIZE;
+    uintptr_t frame = pmm_alloc_user(SIZE_4K, page / FRAME_SIZE);
+    if (!frame)
+      goto rollback;
+
+    void *ptr = mmio_map_frame(frame);
+    if (!ptr)
+    {
+      pmm_free(frame);
+      goto rollback;
+    }
+
+    image_seg_fill(ptr, page, image->file, phdr);
+    mmio_unmap_frame(frame, ptr);
+
+    if (!ksm_share(frame))
+    {
+      pmm_free(frame);
+      goto rollback;
+    }
+
+    seg->frames[seg->pages] = frame;
+  }
+
+  list_add_tail(&image->segs, &seg->node);
+  return seg;
+
+rollback:
+  image_seg_free(seg);
+  return 0;
+}
+
+image_t *image_get(const void *file, size_t size)
+{
+  spin_lock(&image_lock);
+
+  list_for_each(&image_list, node)
+  {
+    image_t *image = container_of(node, image_t, node);
+    if (image->size == size && (image->file == file || memcmp(image->file, file, size) == 0))
+    {
+      refcnt_retain(&image->users);
+      spin_unlock(&image_lock);
+      return image;
+    }
+  }
+
+  image_t *image = kmem_cache_alloc(&image_cache);
+  if (image)
+  {
+    image->file = file;
+    image->size = size;
+    refcnt_init(&image->users);
+    list_init(&image->segs);
+    list_add_tail(&image_list, &image->node);
+  }
+
+  spin_unlock(&image_lock);
+  return image;
+}
+
+bool image_map(image_t *image, elf64_phdr_t *phdr, uintptr_t start, size_t len, vm_acc_t flags)
+{
+  spin_lock(&image_lock);
+
+  /* take a reference to each frame for this mapping of it */
+  image_seg_t *seg = _image_seg(image, phdr, start, len);
+  if (seg)
+  {
+    for (size_t i = 0; i < seg->pages; i++)
+      ksm_get(seg->frames[i]);
+  }
+
+  spin_unlock(&image_lock);
+
+  if (!seg)
+    return false;
+
+  /* the caller is a user of the image, so the segment can't be freed yet */
+  if (!vmm_map_shared(start, seg->frames, seg->pages, flags))
+  {
+    for (size_t i = 0; i < seg->pages; i++)
+      ksm_put(seg->frames[i]);
+
+    return false;
+  }
+
+  return true;
+}
+
+void image_put(image_t *image)
+{
+  spin_lock(&image_lock);
+
+  refcnt_release(&image->users);
+  if (image->users.count > 0)
+  {
+    spin_unlock(&image_lock);
+    return;
+  }
+
+  list_remove(&image_list, &image->node);
+  spin_unlock(&image_lock);
+
+  list_for_each(&image->segs, node)
+  {
+    image_seg_t *seg = container_of(node, image_seg_t, node);
+    image_seg_free(seg);
+  }
+
+  kmem_cache_free(&image_cache, image);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef ARC_PROC_IMAGE_H
+#define ARC_PROC_IMAGE_H
+
+#include <arc/mm/common.h>
+#include <arc/proc/elf64.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A cache of loaded ELF images. The read-only segments of an image are copied
+ * into frames once, and every process running the image maps those frames (as
+ * merged pages, see ksm.h) instead of having its own copy. Writable segments
+ * are still private to each process.
+ */
+typedef struct image image_t;
+
+/*
+ * finds the image of an ELF file (comparing the contents, as a module which
+ * is loaded more than once is in memory more than once), creating it if it
+ * isn't cached, and adds a user to it. the file must stay mapped while the
+ * image is in use
+ */
+image_t *image_get(const void *file, size_t size);
+
+/*
+ * maps the read-only segment described by phdr at [start, start + len) in the
+ * current address space, which must not have anything mapped there yet. the
+ * segment's frames are filled in by the first process which maps it
+ */
+bool image_map(image_t *image, elf64_phdr_t *phdr, uintptr_t start, size_t len, vm_acc_t flags);
+
+/*
+ * removes a user from an image, freeing it when there are none left. frames
+ * which are still mapped by a process are freed when they are unmapped
+ */
+void image_put(image_t *image);
+
+#endif
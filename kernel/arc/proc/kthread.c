@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/proc/kthread.h>
+#include <arc/proc/proc.h>
+#include <arc/lock/spinlock.h>
+
+static spinlock_t kthread_lock = SPIN_UNLOCKED;
+static proc_t *kthread_proc;
+
+thread_t *kthread_create(kthread_func_t func)
+{
+  spin_lock(&kthread_lock);
+
+  if (!kthread_proc)
+  {
+    kthread_proc = proc_create();
+    if (!kthread_proc)
+    {
+      spin_unlock(&kthread_lock);
+      return 0;
+    }
+  }
+
+  thread_t *thread = thread_create(kthread_proc, THREAD_KERNEL, 0);
+  spin_unlock(&kthread_lock);
+
+  if (!thread)
+    return 0;
+
+  thread->rip = (uint64_t) func;
+  thread_resume(thread);
+  return thread;
+}
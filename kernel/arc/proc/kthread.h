@@ -14,18 +14,19 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#ifndef ARC_MM_SEQ_H
-#define ARC_MM_SEQ_H
 
-#include <stddef.h>
+#ifndef ARC_PROC_KTHREAD_H
+#define ARC_PROC_KTHREAD_H
+
+#include <arc/proc/thread.h>
+
+typedef void (*kthread_func_t)(void);
 
 /*
- * Allocates memory from a small 'pool' that can be used before the real
- * allocator has been set up. This memory can never be freed, and the pool is
- * small, so this should be used only when absolutely necessary.
+ * Starts a kernel thread (e.g. a background memory management daemon) running
+ * func, which must never return. Kernel threads all belong to one process,
+ * which has nothing mapped in its user half and is created by the first call.
  */
-void *seq_alloc(size_t len);
-
-void seq_trace(void);
+thread_t *kthread_create(kthread_func_t func);
 
 #endif
@@ -37,12 +37,17 @@ static void module_load(multiboot_tag_t *tag)
   /* switch our address space */
   proc_switch(proc);
 
+  /* find the image, so code is shared with other copies of the module */
+  proc->image = image_get(elf, size);
+  if (!proc->image)
+    panic("couldn't create image for module");
+
   /* load the ELF file */
   if (!elf64_load(elf, size))
     panic("couldn't load elf64 file");
 
   /* make a new thread */
-  thread_t *thread = thread_create(proc, 0);
+  thread_t *thread = thread_create(proc, 0, 0);
   if (!thread)
     panic("couldn't create thread for module");
 
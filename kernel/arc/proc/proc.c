@@ -19,26 +19,31 @@
 #include <arc/smp/cpu.h>
 #include <arc/mm/pmm.h>
 #include <arc/mm/vmm.h>
+#include <arc/mm/slab.h>
 #include <arc/lock/intr.h>
-#include <stdlib.h>
+
+static kmem_cache_t proc_cache = KMEM_CACHE("proc", sizeof(proc_t), _Alignof(proc_t), 0);
+
+list_t proc_list = LIST_EMPTY;
+spinlock_t proc_list_lock = SPIN_UNLOCKED;
 
 proc_t *proc_create(void)
 {
-  proc_t *proc = malloc(sizeof(*proc));
+  proc_t *proc = kmem_cache_alloc(&proc_cache);
   if (!proc)
     return 0;
 
   proc->pml4_table = pmm_alloc();
   if (!proc->pml4_table)
   {
-    free(proc);
+    kmem_cache_free(&proc_cache, proc);
     return 0;
   }
 
   if (!vmm_init_pml4(proc->pml4_table))
   {
     pmm_free(proc->pml4_table);
-    free(proc);
+    kmem_cache_free(&proc_cache, proc);
     return 0;
   }
 
@@ -47,12 +52,19 @@ proc_t *proc_create(void)
   if (!seg_init(&proc->segments))
   {
     pmm_free(proc->pml4_table);
-    free(proc);
+    kmem_cache_free(&proc_cache, proc);
     return 0;
   }
 
   proc->state = PROC_RUNNING;
+  proc->image = 0;
+  refcnt_init(&proc->refs);
   list_init(&proc->thread_list);
+
+  spin_lock(&proc_list_lock);
+  list_add_tail(&proc_list, &proc->node);
+  spin_unlock(&proc_list_lock);
+
   return proc;
 }
 
@@ -83,6 +95,11 @@ void proc_destroy(proc_t *proc)
 {
   // TODO: destroy threads within the process and make sure they aren't queued
 
+  /* stop walkers looking at the process, though some may still have it pinned */
+  spin_lock(&proc_list_lock);
+  proc->state = PROC_DEAD;
+  spin_unlock(&proc_list_lock);
+
   /* lock interrupts so we can temporarily switch address spaces */
   intr_lock();
 
@@ -97,9 +114,36 @@ void proc_destroy(proc_t *proc)
   cr3_write(old_pml4_table);
   intr_unlock();
 
+  /* stop using the image, which frees it if this was the last user */
+  if (proc->image)
+    image_put(proc->image);
+
   // TODO: if cpu->proc == proc, change it to 0?
 
+  /* drop the process's own reference */
+  proc_release(proc);
+}
+
+void proc_retain(proc_t *proc)
+{
+  refcnt_retain(&proc->refs);
+}
+
+void proc_release(proc_t *proc)
+{
+  spin_lock(&proc_list_lock);
+
+  refcnt_release(&proc->refs);
+  if (proc->refs.count > 0)
+  {
+    spin_unlock(&proc_list_lock);
+    return;
+  }
+
+  list_remove(&proc_list, &proc->node);
+  spin_unlock(&proc_list_lock);
+
   /* free the pml4 table and process struct */
   pmm_free(proc->pml4_table);
-  free(proc);
+  kmem_cache_free(&proc_cache, proc);
 }
@@ -18,21 +18,30 @@
 #define ARC_PROC_PROC_H
 
 #include <arc/mm/seg.h>
+#include <arc/proc/image.h>
 #include <arc/proc/thread.h>
 #include <arc/lock/spinlock.h>
 #include <arc/util/list.h>
+#include <arc/util/refcnt.h>
 #include <stdint.h>
 
 typedef enum
 {
-  PROC_RUNNING
+  PROC_RUNNING,
+  PROC_DEAD /* being destroyed, but still pinned in proc_list */
 } proc_state_t;
 
 typedef struct proc
 {
+  /* node used by proc_list */
+  list_node_t node;
+
   /* state */
   proc_state_t state;
 
+  /* references which keep the process in proc_list, see proc_retain() */
+  refcnt_t refs;
+
   /* physical address of the pml4 table of this process */
   uintptr_t pml4_table;
 
@@ -44,8 +53,15 @@ typedef struct proc
 
   /* memory segments */
   seg_t segments;
+
+  /* the image this process was loaded from, if any */
+  image_t *image;
 } proc_t;
 
+/* every process, used by code which has to look at all address spaces */
+extern list_t proc_list;
+extern spinlock_t proc_list_lock;
+
 proc_t *proc_create(void);
 proc_t *proc_get(void);
 void proc_switch(proc_t *proc);
@@ -64,4 +80,14 @@ void proc_thread_remove(proc_t *proc, thread_t *thread);
 
 void proc_destroy(proc_t *proc);
 
+/*
+ * pins a process, so code walking every address space can drop
+ * proc_list_lock while it works in one. the process stays in proc_list (and
+ * its page tables stay allocated) until the last reference is released, but
+ * is marked PROC_DEAD as soon as it starts being destroyed, and walkers must
+ * skip dead processes. proc_retain() must be called with proc_list_lock held.
+ */
+void proc_retain(proc_t *proc);
+void proc_release(proc_t *proc);
+
 #endif
@@ -26,35 +26,232 @@
 #include <arc/panic.h>
 #include <string.h>
 
-#define SCHED_TIMESLICE 10 /* 10ms = 100Hz */
+#define SCHED_TICK 10 /* 10ms = 100Hz */
 
-/* a list of threads that are ready to run */
-static spinlock_t thread_queue_lock = SPIN_UNLOCKED;
-static list_t thread_queue = LIST_EMPTY;
+/* the number of ticks between priority boosts */
+#define SCHED_BOOST_TICKS 100
+
+/*
+ * the number of ticks since the scheduler started, counted by the BSP. it is
+ * only written by the BSP, other cpus just read it
+ */
+static uint64_t sched_ticks;
 
 void sched_init(void)
 {
   if (smp_mode == MODE_SMP)
-    apic_monotonic(SCHED_TIMESLICE, &sched_tick);
+    apic_monotonic(SCHED_TICK, &sched_tick);
   else
-    pit_monotonic(SCHED_TIMESLICE, &sched_tick);
+    pit_monotonic(SCHED_TICK, &sched_tick);
+}
+
+/* the number of ticks a thread may run for at a level, before it is demoted */
+static int sched_timeslice(int level)
+{
+  return level + 1;
+}
+
+/* locks the cpu the thread is on, which can change until it is locked */
+static cpu_t *sched_lock_thread(thread_t *thread)
+{
+  for (;;)
+  {
+    cpu_t *cpu = thread->cpu;
+    spin_lock(&cpu->sched_lock);
+    if (thread->cpu == cpu)
+      return cpu;
+
+    spin_unlock(&cpu->sched_lock);
+  }
+}
+
+static void _sched_enqueue(cpu_t *cpu, thread_t *thread)
+{
+  thread->cpu = cpu;
+  thread->queued = true;
+  thread->queued_run = cpu->sched_runs;
+  list_add_tail(&cpu->run_queues[thread->level], &thread->sched_node);
+  cpu->run_levels |= 1 << thread->level;
+  cpu->run_count++;
+}
+
+static void _sched_dequeue(cpu_t *cpu, thread_t *thread)
+{
+  thread->queued = false;
+  list_remove(&cpu->run_queues[thread->level], &thread->sched_node);
+  if (cpu->run_queues[thread->level].size == 0)
+    cpu->run_levels &= ~(1 << thread->level);
+  cpu->run_count--;
+}
+
+/* returns the first thread in the highest priority queue which isn't empty */
+static thread_t *_sched_first(cpu_t *cpu)
+{
+  if (!cpu->run_levels)
+    return 0;
+
+  int level = __builtin_ctz(cpu->run_levels);
+  return container_of(cpu->run_queues[level].head, thread_t, sched_node);
+}
+
+/*
+ * moves every thread on this cpu back to its base priority, so threads which
+ * have been demoted (or were waiting behind threads at higher levels) get
+ * another chance
+ */
+static void _sched_boost(cpu_t *cpu, thread_t *cur_thread)
+{
+  /* threads only move to higher levels, whose queues have been done already */
+  for (int level = 0; level < SCHED_LEVELS; level++)
+  {
+    list_for_each(&cpu->run_queues[level], node)
+    {
+      thread_t *thread = container_of(node, thread_t, sched_node);
+      thread->slice_used = 0;
+      if (thread->level != thread->priority)
+      {
+        _sched_dequeue(cpu, thread);
+        thread->level = thread->priority;
+        _sched_enqueue(cpu, thread);
+      }
+    }
+  }
+
+  list_for_each(&cpu->sleep_queue, node)
+  {
+    thread_t *thread = container_of(node, thread_t, sched_node);
+    thread->level = thread->priority;
+    thread->slice_used = 0;
+  }
+
+  if (cur_thread)
+  {
+    cur_thread->level = cur_thread->priority;
+    cur_thread->slice_used = 0;
+  }
+}
+
+/*
+ * picks the cpu to run a resumed thread on. the cpu it last ran on is
+ * preferred, as its caches may still be warm, unless it has more threads
+ * waiting than this one. the queue sizes are read without locking, as it
+ * doesn't matter if they are slightly out of date
+ */
+static cpu_t *sched_pick_cpu(thread_t *thread)
+{
+  cpu_t *cpu = cpu_get();
+  cpu_t *last = thread->cpu;
+  if (last && last->run_count <= cpu->run_count)
+    return last;
+
+  return cpu;
+}
+
+/*
+ * takes a thread from another cpu's run queues, for a cpu which has nothing
+ * else to run. queues which look empty are skipped without locking them, and
+ * busy ones are skipped rather than waited for, so stealing never holds up a
+ * cpu which has work to do. the oldest thread in the highest priority queue
+ * is taken, but only if it was queued before the other cpu's latest run of
+ * the scheduler: a thread queued by that run may still be on its way out,
+ * using its kernel stack
+ */
+static thread_t *sched_steal(cpu_t *cpu)
+{
+  list_node_t *node = cpu->node.next ? cpu->node.next : cpu_list.head;
+  for (; node != &cpu->node; node = node->next ? node->next : cpu_list.head)
+  {
+    cpu_t *victim = container_of(node, cpu_t, node);
+    if (victim->run_count == 0 || !spin_try_lock(&victim->sched_lock))
+      continue;
+
+    thread_t *thread = 0;
+    for (uint32_t levels = victim->run_levels; levels; levels &= levels - 1)
+    {
+      int level = __builtin_ctz(levels);
+      thread_t *oldest = container_of(victim->run_queues[level].head, thread_t, sched_node);
+      if (oldest->queued_run != victim->sched_runs)
+      {
+        _sched_dequeue(victim, oldest);
+        oldest->cpu = cpu;
+        thread = oldest;
+        break;
+      }
+    }
+
+    spin_unlock(&victim->sched_lock);
+
+    if (thread)
+      return thread;
+  }
+
+  return 0;
 }
 
 void sched_thread_resume(thread_t *thread)
 {
-  spin_lock(&thread_queue_lock);
-  list_add_tail(&thread_queue, &thread->sched_node);
-  spin_unlock(&thread_queue_lock);
+  cpu_t *cpu = sched_pick_cpu(thread);
+
+  spin_lock(&cpu->sched_lock);
+  _sched_enqueue(cpu, thread);
+  spin_unlock(&cpu->sched_lock);
 }
 
 void sched_thread_suspend(thread_t *thread)
 {
-  spin_lock(&thread_queue_lock);
-  list_remove(&thread_queue, &thread->sched_node);
-  spin_unlock(&thread_queue_lock);
+  if (!thread->cpu)
+    return;
+
+  /* a thread which is running isn't in a queue, it just isn't requeued */
+  cpu_t *cpu = sched_lock_thread(thread);
+  if (thread->queued)
+    _sched_dequeue(cpu, thread);
+  spin_unlock(&cpu->sched_lock);
 }
 
-void sched_tick(cpu_state_t *state)
+void sched_thread_sleep(thread_t *thread, uint64_t ms)
+{
+  uint64_t ticks = ms / SCHED_TICK;
+  if (ticks == 0)
+    ticks = 1;
+
+  /* the thread is running on this cpu, so it is the one which sleeps it */
+  cpu_t *cpu = sched_lock_thread(thread);
+  thread->wake_tick = sched_ticks + ticks;
+  spin_unlock(&cpu->sched_lock);
+}
+
+void sched_thread_wake(thread_t *thread)
+{
+  cpu_t *cpu = sched_lock_thread(thread);
+  thread->wake_tick = 0;
+  spin_unlock(&cpu->sched_lock);
+}
+
+void sched_thread_priority(thread_t *thread, int priority)
+{
+  if (!thread->cpu)
+  {
+    thread->priority = thread->level = priority;
+    thread->slice_used = 0;
+    return;
+  }
+
+  /* a queued thread has to move to the queue for its new level */
+  cpu_t *cpu = sched_lock_thread(thread);
+  bool queued = thread->queued;
+  if (queued)
+    _sched_dequeue(cpu, thread);
+
+  thread->priority = thread->level = priority;
+  thread->slice_used = 0;
+
+  if (queued)
+    _sched_enqueue(cpu, thread);
+  spin_unlock(&cpu->sched_lock);
+}
+
+static void sched_switch(cpu_state_t *state, bool tick)
 {
   cpu_t *cpu = cpu_get();
 
@@ -62,23 +259,90 @@ void sched_tick(cpu_state_t *state)
   thread_t *cur_thread = cpu->thread;
   thread_t *new_thread = 0;
 
-  spin_lock(&thread_queue_lock);
+  if (tick && cpu->bsp)
+    sched_ticks++;
+
+  /*
+   * save the register file for the current thread before it is queued, as
+   * another cpu may pick it up as soon as it is
+   */
+  if (cur_thread)
+  {
+    memcpy(cur_thread->regs, state->regs, sizeof(state->regs));
+    cur_thread->rip = state->rip;
+    cur_thread->rsp = state->rsp;
+    cur_thread->rflags = state->rflags;
+    cur_thread->cs = state->cs;
+    cur_thread->ss = state->ss;
+  }
+
+  spin_lock(&cpu->sched_lock);
+
+  cpu->sched_runs++;
+
+  if (tick && sched_ticks - cpu->sched_boosted >= SCHED_BOOST_TICKS)
+  {
+    _sched_boost(cpu, cur_thread);
+    cpu->sched_boosted = sched_ticks;
+  }
+
+  /* wake up any sleeping threads whose time is up */
+  list_for_each(&cpu->sleep_queue, node)
+  {
+    thread_t *thread = container_of(node, thread_t, sched_node);
+    if (thread->wake_tick <= sched_ticks)
+    {
+      list_remove(&cpu->sleep_queue, node);
+      thread->state = THREAD_RUNNING;
+      _sched_enqueue(cpu, thread);
+    }
+  }
 
-  /* add the current thread to the queue if it is runnable */
   if (cur_thread && cur_thread->state == THREAD_RUNNING)
   {
-    list_add_tail(&thread_queue, &cur_thread->sched_node);
+    /*
+     * a thread which uses up its timeslice is demoted. the time it has used is
+     * kept when it yields or sleeps, so it can't stay at a level by giving up
+     * the cpu just before its timeslice ends
+     */
+    bool expired = false;
+    if (tick && ++cur_thread->slice_used >= sched_timeslice(cur_thread->level))
+    {
+      if (cur_thread->level < SCHED_LEVELS - 1)
+        cur_thread->level++;
+
+      cur_thread->slice_used = 0;
+      expired = true;
+    }
+
+    /*
+     * carry on running the current thread until its timeslice ends, unless it
+     * yielded or a thread with a higher priority is ready
+     */
+    uint32_t higher = (1 << cur_thread->level) - 1;
+    if (tick && !expired && !(cpu->run_levels & higher))
+      new_thread = cur_thread;
+    else
+      _sched_enqueue(cpu, cur_thread);
+  }
+  else if (cur_thread && cur_thread->state == THREAD_SLEEPING)
+  {
+    list_add_tail(&cpu->sleep_queue, &cur_thread->sched_node);
   }
 
   /* pick the next thread to run */
-  list_node_t *head = thread_queue.head;
-  if (head)
+  if (!new_thread)
   {
-    new_thread = container_of(head, thread_t, sched_node);
-    list_remove(&thread_queue, head);
+    new_thread = _sched_first(cpu);
+    if (new_thread)
+      _sched_dequeue(cpu, new_thread);
   }
 
-  spin_unlock(&thread_queue_lock);
+  spin_unlock(&cpu->sched_lock);
+
+  /* if there is nothing to run here, look for work on the other cpus */
+  if (!new_thread)
+    new_thread = sched_steal(cpu);
 
   /* if there is no new thread, switch to the idle thread */
   if (!new_thread)
@@ -90,17 +354,6 @@ void sched_tick(cpu_state_t *state)
     /* actually swap the pointers over */
     cpu->thread = new_thread;
 
-    /* save the register file for the current thread */
-    if (cur_thread)
-    {
-      memcpy(cur_thread->regs, state->regs, sizeof(state->regs));
-      cur_thread->rip = state->rip;
-      cur_thread->rsp = state->rsp;
-      cur_thread->rflags = state->rflags;
-      cur_thread->cs = state->cs;
-      cur_thread->ss = state->ss;
-    }
-
     /* restore the register file for the new thread */
     memcpy(state->regs, new_thread->regs, sizeof(state->regs));
     state->rip = new_thread->rip;
@@ -117,3 +370,13 @@ void sched_tick(cpu_state_t *state)
     tss_set_rsp0(new_thread->kernel_rsp);
   }
 }
+
+void sched_tick(cpu_state_t *state)
+{
+  sched_switch(state, true);
+}
+
+void sched_yield(cpu_state_t *state)
+{
+  sched_switch(state, false);
+}
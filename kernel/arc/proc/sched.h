@@ -20,10 +20,25 @@
 #include <arc/cpu/state.h>
 #include <arc/proc/thread.h>
 
+/*
+ * the scheduler is a multi-level feedback queue. a thread which uses up its
+ * timeslice is demoted to the next level, which has a longer timeslice, so
+ * cpu-bound threads sink while threads which block or sleep stay near their
+ * base priority. level 0 has the highest priority, and every thread is moved
+ * back to its base priority periodically so threads at the bottom don't starve
+ */
+#define SCHED_LEVELS 8
+
+/* the base priority of new threads, leaving room for threads to be raised */
+#define SCHED_PRIORITY_DEFAULT (SCHED_LEVELS / 2)
+
 void sched_init(void);
 
 /*
- * add/remove a thread from the scheduler's queue
+ * add/remove a thread from the scheduler's queues. each cpu has its own run
+ * queue: a resumed thread is put on the queue of the cpu it last ran on (or
+ * this cpu, if it is less busy), and cpus with nothing to run steal threads
+ * from the others
  *
  * these functions should _not_ be called directly - use thread_suspend() and
  * thread_resume() instead, as they correctly deal with locking and updating
@@ -32,6 +47,27 @@ void sched_init(void);
 void sched_thread_resume(thread_t *thread);
 void sched_thread_suspend(thread_t *thread);
 
+/*
+ * sets when a sleeping thread wakes up (this should only be called by
+ * thread_sleep() and thread_wake()). the scheduler moves the thread to its
+ * cpu's sleep queue when it next switches away from it, and back to the run
+ * queue on the first tick after that time
+ */
+void sched_thread_sleep(thread_t *thread, uint64_t ms);
+void sched_thread_wake(thread_t *thread);
+
+/*
+ * sets a thread's base priority (this should only be called by
+ * thread_set_priority()), moving it to that level straight away
+ */
+void sched_thread_priority(thread_t *thread, int priority);
+
+/*
+ * sched_tick() is called by the timer, and charges the current thread for the
+ * tick. sched_yield() switches to another thread straight away, without
+ * charging it (e.g. when it yields or exits)
+ */
 void sched_tick(cpu_state_t *state);
+void sched_yield(cpu_state_t *state);
 
 #endif
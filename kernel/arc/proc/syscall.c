@@ -35,7 +35,12 @@ uintptr_t syscall_table[] =
 {
   /* 0 */ (uintptr_t) &sys_trace,
   /* 1 */ (uintptr_t) &sys_exit,
-  /* 2 */ (uintptr_t) &sys_yield
+  /* 2 */ (uintptr_t) &sys_yield,
+  /* 3 */ (uintptr_t) &sys_mmap,
+  /* 4 */ (uintptr_t) &sys_munmap,
+  /* 5 */ (uintptr_t) &sys_mprotect,
+  /* 6 */ (uintptr_t) &sys_madvise,
+  /* 7 */ (uintptr_t) &sys_setpriority
 };
 uint64_t syscall_table_size = sizeof(syscall_table) / sizeof(*syscall_table);
 
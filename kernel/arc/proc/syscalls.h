@@ -17,15 +17,48 @@
 #ifndef ARC_PROC_SYSCALLS_H
 #define ARC_PROC_SYSCALLS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <arc/cpu/state.h>
 
-#define SYS_TRACE 0
-#define SYS_EXIT  1
-#define SYS_YIELD 2
+#define SYS_TRACE       0
+#define SYS_EXIT        1
+#define SYS_YIELD       2
+#define SYS_MMAP        3
+#define SYS_MUNMAP      4
+#define SYS_MPROTECT    5
+#define SYS_MADVISE     6
+#define SYS_SETPRIORITY 7
+
+/* sys_mmap() and sys_mprotect() protection flags */
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+/* sys_mmap() flags */
+#define MAP_FIXED    0x10
+#define MAP_POPULATE 0x20
+#define MAP_HUGE     0x40
+#define MAP_HUGE_2M  0x80
+#define MAP_HUGE_1G  0x100
+
+/* sys_madvise() advice */
+#define MADV_NORMAL     0
+#define MADV_SEQUENTIAL 1
+#define MADV_WILLNEED   2
+#define MADV_DONTNEED   3
+#define MADV_FREE       4
+#define MADV_HUGEPAGE   5
+#define MADV_NOHUGEPAGE 6
 
 int64_t sys_trace(const char *message);
 void sys_exit(cpu_state_t *state);
 void sys_yield(cpu_state_t *state);
+int64_t sys_mmap(void *addr, size_t len, int prot, int flags);
+int64_t sys_munmap(void *addr, size_t len);
+int64_t sys_mprotect(void *addr, size_t len, int prot);
+int64_t sys_madvise(void *addr, size_t len, int advice);
+int64_t sys_setpriority(int priority);
 
 #endif
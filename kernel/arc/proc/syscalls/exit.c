@@ -27,5 +27,5 @@ void sys_exit(cpu_state_t *state)
 
   thread_t *thread = thread_get();
   thread_kill(thread);
-  sched_tick(state);
+  sched_yield(state);
 }
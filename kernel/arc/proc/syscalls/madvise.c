@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/proc/syscalls.h>
+#include <arc/mm/align.h>
+#include <arc/mm/seg.h>
+#include <arc/mm/validate.h>
+
+int64_t sys_madvise(void *addr, size_t len, int advice)
+{
+  /* check the address and length */
+  uintptr_t addr_start = (uintptr_t) addr;
+  if (len == 0 || PAGE_ALIGN_REVERSE(addr_start) != addr_start)
+    return -1; // TODO: return some meaningful err number
+
+  len = PAGE_ALIGN(len);
+  if (!valid_buffer(addr, len))
+    return -1;
+
+  /* translate the advice */
+  seg_advice_t seg_advice;
+  switch (advice)
+  {
+    case MADV_NORMAL:
+      seg_advice = SEG_ADV_NORMAL;
+      break;
+
+    case MADV_SEQUENTIAL:
+      seg_advice = SEG_ADV_SEQUENTIAL;
+      break;
+
+    case MADV_WILLNEED:
+      seg_advice = SEG_ADV_WILLNEED;
+      break;
+
+    /* there is no lazy reclaim, so MADV_FREE frees the pages straight away */
+    case MADV_DONTNEED:
+    case MADV_FREE:
+      seg_advice = SEG_ADV_DONTNEED;
+      break;
+
+    case MADV_HUGEPAGE:
+      seg_advice = SEG_ADV_HUGEPAGE;
+      break;
+
+    case MADV_NOHUGEPAGE:
+      seg_advice = SEG_ADV_NOHUGEPAGE;
+      break;
+
+    default:
+      return -1;
+  }
+
+  if (!seg_advise(addr, len, seg_advice))
+    return -1;
+
+  return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/proc/syscalls.h>
+#include <arc/mm/align.h>
+#include <arc/mm/seg.h>
+#include <arc/mm/validate.h>
+
+int64_t sys_mmap(void *addr, size_t len, int prot, int flags)
+{
+  /* check the address and length */
+  uintptr_t addr_start = (uintptr_t) addr;
+  if (len == 0 || PAGE_ALIGN_REVERSE(addr_start) != addr_start)
+    return -1; // TODO: return some meaningful err number
+
+  len = PAGE_ALIGN(len);
+  if (addr && !valid_buffer(addr, len))
+    return -1;
+
+  if ((flags & MAP_FIXED) && !addr)
+    return -1;
+
+  /* convert the protection flags, PROT_NONE leaves the memory inaccessible */
+  vm_acc_t vm_flags = 0;
+  if (prot & PROT_READ)
+    vm_flags |= VM_R;
+  if (prot & PROT_WRITE)
+    vm_flags |= VM_R | VM_W;
+  if (prot & PROT_EXEC)
+    vm_flags |= VM_R | VM_X;
+
+  /* convert the mapping flags */
+  int map_flags = 0;
+  if (flags & MAP_FIXED)
+    map_flags |= SEG_FIXED;
+  if (flags & MAP_POPULATE)
+    map_flags |= SEG_POPULATE;
+  if (flags & MAP_HUGE)
+    map_flags |= SEG_HUGE;
+  if (flags & MAP_HUGE_2M)
+    map_flags |= SEG_HUGE_2M;
+  if (flags & MAP_HUGE_1G)
+    map_flags |= SEG_HUGE_1G;
+
+  void *ptr = seg_map(addr, len, vm_flags, map_flags);
+  if (!ptr)
+    return -1;
+
+  return (int64_t) ptr;
+}
@@ -14,26 +14,24 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <arc/mm/seq.h>
-#include <arc/trace.h>
-#include <stdint.h>
+#include <arc/proc/syscalls.h>
+#include <arc/mm/align.h>
+#include <arc/mm/seg.h>
+#include <arc/mm/validate.h>
 
-#define SEQ_SIZE 8192
-
-static uint8_t seq_pool[SEQ_SIZE];
-static size_t seq_pos = 0;
-
-void *seq_alloc(size_t len)
+int64_t sys_munmap(void *addr, size_t len)
 {
-  if ((seq_pos + len) > SEQ_SIZE)
-    return 0;
+  /* check the address and length */
+  uintptr_t addr_start = (uintptr_t) addr;
+  if (len == 0 || PAGE_ALIGN_REVERSE(addr_start) != addr_start)
+    return -1; // TODO: return some meaningful err number
 
-  void *ptr = &seq_pool[seq_pos];
-  seq_pos += len;
-  return ptr;
-}
+  len = PAGE_ALIGN(len);
+  if (!valid_buffer(addr, len))
+    return -1;
 
-void seq_trace(void)
-{
-  trace_printf("Tracing sequential allocator... %d/%d bytes used.\n", seq_pos, SEQ_SIZE);
+  if (!seg_unmap(addr, len))
+    return -1;
+
+  return 0;
 }
@@ -13,23 +13,15 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <arc/proc/syscalls.h>
+#include <arc/proc/sched.h>
+#include <arc/proc/thread.h>
 
-#ifndef ARC_MM_MAP_H
-#define ARC_MM_MAP_H
-
-#include <stddef.h>
-#include <stdint.h>
-#include <arc/multiboot.h>
-#include <arc/util/list.h>
-
-typedef struct
+int64_t sys_setpriority(int priority)
 {
-  struct list_node node;
-  int type;
-  uintptr_t addr_start;
-  uintptr_t addr_end;
-} mm_map_entry_t;
-
-list_t *mm_map_init(multiboot_t *multiboot);
+  if (priority < 0 || priority >= SCHED_LEVELS)
+    return -1;
 
-#endif
+  thread_set_priority(thread_get(), priority);
+  return 0;
+}
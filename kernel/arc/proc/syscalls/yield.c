@@ -21,5 +21,5 @@
 void sys_yield(cpu_state_t *state)
 {
   state->regs[RAX] = 0; /* when yield() returns in userspace 0 is returned */
-  sched_tick(state);
+  sched_yield(state);
 }
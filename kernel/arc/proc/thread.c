@@ -18,37 +18,54 @@
 #include <arc/proc/sched.h>
 #include <arc/cpu/flags.h>
 #include <arc/cpu/gdt.h>
+#include <arc/cpu/halt.h>
 #include <arc/smp/cpu.h>
 #include <arc/mm/seg.h>
-#include <stdlib.h>
+#include <arc/mm/kstack.h>
+#include <arc/mm/slab.h>
+#include <arc/mm/align.h>
 
-#define USER_STACK_SIZE 8192
-#define KERNEL_STACK_SIZE 8192
-#define STACK_ALIGN 32
+static kmem_cache_t thread_cache = KMEM_CACHE("thread", sizeof(thread_t), _Alignof(thread_t), 0);
 
-thread_t *thread_create(proc_t *proc, int flags)
+thread_t *thread_create(proc_t *proc, int flags, size_t stack_size)
 {
-  thread_t *thread = malloc(sizeof(*thread));
+  thread_t *thread = kmem_cache_alloc(&thread_cache);
   if (!thread)
     return 0;
 
   /* allocate kernel-space stack */
-  thread->kstack = memalign(STACK_ALIGN, KERNEL_STACK_SIZE);
+  thread->kstack = kstack_alloc();
   if (!thread->kstack)
   {
-    free(thread);
+    kmem_cache_free(&thread_cache, thread);
     return 0;
   }
 
-  /* allocate user-space stack */
+  /* reserve user-space stack, which is populated on demand as it grows */
   if (!(flags & THREAD_KERNEL))
   {
-    // TODO seg_alloc() means we need to be in the address space of proc
-    thread->stack = seg_alloc(USER_STACK_SIZE, VM_R | VM_W);
+    if (stack_size == 0)
+      stack_size = THREAD_STACK_DEFAULT;
+    else if (stack_size > THREAD_STACK_MAX)
+      stack_size = THREAD_STACK_MAX;
+
+    thread->stack_size = PAGE_ALIGN(stack_size) + THREAD_STACK_GUARD;
+
+    // TODO seg_map() means we need to be in the address space of proc
+    thread->stack = seg_map(0, thread->stack_size, VM_R | VM_W, 0);
     if (!thread->stack)
     {
-      free(thread->kstack);
-      free(thread);
+      kstack_free(thread->kstack);
+      kmem_cache_free(&thread_cache, thread);
+      return 0;
+    }
+
+    /* make the bottom of the stack inaccessible so overflows fault */
+    if (!seg_protect(thread->stack, THREAD_STACK_GUARD, 0))
+    {
+      seg_unmap(thread->stack, thread->stack_size);
+      kstack_free(thread->kstack);
+      kmem_cache_free(&thread_cache, thread);
       return 0;
     }
   }
@@ -56,9 +73,13 @@ thread_t *thread_create(proc_t *proc, int flags)
   thread->lock = SPIN_UNLOCKED;
   thread->state = THREAD_SUSPENDED;
   thread->proc = proc;
+  thread->cpu = 0;
+  thread->queued = false;
+  thread->priority = thread->level = SCHED_PRIORITY_DEFAULT;
+  thread->slice_used = 0;
   thread->flags = flags;
-  thread->rsp = (flags & THREAD_KERNEL) ? ((uintptr_t) thread->kstack + KERNEL_STACK_SIZE) : ((uintptr_t) thread->stack + USER_STACK_SIZE);
-  thread->kernel_rsp = (uintptr_t) thread->kstack + KERNEL_STACK_SIZE;
+  thread->rsp = (flags & THREAD_KERNEL) ? ((uintptr_t) thread->kstack + KSTACK_SIZE) : ((uintptr_t) thread->stack + thread->stack_size);
+  thread->kernel_rsp = (uintptr_t) thread->kstack + KSTACK_SIZE;
   thread->rflags = FLAGS_IF;
 
   if (flags & THREAD_KERNEL)
@@ -103,6 +124,38 @@ void thread_resume(thread_t *thread)
   spin_unlock(&thread->lock);
 }
 
+void thread_sleep(uint64_t ms)
+{
+  thread_t *thread = thread_get();
+
+  spin_lock(&thread->lock);
+  thread->state = THREAD_SLEEPING;
+  sched_thread_sleep(thread, ms);
+  spin_unlock(&thread->lock);
+
+  /*
+   * the thread keeps running until the next tick, when the scheduler moves it
+   * to the sleep queue. it carries on from here once it has been woken up
+   */
+  while (thread->state == THREAD_SLEEPING)
+    halt_once();
+}
+
+void thread_wake(thread_t *thread)
+{
+  spin_lock(&thread->lock);
+  if (thread->state == THREAD_SLEEPING)
+    sched_thread_wake(thread);
+  spin_unlock(&thread->lock);
+}
+
+void thread_set_priority(thread_t *thread, int priority)
+{
+  spin_lock(&thread->lock);
+  sched_thread_priority(thread, priority);
+  spin_unlock(&thread->lock);
+}
+
 void thread_kill(thread_t *thread)
 {
   spin_lock(&thread->lock);
@@ -136,11 +189,11 @@ void thread_destroy(thread_t *thread)
 
   /* free user-space stack */
   if (!(thread->flags & THREAD_KERNEL))
-    seg_free(thread->stack);
+    seg_unmap(thread->stack, thread->stack_size);
 
   /* free kernel-space stack */
-  free(thread->kstack);
+  kstack_free(thread->kstack);
 
   /* free thread structure itself */
-  free(thread);
+  kmem_cache_free(&thread_cache, thread);
 }
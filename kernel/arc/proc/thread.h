@@ -19,15 +19,28 @@
 
 #include <arc/lock/spinlock.h>
 #include <arc/util/list.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 
 #define THREAD_KERNEL 0x1 /* flag to indicate the thread runs in kernel mode */
 
+/*
+ * user-space stacks are reserved up front but only populated as they grow, so
+ * they can be large without using much memory. the stack size passed to
+ * thread_create() is rounded up to a whole page and limited to THREAD_STACK_MAX
+ * (zero means THREAD_STACK_DEFAULT), and an inaccessible guard page sits below
+ * the stack to catch overflows
+ */
+#define THREAD_STACK_DEFAULT 0x800000   /* 8 MiB */
+#define THREAD_STACK_MAX     0x40000000 /* 1 GiB */
+#define THREAD_STACK_GUARD   0x1000     /* 4 KiB */
+
 typedef enum
 {
   THREAD_RUNNING,
   THREAD_SUSPENDED,
+  THREAD_SLEEPING,
   THREAD_ZOMBIE
 } thread_state_t;
 
@@ -45,8 +58,12 @@ typedef struct
    */
   uint64_t syscall_rsp;
 
-  /* base of the stacks (only used upon thread_destroy) */
+  /*
+   * base of the stacks and the size of the user-space stack including its
+   * guard page (only used upon thread_destroy)
+   */
   void *kstack, *stack;
+  size_t stack_size;
 
   /* flags the thread was created with (ditto) */
   int flags;
@@ -60,9 +77,30 @@ typedef struct
   /* node used by proc_t's thread_list */
   list_node_t proc_node;
 
-  /* node used by scheduler's queue */
+  /* node used by scheduler's queues */
   list_node_t sched_node;
 
+  /*
+   * the cpu whose queues the thread is on, or which is running it, and if it
+   * is in that cpu's run queue (protected by the cpu's sched_lock)
+   */
+  struct cpu *cpu;
+  bool queued;
+
+  /* the cpu's sched_runs when the thread was added to its run queue */
+  uint64_t queued_run;
+
+  /*
+   * the base priority set with thread_set_priority(), the priority level the
+   * thread is at now and the number of ticks of that level's timeslice it has
+   * used (protected by the cpu's sched_lock)
+   */
+  int priority, level;
+  int slice_used;
+
+  /* the scheduler tick a sleeping thread is woken up at */
+  uint64_t wake_tick;
+
   /* process which 'owns' this thread */
   struct proc *proc;
 
@@ -72,11 +110,22 @@ typedef struct
   uint64_t cs, ss;
 } thread_t;
 
-thread_t *thread_create(struct proc *proc, int flags);
+thread_t *thread_create(struct proc *proc, int flags, size_t stack_size);
 thread_t *thread_get(void);
 void thread_suspend(thread_t *thread);
 void thread_resume(thread_t *thread);
 void thread_kill(thread_t *thread);
+
+/*
+ * puts the current thread to sleep for at least the given number of
+ * milliseconds, or until thread_wake() is called. this is intended for kernel
+ * threads, and interrupts must be enabled
+ */
+void thread_sleep(uint64_t ms);
+void thread_wake(thread_t *thread);
+
+/* sets the base priority of a thread, from 0 (highest) to SCHED_LEVELS - 1 */
+void thread_set_priority(thread_t *thread, int priority);
 void thread_destroy(thread_t *thread);
 
 #endif
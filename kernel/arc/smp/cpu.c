@@ -16,12 +16,13 @@
 
 #include <arc/smp/cpu.h>
 #include <arc/cpu/msr.h>
-#include <stdlib.h>
+#include <arc/mm/slab.h>
 #include <string.h>
 
 list_t cpu_list = LIST_EMPTY;
 
 static cpu_t cpu_bsp;
+static kmem_cache_t cpu_cache = KMEM_CACHE("cpu", sizeof(cpu_t), _Alignof(cpu_t), 0);
 
 void cpu_bsp_init(void)
 {
@@ -39,13 +40,14 @@ void cpu_bsp_init(void)
 
 bool cpu_ap_init(cpu_lapic_id_t lapic_id, cpu_acpi_id_t acpi_id)
 {
-  cpu_t *cpu = malloc(sizeof(*cpu));
+  cpu_t *cpu = kmem_cache_alloc(&cpu_cache);
   if (!cpu)
     return false;
 
   memclr(cpu, sizeof(*cpu));
 
   cpu->self = cpu;
+  cpu->id = cpu_list.size;
   cpu->lapic_id = lapic_id;
   cpu->acpi_id = acpi_id;
   cpu->intr_mask_count = 1; // as when this is called, interrupts are masked
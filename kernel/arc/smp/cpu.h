@@ -19,8 +19,11 @@
 
 #include <arc/cpu/gdt.h>
 #include <arc/cpu/tss.h>
+#include <arc/mm/kstack.h>
 #include <arc/proc/proc.h>
+#include <arc/proc/sched.h>
 #include <arc/proc/thread.h>
+#include <arc/lock/spinlock.h>
 #include <arc/util/list.h>
 #include <arc/types.h>
 #include <stdbool.h>
@@ -50,6 +53,9 @@ typedef struct cpu
   /* global CPU list node */
   list_node_t node;
 
+  /* sequential id of this cpu, used to index per-cpu arrays (the BSP is 0) */
+  uint32_t id;
+
   /* BSP flag */
   bool bsp;
 
@@ -70,11 +76,39 @@ typedef struct cpu
   /* idle thread for this cpu */
   thread_t *idle_thread;
 
+  /*
+   * this cpu's ready and sleeping threads, protected by sched_lock. other cpus
+   * add threads to the run queues when resuming them, and take them from them
+   * when they have nothing to run. there is a run queue for each priority
+   * level, and bit n of run_levels is set if run_queues[n] isn't empty
+   */
+  spinlock_t sched_lock;
+  list_t run_queues[SCHED_LEVELS];
+  uint32_t run_levels;
+  int run_count;
+  list_t sleep_queue;
+
+  /* the number of times the scheduler has run on this cpu */
+  uint64_t sched_runs;
+
+  /* the scheduler tick of the last priority boost on this cpu */
+  uint64_t sched_boosted;
+
   /* number of APIC ticks per millisecond */
   uint32_t apic_ticks_per_ms;
 
+  /* recently freed kernel stacks, which are still mapped */
+  void *kstack_cache[KSTACK_CACHE_SIZE];
+  int kstack_cache_count;
+
   /* flags indicating if LINTn should be programmed as NMIs */
   bool apic_lint_nmi[2];
+
+  /* this cpu's malloc() mspace */
+  void *mspace;
+
+  /* chunks freed by other cpus, returned to the mspace on the next malloc() */
+  void *malloc_deferred;
 } cpu_t;
 
 extern list_t cpu_list;
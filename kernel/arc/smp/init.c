@@ -23,23 +23,23 @@
 #include <arc/cpu/pause.h>
 #include <arc/cpu/halt.h>
 #include <arc/cpu/tlb.h>
+#include <arc/cpu/pat.h>
 #include <arc/lock/barrier.h>
 #include <arc/lock/intr.h>
 #include <arc/lock/spinlock.h>
 #include <arc/intr/apic.h>
 #include <arc/mm/vmm.h>
+#include <arc/mm/malloc.h>
+#include <arc/mm/kstack.h>
 #include <arc/time/pit.h>
 #include <arc/proc/sched.h>
 #include <arc/proc/syscall.h>
 #include <arc/util/container.h>
 #include <arc/trace.h>
 #include <arc/panic.h>
-#include <stdlib.h>
 #include <string.h>
 
 #define TRAMPOLINE_BASE 0x1000
-#define IDLE_STACK_SIZE  8192
-#define IDLE_STACK_ALIGN 16
 
 /* some variables used to exchange data between the BSP and APs */
 static bool ack_sipi = false;
@@ -71,20 +71,20 @@ static void smp_boot(cpu_t *cpu)
     panic("couldn't map SMP trampoline code");
 
   /* allocate a stack for this AP */
-  void *idle_stack = memalign(IDLE_STACK_ALIGN, IDLE_STACK_SIZE);
+  void *idle_stack = kstack_alloc();
   if (!idle_stack)
     panic("couldn't allocate AP stack");
 
-  /* set up this cpu's bootstrap stack */
-  uint64_t *rsp = (uint64_t *) &trampoline_stack;
-  *rsp = (uint64_t) idle_stack + IDLE_STACK_SIZE;
-
   /* set the pointer to the cpu struct of the cpu we are booting */
   booted_cpu = cpu;
 
   /* copy the trampoline into low memory */
   memcpy((void *) TRAMPOLINE_BASE, &trampoline_start, trampoline_len);
 
+  /* set up this cpu's bootstrap stack, in the copy as the original is read-only */
+  uintptr_t rsp_off = (uintptr_t) &trampoline_stack - (uintptr_t) &trampoline_start;
+  *(uint64_t *) (TRAMPOLINE_BASE + rsp_off) = (uint64_t) idle_stack + KSTACK_SIZE;
+
   /* reset the ack flag */
   ack_sipi = false;
   barrier();
@@ -163,9 +163,18 @@ void smp_ap_init(void)
   idt_ap_init(); /* we re-use the same IDT for every CPU */
   syscall_init();
 
+  /* use the same memory types as the BSP before touching any MMIO */
+  pat_init();
+
   /* set up the local APIC on this CPU */
   apic_init();
 
+  /* give this CPU its own malloc() mspace */
+  malloc_cpu_init();
+
+  /* set up this CPU's double fault stack */
+  kstack_cpu_init();
+
   /* enable interrupts now the IDT and interrupt controllers are set up */
   intr_unlock();
 
@@ -27,13 +27,18 @@ EFER_NX equ 0x800
 
 ; CR0 bitmasks
 CR0_PE equ 0x1
+CR0_WP equ 0x10000
 CR0_PAGING equ 0x80000000
 
 ; CR4 bitmasks
-CR4_PAE equ 0x20
-CR4_PSE equ 0x10
+CR4_PAE  equ 0x20
+CR4_PSE  equ 0x10
+CR4_PGE  equ 0x80
+CR4_LA57 equ 0x1000
 
 [extern boot_pml4]
+[extern boot_pml5]
+[extern boot_la57]
 [extern smp_ap_init]
 
 [global trampoline_start]
@@ -72,9 +77,13 @@ code32:
   mov fs, ax
   mov gs, ax
 
-  ; enable PAE and PSE
+  ; enable PAE, PSE and global pages, and five-level paging if the BSP enabled it
   mov eax, cr4
-  or eax, (CR4_PAE + CR4_PSE)
+  or eax, (CR4_PAE + CR4_PSE + CR4_PGE)
+  cmp dword [boot_la57], 0
+  je .no_la57
+  or eax, CR4_LA57
+.no_la57:
   mov cr4, eax
 
   ; enable long mode and the NX bit
@@ -83,13 +92,18 @@ code32:
   or eax, (EFER_LM + EFER_NX)
   wrmsr
 
-  ; set cr3 to a pointer to pml4
+  ; set cr3 to a pointer to pml4, or pml5 with five-level paging
   mov eax, boot_pml4
+  cmp dword [boot_la57], 0
+  je .set_cr3
+  mov eax, boot_pml5
+.set_cr3:
   mov cr3, eax
 
-  ; enable paging (the BSP already identity-mapped us)
+  ; enable paging (the BSP already identity-mapped us), with read-only pages
+  ; enforced in ring 0 too
   mov eax, cr0
-  or eax, CR0_PAGING
+  or eax, (CR0_PAGING + CR0_WP)
   mov cr0, eax
 
   ; leave compatibility mode
@@ -115,7 +129,8 @@ vcode64:
 
   ; set up the stack
   mov rbp, 0x0 ; terminate stack traces here
-  mov rax, [qword trampoline_stack]
+  ; (read from the copy in low memory, the kernel image is read-only)
+  mov rax, [qword trampoline_stack - trampoline_start + TRAMPOLINE_BASE]
   mov rsp, rax
 
   ; reset RFLAGS
@@ -20,6 +20,10 @@
 #include <stdarg.h>
 
 void trace_init(void);
+
+/* remaps the VGA buffer as write combining, once mmio_map() can be used */
+void trace_remap(void);
+
 void trace_putch(char c);
 void trace_puts(const char *str);
 void trace_printf(const char *fmt, ...);
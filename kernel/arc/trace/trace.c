@@ -171,6 +171,13 @@ void trace_init(void)
     e9_init();
 }
 
+void trace_remap(void)
+{
+  /* not locked, as mmio_map() might need to trace */
+  if (trace_backends & TRACE_VGA)
+    vga_remap();
+}
+
 void trace_putch(char c)
 {
   spin_lock(&trace_lock);
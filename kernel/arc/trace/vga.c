@@ -17,6 +17,7 @@
 #include <arc/trace/vga.h>
 #include <arc/bda.h>
 #include <arc/cpu/port.h>
+#include <arc/mm/mmio.h>
 #include <arc/mm/phy32.h>
 #include <stdbool.h>
 #include <string.h>
@@ -97,6 +98,18 @@ void vga_init(void)
   vga_sync();
 }
 
+void vga_remap(void)
+{
+  /*
+   * vga_sync() only ever writes whole screens to the video buffer and never
+   * reads it back, so it can be write combining. the phy32 window leaves the
+   * type up to the MTRRs, which usually make it uncacheable.
+   */
+  uint16_t *buf = mmio_map(VIDEO_BUFFER, sizeof(shadow_video_buf), VM_R | VM_W | VM_WC);
+  if (buf)
+    video_buf = buf;
+}
+
 void vga_puts(const char *str)
 {
   for (char c; (c = *str++);)
@@ -20,6 +20,9 @@
 /* initializes the vga 80x25 text mode driver */
 void vga_init(void);
 
+/* moves the video buffer to a write combining mapping */
+void vga_remap(void);
+
 /* puts a character onto the screen */
 void vga_putch(char c);
 
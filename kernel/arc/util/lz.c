@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/util/lz.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH   4
+#define LZ_MAX_MATCH   (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERAL 0x80
+#define LZ_MAX_OFFSET  0xFFFF
+#define LZ_MATCH       0x80
+
+static uint32_t lz_read32(const uint8_t *ptr)
+{
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+static size_t lz_hash(uint32_t value)
+{
+  return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* writes literal tokens for count bytes, returning false if dst is full */
+static bool lz_literals(const uint8_t *in, size_t count, uint8_t *out, size_t *op, size_t out_len)
+{
+  while (count > 0)
+  {
+    size_t n = count > LZ_MAX_LITERAL ? LZ_MAX_LITERAL : count;
+    if (*op + 1 + n > out_len)
+      return false;
+
+    out[(*op)++] = n - 1;
+    memcpy(out + *op, in, n);
+    *op += n;
+
+    in += n;
+    count -= n;
+  }
+
+  return true;
+}
+
+size_t lz_compress(lz_state_t *state, const void *src, size_t len, void *dst, size_t dst_len)
+{
+  if (len > LZ_MAX_INPUT)
+    return 0;
+
+  const uint8_t *in = src;
+  uint8_t *out = dst;
+
+  /* table entries are positions plus one, so zero means empty */
+  memset(state->table, 0, sizeof(state->table));
+
+  size_t ip = 0, anchor = 0, op = 0;
+  while (ip + LZ_MIN_MATCH <= len)
+  {
+    uint32_t value = lz_read32(in + ip);
+    size_t hash = lz_hash(value);
+    size_t candidate = state->table[hash];
+    state->table[hash] = ip + 1;
+
+    if (candidate == 0 || lz_read32(in + candidate - 1) != value || ip - (candidate - 1) > LZ_MAX_OFFSET)
+    {
+      ip++;
+      continue;
+    }
+
+    /* extend the match as far as possible */
+    size_t ref = candidate - 1;
+    size_t match = LZ_MIN_MATCH;
+    while (ip + match < len && match < LZ_MAX_MATCH && in[ref + match] == in[ip + match])
+      match++;
+
+    if (!lz_literals(in + anchor, ip - anchor, out, &op, dst_len))
+      return 0;
+
+    if (op + 3 > dst_len)
+      return 0;
+
+    size_t offset = ip - ref;
+    out[op++] = LZ_MATCH | (match - LZ_MIN_MATCH);
+    out[op++] = offset & 0xFF;
+    out[op++] = offset >> 8;
+
+    ip += match;
+    anchor = ip;
+  }
+
+  if (!lz_literals(in + anchor, len - anchor, out, &op, dst_len))
+    return 0;
+
+  return op;
+}
+
+bool lz_decompress(const void *src, size_t len, void *dst, size_t dst_len)
+{
+  const uint8_t *in = src;
+  uint8_t *out = dst;
+
+  size_t ip = 0, op = 0;
+  while (ip < len)
+  {
+    uint8_t token = in[ip++];
+    if (!(token & LZ_MATCH))
+    {
+      size_t n = token + 1;
+      if (ip + n > len || op + n > dst_len)
+        return false;
+
+      memcpy(out + op, in + ip, n);
+      ip += n;
+      op += n;
+    }
+    else
+    {
+      if (ip + 2 > len)
+        return false;
+
+      size_t offset = in[ip] | (in[ip + 1] << 8);
+      size_t match = (token & ~LZ_MATCH) + LZ_MIN_MATCH;
+      ip += 2;
+
+      if (offset == 0 || offset > op || op + match > dst_len)
+        return false;
+
+      /* the source and destination may overlap, so copy a byte at a time */
+      for (size_t i = 0; i < match; i++, op++)
+        out[op] = out[op - offset];
+    }
+  }
+
+  return op == dst_len;
+}
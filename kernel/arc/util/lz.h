@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ARC_UTIL_LZ_H
+#define ARC_UTIL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A small LZ77 compressor, intended for compressing pages of memory quickly
+ * rather than well. The output is a series of tokens:
+ *
+ *   0LLLLLLL <L+1 literal bytes>
+ *   1LLLLLLL <16-bit little endian offset> (copy L+4 bytes from offset back)
+ *
+ * The input can be at most LZ_MAX_INPUT bytes long.
+ */
+#define LZ_MAX_INPUT 0xFFFF
+
+#define LZ_HASH_BITS 10
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+/* scratch space for the compressor, too large to put on a kernel stack */
+typedef struct
+{
+  uint16_t table[LZ_HASH_SIZE];
+} lz_state_t;
+
+/*
+ * compresses len bytes from src into dst, returning the compressed length, or
+ * zero if it wouldn't fit in dst_len bytes
+ */
+size_t lz_compress(lz_state_t *state, const void *src, size_t len, void *dst, size_t dst_len);
+
+/*
+ * decompresses len bytes from src into dst, returning true only if the input
+ * was valid and decompressed to exactly dst_len bytes
+ */
+bool lz_decompress(const void *src, size_t len, void *dst, size_t dst_len);
+
+#endif
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <arc/util/tree.h>
+#include <assert.h>
+
+static int tree_height(tree_node_t *node)
+{
+  return node ? node->height : 0;
+}
+
+static void tree_fix(tree_t *tree, tree_node_t *node)
+{
+  int left = tree_height(node->left);
+  int right = tree_height(node->right);
+  node->height = (left > right ? left : right) + 1;
+
+  if (tree->augment)
+    (*tree->augment)(node);
+}
+
+static void tree_replace_child(tree_t *tree, tree_node_t *parent, tree_node_t *old_node, tree_node_t *new_node)
+{
+  if (!parent)
+    tree->root = new_node;
+  else if (parent->left == old_node)
+    parent->left = new_node;
+  else
+    parent->right = new_node;
+}
+
+static tree_node_t *tree_rotate_left(tree_t *tree, tree_node_t *node)
+{
+  tree_node_t *pivot = node->right;
+
+  node->right = pivot->left;
+  if (pivot->left)
+    pivot->left->parent = node;
+
+  pivot->parent = node->parent;
+  tree_replace_child(tree, node->parent, node, pivot);
+
+  pivot->left = node;
+  node->parent = pivot;
+
+  tree_fix(tree, node);
+  tree_fix(tree, pivot);
+  return pivot;
+}
+
+static tree_node_t *tree_rotate_right(tree_t *tree, tree_node_t *node)
+{
+  tree_node_t *pivot = node->left;
+
+  node->left = pivot->right;
+  if (pivot->right)
+    pivot->right->parent = node;
+
+  pivot->parent = node->parent;
+  tree_replace_child(tree, node->parent, node, pivot);
+
+  pivot->right = node;
+  node->parent = pivot;
+
+  tree_fix(tree, node);
+  tree_fix(tree, pivot);
+  return pivot;
+}
+
+/* walks from the given node up to the root, restoring the AVL property */
+static void tree_rebalance(tree_t *tree, tree_node_t *node)
+{
+  while (node)
+  {
+    tree_fix(tree, node);
+
+    int balance = tree_height(node->left) - tree_height(node->right);
+    if (balance > 1)
+    {
+      if (tree_height(node->left->left) < tree_height(node->left->right))
+        tree_rotate_left(tree, node->left);
+      node = tree_rotate_right(tree, node);
+    }
+    else if (balance < -1)
+    {
+      if (tree_height(node->right->right) < tree_height(node->right->left))
+        tree_rotate_right(tree, node->right);
+      node = tree_rotate_left(tree, node);
+    }
+
+    node = node->parent;
+  }
+}
+
+void tree_init(tree_t *tree, tree_compare_t compare, tree_augment_t augment)
+{
+  tree->root = 0;
+  tree->compare = compare;
+  tree->augment = augment;
+  tree->size = 0;
+}
+
+void tree_insert(tree_t *tree, tree_node_t *node)
+{
+  tree_node_t *parent = 0, **link = &tree->root;
+  while (*link)
+  {
+    parent = *link;
+    if ((*tree->compare)(node, parent) < 0)
+      link = &parent->left;
+    else
+      link = &parent->right;
+  }
+
+  node->left = node->right = 0;
+  node->parent = parent;
+  node->height = 1;
+  *link = node;
+
+  tree->size++;
+  tree_rebalance(tree, node);
+}
+
+void tree_remove(tree_t *tree, tree_node_t *node)
+{
+  assert(tree->size != 0);
+
+  if (node->left && node->right)
+  {
+    /* replace the node with its successor, which has no left child */
+    tree_node_t *successor = node->right;
+    while (successor->left)
+      successor = successor->left;
+
+    tree_node_t *fix;
+    if (successor->parent == node)
+    {
+      fix = successor;
+    }
+    else
+    {
+      fix = successor->parent;
+
+      fix->left = successor->right;
+      if (successor->right)
+        successor->right->parent = fix;
+
+      successor->right = node->right;
+      node->right->parent = successor;
+    }
+
+    successor->left = node->left;
+    node->left->parent = successor;
+
+    successor->parent = node->parent;
+    tree_replace_child(tree, node->parent, node, successor);
+
+    tree_rebalance(tree, fix);
+  }
+  else
+  {
+    tree_node_t *child = node->left ? node->left : node->right;
+    if (child)
+      child->parent = node->parent;
+
+    tree_replace_child(tree, node->parent, node, child);
+    tree_rebalance(tree, node->parent);
+  }
+
+  tree->size--;
+}
+
+void tree_update(tree_t *tree, tree_node_t *node)
+{
+  for (; node; node = node->parent)
+    tree_fix(tree, node);
+}
+
+tree_node_t *tree_first(tree_t *tree)
+{
+  tree_node_t *node = tree->root;
+  if (node)
+  {
+    while (node->left)
+      node = node->left;
+  }
+  return node;
+}
+
+tree_node_t *tree_last(tree_t *tree)
+{
+  tree_node_t *node = tree->root;
+  if (node)
+  {
+    while (node->right)
+      node = node->right;
+  }
+  return node;
+}
+
+tree_node_t *tree_next(tree_node_t *node)
+{
+  if (node->right)
+  {
+    node = node->right;
+    while (node->left)
+      node = node->left;
+    return node;
+  }
+
+  while (node->parent && node->parent->right == node)
+    node = node->parent;
+
+  return node->parent;
+}
+
+tree_node_t *tree_prev(tree_node_t *node)
+{
+  if (node->left)
+  {
+    node = node->left;
+    while (node->right)
+      node = node->right;
+    return node;
+  }
+
+  while (node->parent && node->parent->left == node)
+    node = node->parent;
+
+  return node->parent;
+}
+
+tree_node_t *tree_find(tree_t *tree, const tree_node_t *key)
+{
+  tree_node_t *node = tree->root;
+  while (node)
+  {
+    int result = (*tree->compare)(node, key);
+    if (result == 0)
+      return node;
+    else if (result < 0)
+      node = node->right;
+    else
+      node = node->left;
+  }
+
+  return 0;
+}
+
+tree_node_t *tree_floor(tree_t *tree, const tree_node_t *key)
+{
+  tree_node_t *node = tree->root, *match = 0;
+  while (node)
+  {
+    if ((*tree->compare)(node, key) <= 0)
+    {
+      match = node;
+      node = node->right;
+    }
+    else
+    {
+      node = node->left;
+    }
+  }
+
+  return match;
+}
+
+tree_node_t *tree_ceil(tree_t *tree, const tree_node_t *key)
+{
+  tree_node_t *node = tree->root, *match = 0;
+  while (node)
+  {
+    if ((*tree->compare)(node, key) >= 0)
+    {
+      match = node;
+      node = node->left;
+    }
+    else
+    {
+      node = node->right;
+    }
+  }
+
+  return match;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ARC_UTIL_TREE_H
+#define ARC_UTIL_TREE_H
+
+/*
+ * An intrusive, self-balancing (AVL) binary search tree. Like list_node_t, the
+ * tree_node_t is embedded in the structure being stored, and container_of() is
+ * used to get back to the structure from the node.
+ *
+ * The compare function is passed pointers to two tree_node_t structures, in
+ * the same way as list_compare_t. Lookups are performed by filling out a
+ * temporary 'key' structure on the stack and passing a pointer to its node.
+ *
+ * The optional augment function is called for a node whenever one of its
+ * children changes, bottom-up, so it can be used to maintain extra
+ * information about each subtree (e.g. the largest free region within it).
+ */
+
+typedef struct tree_node
+{
+  struct tree_node *left, *right, *parent;
+  int height;
+} tree_node_t;
+
+typedef int (*tree_compare_t)(const void *left, const void *right);
+typedef void (*tree_augment_t)(tree_node_t *node);
+
+typedef struct
+{
+  tree_node_t *root;
+  tree_compare_t compare;
+  tree_augment_t augment;
+  int size;
+} tree_t;
+
+#define TREE_EMPTY(c) { .root = 0, .compare = (c), .augment = 0, .size = 0 }
+#define TREE_EMPTY_AUGMENTED(c, a) { .root = 0, .compare = (c), .augment = (a), .size = 0 }
+
+#define tree_for_each(tree, node) for (tree_node_t *node = tree_first(tree), *__next = node ? tree_next(node) : 0; node; node = __next, __next = node ? tree_next(node) : 0)
+
+void tree_init(tree_t *tree, tree_compare_t compare, tree_augment_t augment);
+void tree_insert(tree_t *tree, tree_node_t *node);
+void tree_remove(tree_t *tree, tree_node_t *node);
+
+/* re-runs the augment function on a node and all of its ancestors */
+void tree_update(tree_t *tree, tree_node_t *node);
+
+tree_node_t *tree_first(tree_t *tree);
+tree_node_t *tree_last(tree_t *tree);
+tree_node_t *tree_next(tree_node_t *node);
+tree_node_t *tree_prev(tree_node_t *node);
+
+/* finds a node equal to the key */
+tree_node_t *tree_find(tree_t *tree, const tree_node_t *key);
+
+/* finds the last node less than or equal to the key */
+tree_node_t *tree_floor(tree_t *tree, const tree_node_t *key);
+
+/* finds the first node greater than or equal to the key */
+tree_node_t *tree_ceil(tree_t *tree, const tree_node_t *key);
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/virtio/balloon.h>
+#include <arc/virtio/virtio.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/pmm.h>
+#include <arc/proc/kthread.h>
+#include <arc/proc/thread.h>
+#include <arc/panic.h>
+#include <arc/trace.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+
+/* the PCI device id of the transitional balloon device */
+#define BALLOON_DEVICE_ID 0x1002
+
+/* feature bits */
+#define BALLOON_F_MUST_TELL_HOST 0x01
+#define BALLOON_F_STATS_VQ       0x02
+#define BALLOON_F_FREE_PAGE_HINT 0x08
+#define BALLOON_F_REPORTING      0x20
+
+/* offsets in the device-specific configuration space */
+#define BALLOON_NUM_PAGES 0x0
+#define BALLOON_ACTUAL    0x4
+
+#define BALLOON_INFLATEQ 0
+#define BALLOON_DEFLATEQ 1
+
+/* the number of milliseconds between polls of the target size */
+#define BALLOON_INTERVAL 1000
+
+/* the most frames put in each inflate or deflate request */
+#define BALLOON_PFNS 256
+
+/* the most requests sent in one poll, so a large change doesn't hog a cpu */
+#define BALLOON_STEPS 64
+
+/* the most 2M frames reported at once, and the number of reports per poll */
+#define BALLOON_REPORT_FRAMES  64
+#define BALLOON_REPORT_WINDOWS 16
+
+static virtio_dev_t balloon_dev;
+static virtq_t balloon_inflateq, balloon_deflateq, balloon_reportq;
+static bool balloon_reporting;
+
+/* the buffer inflate and deflate requests are built in */
+static uint32_t *balloon_pfns;
+static uintptr_t balloon_pfns_phy;
+
+/* the frame number of every frame in the balloon */
+static uint32_t *balloon_frames;
+static uint64_t balloon_count, balloon_capacity;
+
+/*
+ * free frames are reported a window of physical memory at a time, so each
+ * one is only reported once per sweep rather than every time it is freed
+ */
+static uintptr_t balloon_report_cursor;
+static uintptr_t balloon_report_frames[BALLOON_REPORT_FRAMES];
+static size_t balloon_report_count, balloon_report_max;
+
+/* makes sure there is room to record 'pages' more frames in the balloon */
+static bool balloon_reserve(uint64_t pages)
+{
+  if (balloon_count + pages <= balloon_capacity)
+    return true;
+
+  uint64_t capacity = balloon_capacity ? balloon_capacity * 2 : FRAME_SIZE / sizeof(*balloon_frames);
+  while (capacity < balloon_count + pages)
+    capacity *= 2;
+
+  uint32_t *frames = realloc(balloon_frames, capacity * sizeof(*frames));
+  if (!frames)
+    return false;
+
+  balloon_frames = frames;
+  balloon_capacity = capacity;
+  return true;
+}
+
+static bool balloon_inflate(uint64_t pages)
+{
+  if (pages > BALLOON_PFNS)
+    pages = BALLOON_PFNS;
+
+  if (!balloon_reserve(pages))
+    return false;
+
+  /* don't eat into the kernel's reserve to satisfy the host */
+  uint64_t count;
+  for (count = 0; count < pages; count++)
+  {
+    uintptr_t frame = pmm_alloc_user(SIZE_4K, 0);
+    if (!frame)
+      break;
+
+    balloon_pfns[count] = frame / FRAME_SIZE;
+  }
+
+  if (count == 0)
+    return false;
+
+  virtq_buf_t buf = { .addr = balloon_pfns_phy, .len = count * sizeof(*balloon_pfns), .write = false };
+  bool ok = virtq_submit(&balloon_inflateq, &buf, 1);
+
+  /*
+   * the frames go in the balloon even if the request failed, as the host may
+   * have taken them anyway
+   */
+  memcpy(&balloon_frames[balloon_count], balloon_pfns, count * sizeof(*balloon_pfns));
+  balloon_count += count;
+
+  return ok && count == pages;
+}
+
+static bool balloon_deflate(uint64_t pages)
+{
+  if (pages > BALLOON_PFNS)
+    pages = BALLOON_PFNS;
+
+  uint32_t *frames = &balloon_frames[balloon_count - pages];
+  memcpy(balloon_pfns, frames, pages * sizeof(*balloon_pfns));
+
+  /* the host must be told before the frames are used again */
+  virtq_buf_t buf = { .addr = balloon_pfns_phy, .len = pages * sizeof(*balloon_pfns), .write = false };
+  if (!virtq_submit(&balloon_deflateq, &buf, 1))
+    return false;
+
+  for (uint64_t i = 0; i < pages; i++)
+    pmm_free((uintptr_t) frames[i] * FRAME_SIZE);
+
+  balloon_count -= pages;
+  return true;
+}
+
+static void balloon_adjust(void)
+{
+  for (int step = 0; step < BALLOON_STEPS; step++)
+  {
+    uint64_t target = virtio_config_read32(&balloon_dev, BALLOON_NUM_PAGES);
+
+    bool ok;
+    if (target > balloon_count)
+      ok = balloon_inflate(target - balloon_count);
+    else if (target < balloon_count)
+      ok = balloon_deflate(balloon_count - target);
+    else
+      break;
+
+    virtio_config_write32(&balloon_dev, BALLOON_ACTUAL, balloon_count);
+
+    if (!ok)
+      break;
+  }
+}
+
+static bool balloon_report_filter(uintptr_t addr, int size, void *arg)
+{
+  uintptr_t end = balloon_report_cursor + balloon_report_max * FRAME_SIZE_2M;
+  if (size != SIZE_2M || addr < balloon_report_cursor || addr >= end)
+    return false;
+
+  balloon_report_frames[balloon_report_count++] = addr;
+  return true;
+}
+
+static void balloon_report(void)
+{
+  for (int window = 0; window < BALLOON_REPORT_WINDOWS; window++)
+  {
+    /* only give memory to the host if we aren't short of it ourselves */
+    if (pmm_shortfall() > 0)
+      return;
+
+    /* the window is small enough that every frame in it fits in one report */
+    balloon_report_count = 0;
+    pmm_filter(&balloon_report_filter, 0);
+
+    balloon_report_cursor += balloon_report_max * FRAME_SIZE_2M;
+    if (balloon_report_cursor >= pmm_end())
+      balloon_report_cursor = 0;
+
+    if (balloon_report_count == 0)
+      continue;
+
+    virtq_buf_t bufs[BALLOON_REPORT_FRAMES];
+    for (size_t i = 0; i < balloon_report_count; i++)
+    {
+      bufs[i].addr = balloon_report_frames[i];
+      bufs[i].len = FRAME_SIZE_2M;
+      bufs[i].write = true;
+    }
+
+    /*
+     * if the device didn't respond it may still be discarding the frames, so
+     * they can't safely be used again
+     */
+    if (!virtq_submit(&balloon_reportq, bufs, balloon_report_count))
+      return;
+
+    for (size_t i = 0; i < balloon_report_count; i++)
+      pmm_frees(SIZE_2M, balloon_report_frames[i]);
+  }
+}
+
+static noreturn void balloon_daemon(void)
+{
+  for (;;)
+  {
+    balloon_adjust();
+
+    if (balloon_reporting)
+      balloon_report();
+
+    thread_sleep(BALLOON_INTERVAL);
+  }
+}
+
+void balloon_init(void)
+{
+  if (!virtio_init(&balloon_dev, BALLOON_DEVICE_ID))
+    return;
+
+  uint32_t host_features = virtio_host_features(&balloon_dev);
+  virtio_negotiate(&balloon_dev, BALLOON_F_MUST_TELL_HOST | BALLOON_F_REPORTING);
+
+  if (!virtq_init(&balloon_inflateq, &balloon_dev, BALLOON_INFLATEQ) || !virtq_init(&balloon_deflateq, &balloon_dev, BALLOON_DEFLATEQ))
+    goto fail;
+
+  /*
+   * the reporting queue comes after the stats and free page hint queues, if
+   * the device has them - even though we don't use them
+   */
+  if (balloon_dev.features & BALLOON_F_REPORTING)
+  {
+    uint16_t index = BALLOON_DEFLATEQ + 1;
+    if (host_features & BALLOON_F_STATS_VQ)
+      index++;
+    if (host_features & BALLOON_F_FREE_PAGE_HINT)
+      index++;
+
+    if (!virtq_init(&balloon_reportq, &balloon_dev, index))
+      goto fail;
+
+    balloon_report_max = balloon_reportq.size < BALLOON_REPORT_FRAMES ? balloon_reportq.size : BALLOON_REPORT_FRAMES;
+    balloon_reporting = true;
+  }
+
+  balloon_pfns_phy = pmm_alloc();
+  if (!balloon_pfns_phy)
+    goto fail;
+
+  balloon_pfns = mmio_map_frame(balloon_pfns_phy);
+  if (!balloon_pfns)
+    goto fail;
+
+  virtio_ready(&balloon_dev);
+
+  if (!kthread_create(&balloon_daemon))
+    panic("couldn't create balloon thread");
+
+  trace_printf("virtio-balloon: found device%s\n", balloon_reporting ? " with free page reporting" : "");
+  return;
+
+fail:
+  virtio_fail(&balloon_dev);
+  trace_puts("virtio-balloon: couldn't set up device\n");
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_VIRTIO_BALLOON_H
+#define ARC_VIRTIO_BALLOON_H
+
+/*
+ * A driver for the virtio memory balloon, which lets the host take memory
+ * back from the guest and give it back later. A kernel thread polls the
+ * target size set by the host, inflating the balloon by taking frames from
+ * the PMM and handing them to the host, or deflating it by doing the reverse.
+ *
+ * If the host supports free page reporting, the thread also tells it about
+ * free 2M frames, so it can discard their contents until they are next used.
+ */
+void balloon_init(void);
+
+#endif
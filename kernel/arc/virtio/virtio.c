@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arc/virtio/virtio.h>
+#include <arc/mm/align.h>
+#include <arc/mm/mmio.h>
+#include <arc/mm/pmm.h>
+#include <arc/cpu/pause.h>
+#include <arc/cpu/port.h>
+#include <arc/lock/barrier.h>
+#include <string.h>
+
+/* legacy register offsets, relative to the start of BAR0 */
+#define VIRTIO_PCI_HOST_FEATURES  0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN      0x08
+#define VIRTIO_PCI_QUEUE_SIZE     0x0C
+#define VIRTIO_PCI_QUEUE_SELECT   0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10
+#define VIRTIO_PCI_STATUS         0x12
+#define VIRTIO_PCI_ISR            0x13
+#define VIRTIO_PCI_CONFIG         0x14 /* MSI-X is never enabled */
+
+/* the legacy transport aligns the used ring to a page boundary */
+#define VIRTQ_ALIGN FRAME_SIZE
+
+/* the number of times to check for a used buffer before giving up */
+#define VIRTQ_POLL_LIMIT 100000000
+
+bool virtio_init(virtio_dev_t *dev, uint16_t device_id)
+{
+  if (!pci_find(VIRTIO_PCI_VENDOR, device_id, &dev->pci))
+    return false;
+
+  uint32_t bar = pci_read32(dev->pci, PCI_BAR0);
+  if (!(bar & PCI_BAR_IO))
+    return false;
+
+  dev->io = bar & PCI_BAR_IO_MASK;
+  dev->features = 0;
+
+  uint16_t command = pci_read16(dev->pci, PCI_COMMAND);
+  pci_write16(dev->pci, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  /* reset the device, then tell it we have found it and know how to drive it */
+  outb(dev->io + VIRTIO_PCI_STATUS, 0);
+  outb(dev->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK);
+  outb(dev->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+  return true;
+}
+
+uint32_t virtio_host_features(virtio_dev_t *dev)
+{
+  return inl(dev->io + VIRTIO_PCI_HOST_FEATURES);
+}
+
+void virtio_negotiate(virtio_dev_t *dev, uint32_t features)
+{
+  dev->features = virtio_host_features(dev) & features;
+  outl(dev->io + VIRTIO_PCI_GUEST_FEATURES, dev->features);
+}
+
+/*
+ * allocates physically contiguous memory for a queue. the PMM can't do this
+ * for 4K frames directly, so larger queues take a 2M frame and give back the
+ * part they don't need
+ */
+static uintptr_t virtq_alloc(size_t len)
+{
+  if (len <= FRAME_SIZE)
+    return pmm_alloc();
+
+  if (len > FRAME_SIZE_2M)
+    return 0;
+
+  uintptr_t frame = pmm_allocs(SIZE_2M);
+  if (!frame)
+    return 0;
+
+  for (uintptr_t off = PAGE_ALIGN(len); off < FRAME_SIZE_2M; off += FRAME_SIZE)
+    pmm_free(frame + off);
+
+  return frame;
+}
+
+bool virtq_init(virtq_t *vq, virtio_dev_t *dev, uint16_t index)
+{
+  outw(dev->io + VIRTIO_PCI_QUEUE_SELECT, index);
+
+  /* the legacy transport doesn't let the driver pick the size */
+  uint16_t size = inw(dev->io + VIRTIO_PCI_QUEUE_SIZE);
+  if (size == 0)
+    return false;
+
+  size_t avail_off = size * sizeof(virtq_desc_t);
+  size_t used_off = avail_off + sizeof(virtq_avail_t) + (size + 1) * sizeof(uint16_t);
+  used_off = (used_off + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+  size_t len = used_off + sizeof(virtq_used_t) + size * sizeof(virtq_used_elem_t) + sizeof(uint16_t);
+  len = PAGE_ALIGN(len);
+
+  uintptr_t phy = virtq_alloc(len);
+  if (!phy)
+    return false;
+
+  uintptr_t virt = (uintptr_t) mmio_map(phy, len, VM_R | VM_W);
+  if (!virt)
+  {
+    /* the device hasn't been told about the frames yet, so they can go back */
+    for (uintptr_t off = 0; off < len; off += FRAME_SIZE)
+      pmm_free(phy + off);
+
+    return false;
+  }
+
+  memclr((void *) virt, len);
+
+  vq->dev = dev;
+  vq->index = index;
+  vq->size = size;
+  vq->last_used = 0;
+  vq->broken = false;
+  vq->desc = (volatile virtq_desc_t *) virt;
+  vq->avail = (volatile virtq_avail_t *) (virt + avail_off);
+  vq->used = (volatile virtq_used_t *) (virt + used_off);
+
+  /* we poll for used buffers, so interrupts aren't needed */
+  vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+  outl(dev->io + VIRTIO_PCI_QUEUE_PFN, phy / FRAME_SIZE);
+  return true;
+}
+
+void virtio_ready(virtio_dev_t *dev)
+{
+  uint8_t status = inb(dev->io + VIRTIO_PCI_STATUS);
+  outb(dev->io + VIRTIO_PCI_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_dev_t *dev)
+{
+  uint8_t status = inb(dev->io + VIRTIO_PCI_STATUS);
+  outb(dev->io + VIRTIO_PCI_STATUS, status | VIRTIO_STATUS_FAILED);
+}
+
+uint32_t virtio_config_read32(virtio_dev_t *dev, uint16_t off)
+{
+  return inl(dev->io + VIRTIO_PCI_CONFIG + off);
+}
+
+void virtio_config_write32(virtio_dev_t *dev, uint16_t off, uint32_t value)
+{
+  outl(dev->io + VIRTIO_PCI_CONFIG + off, value);
+}
+
+bool virtq_submit(virtq_t *vq, const virtq_buf_t *bufs, size_t count)
+{
+  if (vq->broken || count == 0 || count > vq->size)
+    return false;
+
+  /* only one request is in flight at once, so it always starts at desc 0 */
+  for (size_t i = 0; i < count; i++)
+  {
+    volatile virtq_desc_t *desc = &vq->desc[i];
+    desc->addr = bufs[i].addr;
+    desc->len = bufs[i].len;
+    desc->flags = (bufs[i].write ? VIRTQ_DESC_F_WRITE : 0) | (i + 1 < count ? VIRTQ_DESC_F_NEXT : 0);
+    desc->next = i + 1;
+  }
+
+  uint16_t idx = vq->avail->idx;
+  vq->avail->ring[idx % vq->size] = 0;
+
+  /* the device must see the descriptors before the new index */
+  barrier();
+  vq->avail->idx = idx + 1;
+  barrier();
+
+  outw(vq->dev->io + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+
+  for (uint64_t i = 0; i < VIRTQ_POLL_LIMIT; i++)
+  {
+    if (vq->used->idx != vq->last_used)
+    {
+      vq->last_used++;
+      barrier();
+      return true;
+    }
+
+    pause_once();
+  }
+
+  vq->broken = true;
+  return false;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2011-2014 Graham Edgecombe <graham@grahamedgecombe.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARC_VIRTIO_VIRTIO_H
+#define ARC_VIRTIO_VIRTIO_H
+
+#include <arc/bus/pci.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A minimal driver for the legacy virtio PCI transport, which is accessed
+ * through the I/O ports in BAR0. Queues are polled rather than interrupt
+ * driven: virtq_submit() waits for the device to use each request before
+ * returning, so there is only ever one request in flight on a queue.
+ */
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+/* device status bits */
+#define VIRTIO_STATUS_ACK       0x01
+#define VIRTIO_STATUS_DRIVER    0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED    0x80
+
+/* descriptor flags */
+#define VIRTQ_DESC_F_NEXT  0x1
+#define VIRTQ_DESC_F_WRITE 0x2
+
+/* tells the device not to interrupt us when it uses a buffer */
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x1
+
+typedef struct
+{
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((__packed__)) virtq_desc_t;
+
+typedef struct
+{
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+} __attribute__((__packed__)) virtq_avail_t;
+
+typedef struct
+{
+  uint32_t id;
+  uint32_t len;
+} __attribute__((__packed__)) virtq_used_elem_t;
+
+typedef struct
+{
+  uint16_t flags;
+  uint16_t idx;
+  virtq_used_elem_t ring[];
+} __attribute__((__packed__)) virtq_used_t;
+
+typedef struct
+{
+  pci_addr_t pci;
+  uint16_t io;       /* the base of the I/O port range in BAR0 */
+  uint32_t features; /* the features both sides agreed on */
+} virtio_dev_t;
+
+typedef struct
+{
+  virtio_dev_t *dev;
+  uint16_t index, size;
+  uint16_t last_used;
+  bool broken; /* set if the device stopped responding */
+
+  volatile virtq_desc_t *desc;
+  volatile virtq_avail_t *avail;
+  volatile virtq_used_t *used;
+} virtq_t;
+
+/* a physically contiguous buffer in a request */
+typedef struct
+{
+  uintptr_t addr;
+  uint32_t len;
+  bool write; /* if the device writes to the buffer, rather than reading it */
+} virtq_buf_t;
+
+/*
+ * Finds the first legacy virtio device with the given PCI device id, resets
+ * it and acknowledges it. Returns false if there isn't one.
+ */
+bool virtio_init(virtio_dev_t *dev, uint16_t device_id);
+
+/* returns the features offered by the device */
+uint32_t virtio_host_features(virtio_dev_t *dev);
+
+/* accepts the offered features in 'features', setting dev->features */
+void virtio_negotiate(virtio_dev_t *dev, uint32_t features);
+
+/* sets up one of the device's queues, which must be done before virtio_ready() */
+bool virtq_init(virtq_t *vq, virtio_dev_t *dev, uint16_t index);
+
+/* tells the device the driver is ready, or that it has given up on it */
+void virtio_ready(virtio_dev_t *dev);
+void virtio_fail(virtio_dev_t *dev);
+
+/* accesses the device-specific configuration space */
+uint32_t virtio_config_read32(virtio_dev_t *dev, uint16_t off);
+void virtio_config_write32(virtio_dev_t *dev, uint16_t off, uint32_t value);
+
+/*
+ * Submits a chain of buffers and waits for the device to use them. Returns
+ * false if there are too many buffers, or the device doesn't respond - in
+ * which case the queue is marked as broken, as the device may still own them.
+ */
+bool virtq_submit(virtq_t *vq, const virtq_buf_t *bufs, size_t count);
+
+#endif
@@ -4538,6 +4538,19 @@ int mspace_mallopt(int param_number, int value) {
   return change_mparam(param_number, value);
 }
 
+#if FOOTERS
+/* Arc: find the mspace a chunk was allocated from (see arc/mm/malloc.c) */
+mspace mspace_owner(void* mem) {
+  mchunkptr p = mem2chunk(mem);
+  mstate ms = get_mstate_for(p);
+  if (!ok_magic(ms)) {
+    USAGE_ERROR_ACTION(ms,p);
+    return 0;
+  }
+  return (mspace)ms;
+}
+#endif /* FOOTERS */
+
 #endif /* MSPACES */
 
 
@@ -19,8 +19,5 @@
 
 void *calloc(size_t num, size_t size)
 {
-  spin_lock(&malloc_lock);
-  void *ptr = dlcalloc(num, size);
-  spin_unlock(&malloc_lock);
-  return ptr;
+  return mspace_calloc(malloc_mspace(), num, size);
 }
@@ -19,7 +19,5 @@
 
 void free(void *ptr)
 {
-  spin_lock(&malloc_lock);
-  dlfree(ptr);
-  spin_unlock(&malloc_lock);
+  malloc_free(ptr);
 }
@@ -19,8 +19,5 @@
 
 void *malloc(size_t size)
 {
-  spin_lock(&malloc_lock);
-  void *ptr = dlmalloc(size);
-  spin_unlock(&malloc_lock);
-  return ptr;
+  return mspace_malloc(malloc_mspace(), size);
 }
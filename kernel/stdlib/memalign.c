@@ -19,8 +19,5 @@
 
 void *memalign(size_t alignment, size_t size)
 {
-  spin_lock(&malloc_lock);
-  void *ptr = dlmemalign(alignment, size);
-  spin_unlock(&malloc_lock);
-  return ptr;
+  return mspace_memalign(malloc_mspace(), alignment, size);
 }
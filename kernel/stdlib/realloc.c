@@ -19,8 +19,6 @@
 
 void *realloc(void *ptr, size_t size)
 {
-  spin_lock(&malloc_lock);
-  ptr = dlrealloc(ptr, size);
-  spin_unlock(&malloc_lock);
-  return ptr;
+  /* with FOOTERS, an existing chunk is resized within its own mspace */
+  return mspace_realloc(malloc_mspace(), ptr, size);
 }
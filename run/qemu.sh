@@ -2,4 +2,5 @@
 BASEDIR=`dirname $0`
 cd $BASEDIR
 ./image.sh
-qemu-system-x86_64 -smp 2 -m 128 -monitor stdio -hda disk.img
+qemu-system-x86_64 -smp 2 -m 128 -monitor stdio -hda disk.img \
+  -device virtio-balloon-pci,free-page-reporting=on